@@ -54,18 +54,56 @@ ASTNode::~ASTNode() {
 ///////////////////////////////////////////////////////////////////////////
 // AST
 
+AST::AST() {
+    numStdlibFunctions = 0;
+    stdlibMarked = false;
+}
+
+
 void
 AST::AddFunction(Symbol *sym, Stmt *code) {
     if (sym == NULL)
         return;
-    functions.push_back(new Function(sym, code));
+    functions.push_back(new Function(sym, code, !stdlibMarked));
+}
+
+
+void
+AST::MarkStdlibFunctions() {
+    numStdlibFunctions = functions.size();
+    stdlibMarked = true;
 }
 
 
 void
 AST::GenerateIR() {
-    for (unsigned int i = 0; i < functions.size(); ++i)
+    for (unsigned int i = numStdlibFunctions; i < functions.size(); ++i)
         functions[i]->GenerateIR();
+
+    // Most programs only use a handful of the standard library's
+    // functions, so rather than generating IR for all of them and then
+    // having the optimizer throw most of it away, we only generate IR for
+    // the ones that the code emitted so far refers to.  Doing so may
+    // introduce references to other standard library functions, so keep
+    // going until no more are needed.
+    std::vector<bool> generated(numStdlibFunctions, false);
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (unsigned int i = 0; i < numStdlibFunctions; ++i) {
+            if (!generated[i] && functions[i]->IsReferenced()) {
+                functions[i]->GenerateIR();
+                generated[i] = true;
+                progress = true;
+            }
+        }
+    }
+
+    // The rest are never called; get rid of their (internal, and thus
+    // otherwise invalid) declarations.
+    for (unsigned int i = 0; i < numStdlibFunctions; ++i)
+        if (!generated[i])
+            functions[i]->EraseDeclaration();
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -143,16 +143,26 @@ public:
 
 class AST {
 public:
+    AST();
+
     /** Add the AST for a function described by the given declaration
         information and source code. */
     void AddFunction(Symbol *sym, Stmt *code);
 
+    /** Indicates that all of the functions added so far come from the
+        standard library.  Type checking of their code is deferred until
+        IR is generated for them. */
+    void MarkStdlibFunctions();
+
     /** Generate LLVM IR for all of the functions into the current
-        module. */
+        module.  IR for standard library functions is only generated for
+        the ones that are actually referenced. */
     void GenerateIR();
 
 private:
     std::vector<Function *> functions;
+    unsigned int numStdlibFunctions;
+    bool stdlibMarked;
 };
 
 
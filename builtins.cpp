@@ -458,8 +458,10 @@ lSetInternalFunctions(llvm::Module *module) {
         "__count_leading_zeros_i64",
         "__delete_uniform_32rt",
         "__delete_uniform_64rt",
+        "__delete_uniform_hook",
         "__delete_varying_32rt",
         "__delete_varying_64rt",
+        "__delete_varying_hook",
         "__do_assert_uniform",
         "__do_assert_varying",
         "__do_print",
@@ -474,6 +476,18 @@ lSetInternalFunctions(llvm::Module *module) {
         "__exclusive_scan_add_i64",
         "__exclusive_scan_and_i32",
         "__exclusive_scan_and_i64",
+        "__exclusive_scan_max_double",
+        "__exclusive_scan_max_float",
+        "__exclusive_scan_max_int32",
+        "__exclusive_scan_max_int64",
+        "__exclusive_scan_max_uint32",
+        "__exclusive_scan_max_uint64",
+        "__exclusive_scan_min_double",
+        "__exclusive_scan_min_float",
+        "__exclusive_scan_min_int32",
+        "__exclusive_scan_min_int64",
+        "__exclusive_scan_min_uint32",
+        "__exclusive_scan_min_uint64",
         "__exclusive_scan_or_i32",
         "__exclusive_scan_or_i64",
         "__extract_int16",
@@ -498,6 +512,26 @@ lSetInternalFunctions(llvm::Module *module) {
         "__get_system_isa",
         "__half_to_float_uniform",
         "__half_to_float_varying",
+        "__inclusive_scan_add_double",
+        "__inclusive_scan_add_float",
+        "__inclusive_scan_add_i32",
+        "__inclusive_scan_add_i64",
+        "__inclusive_scan_and_i32",
+        "__inclusive_scan_and_i64",
+        "__inclusive_scan_max_double",
+        "__inclusive_scan_max_float",
+        "__inclusive_scan_max_int32",
+        "__inclusive_scan_max_int64",
+        "__inclusive_scan_max_uint32",
+        "__inclusive_scan_max_uint64",
+        "__inclusive_scan_min_double",
+        "__inclusive_scan_min_float",
+        "__inclusive_scan_min_int32",
+        "__inclusive_scan_min_int64",
+        "__inclusive_scan_min_uint32",
+        "__inclusive_scan_min_uint64",
+        "__inclusive_scan_or_i32",
+        "__inclusive_scan_or_i64",
         "__insert_int16",
         "__insert_int32",
         "__insert_int64",
@@ -547,13 +581,26 @@ lSetInternalFunctions(llvm::Module *module) {
 //#endif /* ISPC_NVPTX_ENABLED */
         "__new_uniform_32rt",
         "__new_uniform_64rt",
+        "__new_uniform_hook",
         "__new_varying32_32rt",
         "__new_varying32_64rt",
+        "__new_varying32_hook",
         "__new_varying64_64rt",
+        "__new_varying64_hook",
         "__none",
         "__num_cores",
         "__packed_load_active",
+        "__packed_load_active_double",
+        "__packed_load_active_float",
+        "__packed_load_active_i16",
+        "__packed_load_active_i64",
+        "__packed_load_active_i8",
         "__packed_store_active",
+        "__packed_store_active_double",
+        "__packed_store_active_float",
+        "__packed_store_active_i16",
+        "__packed_store_active_i64",
+        "__packed_store_active_i8",
         "__packed_store_active2",
         "__padds_vi8",
         "__padds_vi16",
@@ -616,6 +663,14 @@ lSetInternalFunctions(llvm::Module *module) {
         "__rsqrt_varying_float",
         "__rsqrt_uniform_double",
         "__rsqrt_varying_double",
+        "__segmented_exclusive_scan_add_double",
+        "__segmented_exclusive_scan_add_float",
+        "__segmented_exclusive_scan_add_i32",
+        "__segmented_exclusive_scan_add_i64",
+        "__segmented_inclusive_scan_add_double",
+        "__segmented_inclusive_scan_add_float",
+        "__segmented_inclusive_scan_add_i32",
+        "__segmented_inclusive_scan_add_i64",
         "__set_system_isa",
         "__sext_uniform_bool",
         "__sext_varying_bool",
@@ -676,6 +731,13 @@ lSetInternalFunctions(llvm::Module *module) {
         "__stdlib_sinf",
         "__stdlib_tan",
         "__stdlib_tanf",
+        "__streaming_store_fence",
+        "__streaming_store_uniform_double",
+        "__streaming_store_uniform_float",
+        "__streaming_store_uniform_i16",
+        "__streaming_store_uniform_i32",
+        "__streaming_store_uniform_i64",
+        "__streaming_store_uniform_i8",
         "__svml_sind",
         "__svml_asind",
         "__svml_cosd",
@@ -38,6 +38,7 @@
 
 ctlztz()
 define_prefetches()
+define_streaming_stores(32, sfence)
 define_shuffles()
 aossoa()
 
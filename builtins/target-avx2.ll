@@ -30,6 +30,8 @@
 ;;   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
 
 define(`HAVE_GATHER', `1')
+define(`HAVE_PACKED_32', `1')
+define(`HAVE_PACKED_64', `1')
 
 include(`target-avx.ll')
 
@@ -106,6 +108,188 @@ define i16 @__float_to_half_uniform(float %v) nounwind readnone {
   ret i16 %r
 }
 
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;; packed load/store
+;;
+;; Rather than going lane by lane, the values are moved between the active
+;; lanes and consecutive lanes with a single vpermd, with the permutation
+;; for the mask coming from a table, and vpmaskmov reads or writes just as
+;; many elements as there are active lanes.  64-bit elements are done in
+;; two halves of four lanes each.
+
+@__packed_store_perm8 = internal constant [256 x i32] [
+  forloop(i, 0, 254, `i32 packed_store_perm(i, 8), ') i32 packed_store_perm(255, 8) ]
+@__packed_load_perm8 = internal constant [256 x i32] [
+  forloop(i, 0, 254, `i32 packed_load_perm(i, 8), ') i32 packed_load_perm(255, 8) ]
+@__packed_store_perm4 = internal constant [16 x i32] [
+  forloop(i, 0, 14, `i32 packed_store_perm(i, 4), ') i32 packed_store_perm(15, 4) ]
+@__packed_load_perm4 = internal constant [16 x i32] [
+  forloop(i, 0, 14, `i32 packed_load_perm(i, 4), ') i32 packed_load_perm(15, 4) ]
+
+declare <8 x i32> @llvm.x86.avx2.permd(<8 x i32>, <8 x i32>) nounwind readnone
+declare <8 x i32> @llvm.x86.avx2.maskload.d.256(i8 *, <8 x i32>) nounwind readonly
+declare <4 x i64> @llvm.x86.avx2.maskload.q.256(i8 *, <4 x i64>) nounwind readonly
+declare void @llvm.x86.avx2.maskstore.d.256(i8 *, <8 x i32>, <8 x i32>) nounwind
+declare void @llvm.x86.avx2.maskstore.q.256(i8 *, <4 x i64>, <4 x i64>) nounwind
+
+;; vpermd indices for 8 32-bit lanes from a table entry
+define internal <8 x i32> @__packed_perm8([256 x i32] * %table, i64 %mask) nounwind alwaysinline {
+  %ptr = getelementptr PTR_OP_ARGS(`[256 x i32]') %table, i64 0, i64 %mask
+  %fields = load PTR_OP_ARGS(`i32 ') %ptr
+  %fields_vec = insertelement <8 x i32> undef, i32 %fields, i32 0
+  %fields_splat = shufflevector <8 x i32> %fields_vec, <8 x i32> undef, <8 x i32> zeroinitializer
+  %shifted = lshr <8 x i32> %fields_splat,
+                   <i32 0, i32 4, i32 8, i32 12, i32 16, i32 20, i32 24, i32 28>
+  %perm = and <8 x i32> %shifted, <i32 7, i32 7, i32 7, i32 7, i32 7, i32 7, i32 7, i32 7>
+  ret <8 x i32> %perm
+}
+
+;; vpermd indices for 4 64-bit lanes (as pairs of 32-bit lanes) from a
+;; table entry
+define internal <8 x i32> @__packed_perm4x2([16 x i32] * %table, i64 %mask) nounwind alwaysinline {
+  %ptr = getelementptr PTR_OP_ARGS(`[16 x i32]') %table, i64 0, i64 %mask
+  %fields = load PTR_OP_ARGS(`i32 ') %ptr
+  %fields_vec = insertelement <8 x i32> undef, i32 %fields, i32 0
+  %fields_splat = shufflevector <8 x i32> %fields_vec, <8 x i32> undef, <8 x i32> zeroinitializer
+  %shifted = lshr <8 x i32> %fields_splat,
+                   <i32 0, i32 0, i32 4, i32 4, i32 8, i32 8, i32 12, i32 12>
+  %lanes = and <8 x i32> %shifted, <i32 3, i32 3, i32 3, i32 3, i32 3, i32 3, i32 3, i32 3>
+  %lanes2 = shl <8 x i32> %lanes, <i32 1, i32 1, i32 1, i32 1, i32 1, i32 1, i32 1, i32 1>
+  %perm = or <8 x i32> %lanes2, <i32 0, i32 1, i32 0, i32 1, i32 0, i32 1, i32 0, i32 1>
+  ret <8 x i32> %perm
+}
+
+;; vpmaskmov masks for the first %count lanes
+define internal <8 x i32> @__packed_first8(i32 %count) nounwind readnone alwaysinline {
+  %count_vec = insertelement <8 x i32> undef, i32 %count, i32 0
+  %count_splat = shufflevector <8 x i32> %count_vec, <8 x i32> undef, <8 x i32> zeroinitializer
+  %on = icmp ult <8 x i32> <i32 0, i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7>, %count_splat
+  %m = sext <8 x i1> %on to <8 x i32>
+  ret <8 x i32> %m
+}
+
+define internal <4 x i64> @__packed_first4(i32 %count) nounwind readnone alwaysinline {
+  %count_vec = insertelement <4 x i32> undef, i32 %count, i32 0
+  %count_splat = shufflevector <4 x i32> %count_vec, <4 x i32> undef, <4 x i32> zeroinitializer
+  %on = icmp ult <4 x i32> <i32 0, i32 1, i32 2, i32 3>, %count_splat
+  %m = sext <4 x i1> %on to <4 x i64>
+  ret <4 x i64> %m
+}
+
+;; Pack or unpack one half of a vector of 64-bit values; returns the
+;; number of values stored/loaded.
+define internal i32 @__packed_store4_i64(i64 * %ptr, <4 x i64> %vals,
+                                         i64 %mask) nounwind alwaysinline {
+  %count64 = call i64 @llvm.ctpop.i64(i64 %mask)
+  %count = trunc i64 %count64 to i32
+  %perm = call <8 x i32> @__packed_perm4x2([16 x i32] * @__packed_store_perm4, i64 %mask)
+  %vals32 = bitcast <4 x i64> %vals to <8 x i32>
+  %packed32 = call <8 x i32> @llvm.x86.avx2.permd(<8 x i32> %vals32, <8 x i32> %perm)
+  %packed = bitcast <8 x i32> %packed32 to <4 x i64>
+  %storemask = call <4 x i64> @__packed_first4(i32 %count)
+  %ptr8 = bitcast i64 * %ptr to i8 *
+  call void @llvm.x86.avx2.maskstore.q.256(i8 * %ptr8, <4 x i64> %storemask, <4 x i64> %packed)
+  ret i32 %count
+}
+
+define internal <4 x i64> @__packed_load4_i64(i64 * %ptr, i64 %mask,
+                                              i32 %count) nounwind alwaysinline {
+  %loadmask = call <4 x i64> @__packed_first4(i32 %count)
+  %ptr8 = bitcast i64 * %ptr to i8 *
+  %packed = call <4 x i64> @llvm.x86.avx2.maskload.q.256(i8 * %ptr8, <4 x i64> %loadmask)
+  %perm = call <8 x i32> @__packed_perm4x2([16 x i32] * @__packed_load_perm4, i64 %mask)
+  %packed32 = bitcast <4 x i64> %packed to <8 x i32>
+  %spread32 = call <8 x i32> @llvm.x86.avx2.permd(<8 x i32> %packed32, <8 x i32> %perm)
+  %spread = bitcast <8 x i32> %spread32 to <4 x i64>
+  ret <4 x i64> %spread
+}
+
+; $1: element type
+; $2: suffix for the function names
+
+define(`packed_load_and_store_permd32', `
+define i32 @__packed_load_active$2($1 * %startptr, <8 x $1> * %val_ptr,
+                                   <8 x i32> %full_mask) nounwind alwaysinline {
+  %mask = call i64 @__movmsk(<8 x i32> %full_mask)
+  %count64 = call i64 @llvm.ctpop.i64(i64 %mask)
+  %count = trunc i64 %count64 to i32
+  %loadmask = call <8 x i32> @__packed_first8(i32 %count)
+  %ptr = bitcast $1 * %startptr to i8 *
+  %packed = call <8 x i32> @llvm.x86.avx2.maskload.d.256(i8 * %ptr, <8 x i32> %loadmask)
+  %perm = call <8 x i32> @__packed_perm8([256 x i32] * @__packed_load_perm8, i64 %mask)
+  %spread = call <8 x i32> @llvm.x86.avx2.permd(<8 x i32> %packed, <8 x i32> %perm)
+  %spread_typed = bitcast <8 x i32> %spread to <8 x $1>
+  %old = load PTR_OP_ARGS(`<8 x $1> ') %val_ptr, align 4
+  %m = icmp ne <8 x i32> %full_mask, zeroinitializer
+  %result = select <8 x i1> %m, <8 x $1> %spread_typed, <8 x $1> %old
+  store <8 x $1> %result, <8 x $1> * %val_ptr, align 4
+  ret i32 %count
+}
+
+define i32 @__packed_store_active$2($1 * %startptr, <8 x $1> %vals,
+                                    <8 x i32> %full_mask) nounwind alwaysinline {
+  %mask = call i64 @__movmsk(<8 x i32> %full_mask)
+  %count64 = call i64 @llvm.ctpop.i64(i64 %mask)
+  %count = trunc i64 %count64 to i32
+  %vals32 = bitcast <8 x $1> %vals to <8 x i32>
+  %perm = call <8 x i32> @__packed_perm8([256 x i32] * @__packed_store_perm8, i64 %mask)
+  %packed = call <8 x i32> @llvm.x86.avx2.permd(<8 x i32> %vals32, <8 x i32> %perm)
+  %storemask = call <8 x i32> @__packed_first8(i32 %count)
+  %ptr = bitcast $1 * %startptr to i8 *
+  call void @llvm.x86.avx2.maskstore.d.256(i8 * %ptr, <8 x i32> %storemask, <8 x i32> %packed)
+  ret i32 %count
+}
+')
+
+define(`packed_load_and_store_permd64', `
+define i32 @__packed_load_active$2($1 * %startptr, <8 x $1> * %val_ptr,
+                                   <8 x i32> %full_mask) nounwind alwaysinline {
+  %mask = call i64 @__movmsk(<8 x i32> %full_mask)
+  %mask0 = and i64 %mask, 15
+  %mask1 = lshr i64 %mask, 4
+  %count0_64 = call i64 @llvm.ctpop.i64(i64 %mask0)
+  %count0 = trunc i64 %count0_64 to i32
+  %count1_64 = call i64 @llvm.ctpop.i64(i64 %mask1)
+  %count1 = trunc i64 %count1_64 to i32
+  %ptr0 = bitcast $1 * %startptr to i64 *
+  %ptr1 = getelementptr PTR_OP_ARGS(`i64') %ptr0, i32 %count0
+  %spread0 = call <4 x i64> @__packed_load4_i64(i64 * %ptr0, i64 %mask0, i32 %count0)
+  %spread1 = call <4 x i64> @__packed_load4_i64(i64 * %ptr1, i64 %mask1, i32 %count1)
+  %spread = shufflevector <4 x i64> %spread0, <4 x i64> %spread1,
+                 <8 x i32> <i32 0, i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7>
+  %spread_typed = bitcast <8 x i64> %spread to <8 x $1>
+  %old = load PTR_OP_ARGS(`<8 x $1> ') %val_ptr, align 8
+  %m = icmp ne <8 x i32> %full_mask, zeroinitializer
+  %result = select <8 x i1> %m, <8 x $1> %spread_typed, <8 x $1> %old
+  store <8 x $1> %result, <8 x $1> * %val_ptr, align 8
+  %count = add i32 %count0, %count1
+  ret i32 %count
+}
+
+define i32 @__packed_store_active$2($1 * %startptr, <8 x $1> %vals,
+                                    <8 x i32> %full_mask) nounwind alwaysinline {
+  %mask = call i64 @__movmsk(<8 x i32> %full_mask)
+  %mask0 = and i64 %mask, 15
+  %mask1 = lshr i64 %mask, 4
+  %vals64 = bitcast <8 x $1> %vals to <8 x i64>
+  %vals0 = shufflevector <8 x i64> %vals64, <8 x i64> undef,
+                 <4 x i32> <i32 0, i32 1, i32 2, i32 3>
+  %vals1 = shufflevector <8 x i64> %vals64, <8 x i64> undef,
+                 <4 x i32> <i32 4, i32 5, i32 6, i32 7>
+  %ptr0 = bitcast $1 * %startptr to i64 *
+  %count0 = call i32 @__packed_store4_i64(i64 * %ptr0, <4 x i64> %vals0, i64 %mask0)
+  %ptr1 = getelementptr PTR_OP_ARGS(`i64') %ptr0, i32 %count0
+  %count1 = call i32 @__packed_store4_i64(i64 * %ptr1, <4 x i64> %vals1, i64 %mask1)
+  %count = add i32 %count0, %count1
+  ret i32 %count
+}
+')
+
+packed_load_and_store_permd32(i32, `')
+packed_load_and_store_permd32(float, _float)
+packed_load_and_store_permd64(i64, _i64)
+packed_load_and_store_permd64(double, _double)
+
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; gather
 
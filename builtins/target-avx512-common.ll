@@ -1188,32 +1188,136 @@ gen_scatter(double)
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; packed_load/store
 
-declare <16 x i32> @llvm.x86.avx512.mask.expand.load.d.512(i8* %addr, <16 x i32> %data, i16 %mask)
+; $1: element type
+; $2: suffix for the function names
+; $3: suffix of the expand/compress intrinsics
 
-define i32 @__packed_load_active(i32 * %startptr, <16 x i32> * %val_ptr,
+define(`packed_load_and_store_expand32', `
+declare <16 x $1> @llvm.x86.avx512.mask.expand.load.$3.512(i8* %addr, <16 x $1> %data, i16 %mask)
+
+define i32 @__packed_load_active$2($1 * %startptr, <16 x $1> * %val_ptr,
                                  <WIDTH x MASK> %full_mask) nounwind alwaysinline {
-  %addr = bitcast i32* %startptr to i8*
-  %data = load PTR_OP_ARGS(`<16 x i32> ') %val_ptr
+  %addr = bitcast $1* %startptr to i8*
+  %data = load PTR_OP_ARGS(`<16 x $1> ') %val_ptr
   %mask = call i16 @__cast_mask_to_i16 (<WIDTH x MASK> %full_mask)
-  %store_val = call <16 x i32> @llvm.x86.avx512.mask.expand.load.d.512(i8* %addr, <16 x i32> %data, i16 %mask)
-  store <16 x i32> %store_val, <16 x i32> * %val_ptr
+  %store_val = call <16 x $1> @llvm.x86.avx512.mask.expand.load.$3.512(i8* %addr, <16 x $1> %data, i16 %mask)
+  store <16 x $1> %store_val, <16 x $1> * %val_ptr
   %mask_i32 = zext i16 %mask to i32
   %res = call i32 @llvm.ctpop.i32(i32 %mask_i32)
   ret i32 %res
 }
 
-declare void @llvm.x86.avx512.mask.compress.store.d.512(i8* %addr, <16 x i32> %data, i16 %mask)
+declare void @llvm.x86.avx512.mask.compress.store.$3.512(i8* %addr, <16 x $1> %data, i16 %mask)
 
-define i32 @__packed_store_active(i32 * %startptr, <16 x i32> %vals,
+define i32 @__packed_store_active$2($1 * %startptr, <16 x $1> %vals,
                                    <WIDTH x MASK> %full_mask) nounwind alwaysinline {
-  %addr = bitcast i32* %startptr to i8*
+  %addr = bitcast $1* %startptr to i8*
+  %mask = call i16 @__cast_mask_to_i16 (<WIDTH x MASK> %full_mask)
+  call void @llvm.x86.avx512.mask.compress.store.$3.512(i8* %addr, <16 x $1> %vals, i16 %mask)
+  %mask_i32 = zext i16 %mask to i32
+  %res = call i32 @llvm.ctpop.i32(i32 %mask_i32)
+  ret i32 %res
+}
+')
+
+;; 64-bit values are done in two halves of 8 lanes; the second half goes
+;; right after however many values the first one stored.
+
+define(`packed_load_and_store_expand64', `
+declare <8 x $1> @llvm.x86.avx512.mask.expand.load.$3.512(i8* %addr, <8 x $1> %data, i8 %mask)
+
+define i32 @__packed_load_active$2($1 * %startptr, <16 x $1> * %val_ptr,
+                                 <WIDTH x MASK> %full_mask) nounwind alwaysinline {
+  %data = load PTR_OP_ARGS(`<16 x $1> ') %val_ptr
+  %data0 = shufflevector <16 x $1> %data, <16 x $1> undef,
+              <8 x i32> <i32 0, i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7>
+  %data1 = shufflevector <16 x $1> %data, <16 x $1> undef,
+              <8 x i32> <i32 8, i32 9, i32 10, i32 11, i32 12, i32 13, i32 14, i32 15>
   %mask = call i16 @__cast_mask_to_i16 (<WIDTH x MASK> %full_mask)
-  call void @llvm.x86.avx512.mask.compress.store.d.512(i8* %addr, <16 x i32> %vals, i16 %mask)
+  %mask0 = trunc i16 %mask to i8
+  %mask_hi = lshr i16 %mask, 8
+  %mask1 = trunc i16 %mask_hi to i8
+  %mask0_i32 = zext i8 %mask0 to i32
+  %count0 = call i32 @llvm.ctpop.i32(i32 %mask0_i32)
+  %addr0 = bitcast $1* %startptr to i8*
+  %ptr1 = getelementptr PTR_OP_ARGS(`$1') %startptr, i32 %count0
+  %addr1 = bitcast $1* %ptr1 to i8*
+  %val0 = call <8 x $1> @llvm.x86.avx512.mask.expand.load.$3.512(i8* %addr0, <8 x $1> %data0, i8 %mask0)
+  %val1 = call <8 x $1> @llvm.x86.avx512.mask.expand.load.$3.512(i8* %addr1, <8 x $1> %data1, i8 %mask1)
+  %store_val = shufflevector <8 x $1> %val0, <8 x $1> %val1,
+              <16 x i32> <i32 0, i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7,
+                          i32 8, i32 9, i32 10, i32 11, i32 12, i32 13, i32 14, i32 15>
+  store <16 x $1> %store_val, <16 x $1> * %val_ptr
   %mask_i32 = zext i16 %mask to i32
   %res = call i32 @llvm.ctpop.i32(i32 %mask_i32)
   ret i32 %res
 }
 
+declare void @llvm.x86.avx512.mask.compress.store.$3.512(i8* %addr, <8 x $1> %data, i8 %mask)
+
+define i32 @__packed_store_active$2($1 * %startptr, <16 x $1> %vals,
+                                   <WIDTH x MASK> %full_mask) nounwind alwaysinline {
+  %vals0 = shufflevector <16 x $1> %vals, <16 x $1> undef,
+              <8 x i32> <i32 0, i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7>
+  %vals1 = shufflevector <16 x $1> %vals, <16 x $1> undef,
+              <8 x i32> <i32 8, i32 9, i32 10, i32 11, i32 12, i32 13, i32 14, i32 15>
+  %mask = call i16 @__cast_mask_to_i16 (<WIDTH x MASK> %full_mask)
+  %mask0 = trunc i16 %mask to i8
+  %mask_hi = lshr i16 %mask, 8
+  %mask1 = trunc i16 %mask_hi to i8
+  %mask0_i32 = zext i8 %mask0 to i32
+  %count0 = call i32 @llvm.ctpop.i32(i32 %mask0_i32)
+  %addr0 = bitcast $1* %startptr to i8*
+  %ptr1 = getelementptr PTR_OP_ARGS(`$1') %startptr, i32 %count0
+  %addr1 = bitcast $1* %ptr1 to i8*
+  call void @llvm.x86.avx512.mask.compress.store.$3.512(i8* %addr0, <8 x $1> %vals0, i8 %mask0)
+  call void @llvm.x86.avx512.mask.compress.store.$3.512(i8* %addr1, <8 x $1> %vals1, i8 %mask1)
+  %mask_i32 = zext i16 %mask to i32
+  %res = call i32 @llvm.ctpop.i32(i32 %mask_i32)
+  ret i32 %res
+}
+')
+
+;; There is no compress for 8 and 16-bit elements in AVX-512F, so they are
+;; widened to 32 bits and compressed in a register, and the first count
+;; values are then narrowed and stored with vpmovdb/vpmovdw.  Loads use the
+;; generic lane-by-lane code.
+
+declare <16 x i32> @llvm.x86.avx512.mask.compress.d.512(<16 x i32> %data, <16 x i32> %src, i16 %mask)
+declare void @llvm.x86.avx512.mask.pmov.db.mem.512(i8* %addr, <16 x i32> %data, i16 %mask)
+declare void @llvm.x86.avx512.mask.pmov.dw.mem.512(i8* %addr, <16 x i32> %data, i16 %mask)
+
+; $1: element type
+; $2: suffix for the function names
+; $3: b or w, for the vpmov intrinsic
+
+define(`packed_store_compress_narrow', `
+define i32 @__packed_store_active$2($1 * %startptr, <16 x $1> %vals,
+                                   <WIDTH x MASK> %full_mask) nounwind alwaysinline {
+  %mask = call i16 @__cast_mask_to_i16 (<WIDTH x MASK> %full_mask)
+  %wide = sext <16 x $1> %vals to <16 x i32>
+  %packed = call <16 x i32> @llvm.x86.avx512.mask.compress.d.512(<16 x i32> %wide,
+                                     <16 x i32> zeroinitializer, i16 %mask)
+  %mask_i32 = zext i16 %mask to i32
+  %res = call i32 @llvm.ctpop.i32(i32 %mask_i32)
+  %first_bit = shl i32 1, %res
+  %first = sub i32 %first_bit, 1
+  %first_i16 = trunc i32 %first to i16
+  %addr = bitcast $1* %startptr to i8*
+  call void @llvm.x86.avx512.mask.pmov.d$3.mem.512(i8* %addr, <16 x i32> %packed, i16 %first_i16)
+  ret i32 %res
+}
+')
+
+packed_load_and_store_expand32(i32, `', d)
+packed_load_and_store_expand32(float, _float, ps)
+packed_load_and_store_expand64(i64, _i64, q)
+packed_load_and_store_expand64(double, _double, pd)
+packed_load_active_type(i8, _i8, 1)
+packed_load_active_type(i16, _i16, 2)
+packed_store_compress_narrow(i8, _i8, b)
+packed_store_compress_narrow(i16, _i16, w)
+
 define i32 @__packed_store_active2(i32 * %startptr, <16 x i32> %vals,
                                    <WIDTH x MASK> %full_mask) nounwind alwaysinline {
   %res = call i32 @__packed_store_active(i32 * %startptr, <16 x i32> %vals,
@@ -1226,6 +1330,11 @@ define i32 @__packed_store_active2(i32 * %startptr, <16 x i32> %vals,
 
 define_prefetches()
 
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;; streaming stores
+
+define_streaming_stores(64, sfence)
+
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; int8/int16 builtins
 
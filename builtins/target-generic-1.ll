@@ -1012,6 +1012,7 @@ define_shuffles()
 ctlztz()
 
 define_prefetches()
+define_regular_streaming_stores()
 
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; half conversion routines
@@ -361,6 +361,14 @@ declare i32 @__packed_store_active(i32 * nocapture, <WIDTH x i32> %vals,
 declare i32 @__packed_store_active2(i32 * nocapture, <WIDTH x i32> %vals,
                                    <WIDTH x i1>) nounwind
 
+;; The packed loads and stores for the other element types aren't provided
+;; by the C++ headers; use the ones from util.m4 for them.
+packed_load_and_store_type(float, _float, 4)
+packed_load_and_store_type(i64, _i64, 8)
+packed_load_and_store_type(double, _double, 8)
+packed_load_and_store_type(i8, _i8, 1)
+packed_load_and_store_type(i16, _i16, 2)
+
 
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; prefetch
@@ -378,6 +386,12 @@ declare void @__prefetch_read_varying_3(<WIDTH x i64> %addr, <WIDTH x MASK> %mas
 declare void @__prefetch_read_varying_3_native(i8 * %base, i32 %scale, <WIDTH x i32> %offsets, <WIDTH x MASK> %mask) nounwind
 declare void @__prefetch_read_varying_nt(<WIDTH x i64> %addr, <WIDTH x MASK> %mask) nounwind
 declare void @__prefetch_read_varying_nt_native(i8 * %base, i32 %scale, <WIDTH x i32> %offsets, <WIDTH x MASK> %mask) nounwind
+
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;; streaming stores
+
+define_regular_streaming_stores()
+
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; int8/int16 builtins
 
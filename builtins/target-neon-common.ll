@@ -351,4 +351,5 @@ packed_load_and_store(4)
 ;; prefetch
 
 define_prefetches()
+define_regular_streaming_stores()
 declare_nvptx()
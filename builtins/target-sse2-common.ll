@@ -31,6 +31,7 @@
 
 ctlztz()
 define_prefetches()
+define_streaming_stores(16, sfence)
 define_shuffles()
 aossoa()
 rdrand_decls()
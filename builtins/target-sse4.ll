@@ -38,6 +38,7 @@ define(`MASK',`i32')
 include(`util.m4')
 
 stdlib_core()
+define(`HAVE_PACKED_32', `1')
 packed_load_and_store()
 scans()
 int64minmax()
@@ -209,6 +210,159 @@ define <4 x i32> @__max_varying_uint32(<4 x i32>, <4 x i32>) nounwind readonly a
   ret <4 x i32> %call
 }
 
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;; packed load/store
+;;
+;; The 32-bit packed loads and stores move the values between the active
+;; lanes and consecutive lanes with a single pshufb, using a control vector
+;; for the mask from a table, rather than going lane by lane.  Only as many
+;; values as there are active lanes are read or written in memory.
+
+@__packed_store_pshufb = internal constant [16 x <16 x i8>] [
+  forloop(i, 0, 14, `<16 x i8> < packed_pshufb_bytes(packed_store_perm(i, 4)) >,
+  ') <16 x i8> < packed_pshufb_bytes(packed_store_perm(15, 4)) > ]
+
+@__packed_load_pshufb = internal constant [16 x <16 x i8>] [
+  forloop(i, 0, 14, `<16 x i8> < packed_pshufb_bytes(packed_load_perm(i, 4)) >,
+  ') <16 x i8> < packed_pshufb_bytes(packed_load_perm(15, 4)) > ]
+
+declare <16 x i8> @llvm.x86.ssse3.pshuf.b.128(<16 x i8>, <16 x i8>) nounwind readnone
+
+define internal <4 x i32> @__packed_pshufb(<4 x i32> %v, [16 x <16 x i8>] * %table,
+                                           i64 %mask) nounwind alwaysinline {
+  %ctlptr = getelementptr PTR_OP_ARGS(`[16 x <16 x i8>]') %table, i64 0, i64 %mask
+  %ctl = load PTR_OP_ARGS(`<16 x i8> ') %ctlptr, align 16
+  %bytes = bitcast <4 x i32> %v to <16 x i8>
+  %shuffled = call <16 x i8> @llvm.x86.ssse3.pshuf.b.128(<16 x i8> %bytes, <16 x i8> %ctl)
+  %r = bitcast <16 x i8> %shuffled to <4 x i32>
+  ret <4 x i32> %r
+}
+
+;; Write the first %count elements of %v to %ptr, without touching the
+;; memory after them.
+define internal void @__packed_store_first(i32 * %ptr, <4 x i32> %v,
+                                           i32 %count) nounwind alwaysinline {
+entry:
+  %all = icmp eq i32 %count, 4
+  br i1 %all, label %store4, label %check2
+
+store4:
+  %ptr4 = bitcast i32 * %ptr to <4 x i32> *
+  store <4 x i32> %v, <4 x i32> * %ptr4, align 4
+  ret void
+
+check2:
+  %two = and i32 %count, 2
+  %do2 = icmp ne i32 %two, 0
+  br i1 %do2, label %store2, label %check1
+
+store2:
+  %v64 = bitcast <4 x i32> %v to <2 x i64>
+  %lo = extractelement <2 x i64> %v64, i32 0
+  %ptr2 = bitcast i32 * %ptr to i64 *
+  store i64 %lo, i64 * %ptr2, align 4
+  %hi = shufflevector <4 x i32> %v, <4 x i32> undef,
+                      <4 x i32> <i32 2, i32 3, i32 undef, i32 undef>
+  br label %check1
+
+check1:
+  %rest = phi <4 x i32> [ %v, %check2 ], [ %hi, %store2 ]
+  %one = and i32 %count, 1
+  %do1 = icmp ne i32 %one, 0
+  br i1 %do1, label %store1, label %done
+
+store1:
+  %last = extractelement <4 x i32> %rest, i32 0
+  %ptr1 = getelementptr PTR_OP_ARGS(`i32') %ptr, i32 %two
+  store i32 %last, i32 * %ptr1
+  br label %done
+
+done:
+  ret void
+}
+
+;; Read %count elements starting at %ptr into the first lanes of a vector,
+;; without touching the memory after them.
+define internal <4 x i32> @__packed_load_first(i32 * %ptr,
+                                               i32 %count) nounwind alwaysinline {
+entry:
+  %all = icmp eq i32 %count, 4
+  br i1 %all, label %load4, label %check2
+
+load4:
+  %ptr4 = bitcast i32 * %ptr to <4 x i32> *
+  %v4 = load PTR_OP_ARGS(`<4 x i32> ') %ptr4, align 4
+  ret <4 x i32> %v4
+
+check2:
+  %two = and i32 %count, 2
+  %do2 = icmp ne i32 %two, 0
+  br i1 %do2, label %load2, label %check1
+
+load2:
+  %ptr2 = bitcast i32 * %ptr to i64 *
+  %lo = load PTR_OP_ARGS(`i64 ') %ptr2, align 4
+  %lov = insertelement <2 x i64> undef, i64 %lo, i32 0
+  %v2 = bitcast <2 x i64> %lov to <4 x i32>
+  br label %check1
+
+check1:
+  %v = phi <4 x i32> [ undef, %check2 ], [ %v2, %load2 ]
+  %one = and i32 %count, 1
+  %do1 = icmp ne i32 %one, 0
+  br i1 %do1, label %load1, label %done
+
+load1:
+  %ptr1 = getelementptr PTR_OP_ARGS(`i32') %ptr, i32 %two
+  %last = load PTR_OP_ARGS(`i32 ') %ptr1
+  %in0 = insertelement <4 x i32> %v, i32 %last, i32 0
+  %in2 = insertelement <4 x i32> %v, i32 %last, i32 2
+  %vl = select i1 %do2, <4 x i32> %in2, <4 x i32> %in0
+  br label %done
+
+done:
+  %r = phi <4 x i32> [ %v, %check1 ], [ %vl, %load1 ]
+  ret <4 x i32> %r
+}
+
+; $1: element type
+; $2: suffix for the function names
+
+define(`packed_load_and_store_pshufb', `
+define i32 @__packed_load_active$2($1 * %startptr, <4 x $1> * %val_ptr,
+                                   <4 x i32> %full_mask) nounwind alwaysinline {
+  %mask = call i64 @__movmsk(<4 x i32> %full_mask)
+  %count64 = call i64 @llvm.ctpop.i64(i64 %mask)
+  %count = trunc i64 %count64 to i32
+  %ptr = bitcast $1 * %startptr to i32 *
+  %packed = call <4 x i32> @__packed_load_first(i32 * %ptr, i32 %count)
+  %spread = call <4 x i32> @__packed_pshufb(<4 x i32> %packed,
+                   [16 x <16 x i8>] * @__packed_load_pshufb, i64 %mask)
+  %spread_typed = bitcast <4 x i32> %spread to <4 x $1>
+  %old = load PTR_OP_ARGS(`<4 x $1> ') %val_ptr, align 4
+  %m = icmp ne <4 x i32> %full_mask, zeroinitializer
+  %result = select <4 x i1> %m, <4 x $1> %spread_typed, <4 x $1> %old
+  store <4 x $1> %result, <4 x $1> * %val_ptr, align 4
+  ret i32 %count
+}
+
+define i32 @__packed_store_active$2($1 * %startptr, <4 x $1> %vals,
+                                    <4 x i32> %full_mask) nounwind alwaysinline {
+  %mask = call i64 @__movmsk(<4 x i32> %full_mask)
+  %count64 = call i64 @llvm.ctpop.i64(i64 %mask)
+  %count = trunc i64 %count64 to i32
+  %vals32 = bitcast <4 x $1> %vals to <4 x i32>
+  %packed = call <4 x i32> @__packed_pshufb(<4 x i32> %vals32,
+                   [16 x <16 x i8>] * @__packed_store_pshufb, i64 %mask)
+  %ptr = bitcast $1 * %startptr to i32 *
+  call void @__packed_store_first(i32 * %ptr, <4 x i32> %packed, i32 %count)
+  ret i32 %count
+}
+')
+
+packed_load_and_store_pshufb(i32, `')
+packed_load_and_store_pshufb(float, _float)
+
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; svml stuff
 
@@ -1446,6 +1446,18 @@ define void @__keep_funcs_live(i8 * %ptr, <WIDTH x i8> %v8, <WIDTH x i16> %v16,
   call void @__masked_store_i64(<WIDTH x i64> * %pv64, <WIDTH x i64> %v64, <WIDTH x MASK> %mask)
   call void @__masked_store_double(<WIDTH x double> * %pvd, <WIDTH x double> %vd, <WIDTH x MASK> %mask)
 
+  %ps16 = bitcast i8 * %ptr to i16 *
+  %ps32 = bitcast i8 * %ptr to i32 *
+  %psf = bitcast i8 * %ptr to float *
+  %ps64 = bitcast i8 * %ptr to i64 *
+  %psd = bitcast i8 * %ptr to double *
+  call void @__streaming_store_varying_i8(i8 * %ptr, <WIDTH x i8> %v8, <WIDTH x MASK> %mask)
+  call void @__streaming_store_varying_i16(i16 * %ps16, <WIDTH x i16> %v16, <WIDTH x MASK> %mask)
+  call void @__streaming_store_varying_i32(i32 * %ps32, <WIDTH x i32> %v32, <WIDTH x MASK> %mask)
+  call void @__streaming_store_varying_float(float * %psf, <WIDTH x float> %vf, <WIDTH x MASK> %mask)
+  call void @__streaming_store_varying_i64(i64 * %ps64, <WIDTH x i64> %v64, <WIDTH x MASK> %mask)
+  call void @__streaming_store_varying_double(double * %psd, <WIDTH x double> %vd, <WIDTH x MASK> %mask)
+
   call void @__masked_store_blend_i8(<WIDTH x i8> * %pv8, <WIDTH x i8> %v8,
                                      <WIDTH x MASK> %mask)
   call void @__masked_store_blend_i16(<WIDTH x i16> * %pv16, <WIDTH x i16> %v16,
@@ -2760,13 +2772,14 @@ define void @__masked_store_blend_i16(<16 x i16>* nocapture, <16 x i16>,
 ;; destination array.  For packed load, each lane that has an active mask
 ;; loads a sequential value from the array.
 ;;
-;; $1: vector width of the target
+;; $1: element type
+;; $2: suffix for the function names (empty for int32)
+;; $3: alignment of the element type
 ;;
 ;; FIXME: use the per_lane macro, defined below, to implement these!
 
-define(`packed_load_and_store', `
-
-define i32 @__packed_load_active(i32 * %startptr, <1 x i32> * %val_ptr,
+define(`packed_load_and_store_type', `
+define i32 @__packed_load_active$2($1 * %startptr, <1 x $1> * %val_ptr,
                                  <1 x i1> %full_mask) nounwind alwaysinline {
 entry:
   %active = extractelement <1 x i1> %full_mask, i32 0
@@ -2776,17 +2789,17 @@ entry:
 
 if.then:                                          ; preds = %entry
   %idxprom = ashr i64 %call, 32
-  %arrayidx = getelementptr inbounds PTR_OP_ARGS(`i32') %startptr, i64 %idxprom
-  %val = load PTR_OP_ARGS(`i32')  %arrayidx, align 4
-  %valvec = insertelement <1 x i32> undef, i32 %val, i32 0
-  store <1 x i32> %valvec, <1 x i32>* %val_ptr, align 4
+  %arrayidx = getelementptr inbounds PTR_OP_ARGS(`$1') %startptr, i64 %idxprom
+  %val = load PTR_OP_ARGS(`$1')  %arrayidx, align $3
+  %valvec = insertelement <1 x $1> undef, $1 %val, i32 0
+  store <1 x $1> %valvec, <1 x $1>* %val_ptr, align $3
   br label %if.end
 
 if.end:                                           ; preds = %if.then, %entry
   ret i32 %res.sroa.0.0.extract.trunc
 }
 
-define i32 @__packed_store_active(i32 * %startptr, <WIDTH x i32> %vals,
+define i32 @__packed_store_active$2($1 * %startptr, <WIDTH x $1> %vals,
                                    <WIDTH x MASK> %full_mask) nounwind alwaysinline 
 {
 entry:
@@ -2797,15 +2810,25 @@ entry:
 
 if.then:                                          ; preds = %entry
   %idxprom = ashr i64 %call, 32
-  %arrayidx = getelementptr inbounds PTR_OP_ARGS(`i32') %startptr, i64 %idxprom
-  %val = extractelement <1 x i32> %vals, i32 0
-  store i32 %val, i32* %arrayidx, align 4
+  %arrayidx = getelementptr inbounds PTR_OP_ARGS(`$1') %startptr, i64 %idxprom
+  %val = extractelement <1 x $1> %vals, i32 0
+  store $1 %val, $1* %arrayidx, align $3
   br label %if.end
 
 if.end:                                           ; preds = %if.then, %entry
   ret i32 %res.sroa.0.0.extract.trunc
 }
 
+')
+
+define(`packed_load_and_store', `
+packed_load_and_store_type(i32, `', 4)
+packed_load_and_store_type(float, _float, 4)
+packed_load_and_store_type(i64, _i64, 8)
+packed_load_and_store_type(double, _double, 8)
+packed_load_and_store_type(i8, _i8, 1)
+packed_load_and_store_type(i16, _i16, 2)
+
 define i32 @__packed_store_active2(i32 * %startptr, <1 x i32> %vals,
                                    <1 x i1> %full_mask) nounwind alwaysinline 
 {
@@ -2816,6 +2839,240 @@ define i32 @__packed_store_active2(i32 * %startptr, <1 x i32> %vals,
 ')
 
 
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;; prefix sum stuff
+;;
+;; The inclusive, min/max and segmented scans that util.m4 defines for the
+;; other targets.  (target-nvptx.ll has its own exclusive add, and and or
+;; scans.)  Each lane of the warp is a program instance here, so each of
+;; the five steps reads the partial result from the lane 1, 2, 4, 8 or 16
+;; below with a shfl and combines it with its own.
+
+;; Returns the value of the given variable in the given lane of the warp.
+;; $1: element type
+
+define(`scan_shfl', `
+define internal $1 @__scan_shfl_$1($1 %v, i32 %lane) nounwind readnone alwaysinline {
+ifelse($1, `i32', `
+  %r = call i32 @__shfl_i32_nvptx(i32 %v, i32 %lane)
+  ret i32 %r
+', $1, `float', `
+  %r = call float @__shfl_float_nvptx(float %v, i32 %lane)
+  ret float %r
+', `
+  %vv = bitcast $1 %v to <2 x i32>
+  %v0 = extractelement <2 x i32> %vv, i32 0
+  %v1 = extractelement <2 x i32> %vv, i32 1
+  %r0 = call i32 @__shfl_i32_nvptx(i32 %v0, i32 %lane)
+  %r1 = call i32 @__shfl_i32_nvptx(i32 %v1, i32 %lane)
+  %rv0 = insertelement <2 x i32> undef, i32 %r0, i32 0
+  %rv1 = insertelement <2 x i32> %rv0, i32 %r1, i32 1
+  %r = bitcast <2 x i32> %rv1 to $1
+  ret $1 %r
+')
+}
+')
+
+; Combine two partial results; see scan_combine in util.m4.
+; $1: element type
+; $2: operator (add, fadd, and, or, smin, smax, umin, umax, fmin or fmax)
+; $3: name of the result
+; $4, $5: names of the operands
+
+define(`scan_select', `%$3_cmp = $2 $1 %$4, %$5
+  %$3 = select i1 %$3_cmp, $1 %$4, $1 %$5')
+
+define(`scan_combine', `ifelse($2, `smin', `scan_select($1, icmp slt, $3, $4, $5)',
+  $2, `smax', `scan_select($1, icmp sgt, $3, $4, $5)',
+  $2, `umin', `scan_select($1, icmp ult, $3, $4, $5)',
+  $2, `umax', `scan_select($1, icmp ugt, $3, $4, $5)',
+  $2, `fmin', `scan_select($1, fcmp olt, $3, $4, $5)',
+  $2, `fmax', `scan_select($1, fcmp ogt, $3, $4, $5)',
+  `%$3 = $2 $1 %$4, %$5')')
+
+; $1: element type
+; $2: operator to apply (see scan_combine)
+; $3: identity element value
+; $4: suffix for function (e.g. add_float)
+
+define(`inclusive_scan', `
+define <1 x $1> @__inclusive_scan_$4(<1 x $1>, <1 x i1>) nounwind readnone alwaysinline {
+  %v = extractelement <1 x $1> %0, i32 0
+  %mask = extractelement <1 x i1> %1, i32 0
+  %s0 = select i1 %mask, $1 %v, $1 $3
+  %lane = call i32 @__program_index()
+  forloop(k, 1, 5, `
+  %src`'k = sub i32 %lane, eval(1 << (k-1))
+  %sh`'k = call $1 @__scan_shfl_$1($1 %s`'eval(k-1), i32 %src`'k)
+  scan_combine($1, $2, c`'k, sh`'k, s`'eval(k-1))
+  %in`'k = icmp sge i32 %src`'k, 0
+  %s`'k = select i1 %in`'k, $1 %c`'k, $1 %s`'eval(k-1)')
+
+  %r = insertelement <1 x $1> undef, $1 %s5, i32 0
+  ret <1 x $1> %r
+}
+')
+
+; The exclusive scan is the inclusive one read from the lane below.
+
+define(`exclusive_scan', `
+define <1 x $1> @__exclusive_scan_$4(<1 x $1>, <1 x i1>) nounwind readnone alwaysinline {
+  %incl = call <1 x $1> @__inclusive_scan_$4(<1 x $1> %0, <1 x i1> %1)
+  %i = extractelement <1 x $1> %incl, i32 0
+  %lane = call i32 @__program_index()
+  %src = sub i32 %lane, 1
+  %sh = call $1 @__scan_shfl_$1($1 %i, i32 %src)
+  %first = icmp eq i32 %lane, 0
+  %e = select i1 %first, $1 $3, $1 %sh
+  %r = insertelement <1 x $1> undef, $1 %e, i32 0
+  ret <1 x $1> %r
+}
+')
+
+; Segmented scans restart at each lane where the given flag is set; as in
+; util.m4, the flags are carried along with the partial results, so that a
+; lane stops accumulating once it has seen a flag.
+
+define(`segmented_scan', `
+define <1 x $1> @__segmented_inclusive_scan_$4(<1 x $1>, <1 x i1>, <1 x i1>) nounwind readnone alwaysinline {
+  %v = extractelement <1 x $1> %0, i32 0
+  %mask = extractelement <1 x i1> %1, i32 0
+  %flag = extractelement <1 x i1> %2, i32 0
+  %s0 = select i1 %mask, $1 %v, $1 $3
+  %f0 = and i1 %flag, %mask
+  %lane = call i32 @__program_index()
+  forloop(k, 1, 5, `
+  %src`'k = sub i32 %lane, eval(1 << (k-1))
+  %in`'k = icmp sge i32 %src`'k, 0
+  %sh`'k = call $1 @__scan_shfl_$1($1 %s`'eval(k-1), i32 %src`'k)
+  scan_combine($1, $2, c`'k, sh`'k, s`'eval(k-1))
+  %nf`'k = xor i1 %f`'eval(k-1), true
+  %use`'k = and i1 %nf`'k, %in`'k
+  %s`'k = select i1 %use`'k, $1 %c`'k, $1 %s`'eval(k-1)
+  %fi`'k = zext i1 %f`'eval(k-1) to i32
+  %fsh`'k = call i32 @__shfl_i32_nvptx(i32 %fi`'k, i32 %src`'k)
+  %fshb`'k = trunc i32 %fsh`'k to i1
+  %fin`'k = and i1 %fshb`'k, %in`'k
+  %f`'k = or i1 %f`'eval(k-1), %fin`'k')
+
+  %r = insertelement <1 x $1> undef, $1 %s5, i32 0
+  ret <1 x $1> %r
+}
+
+define <1 x $1> @__segmented_exclusive_scan_$4(<1 x $1>, <1 x i1>, <1 x i1>) nounwind readnone alwaysinline {
+  %incl = call <1 x $1> @__segmented_inclusive_scan_$4(<1 x $1> %0, <1 x i1> %1,
+                                                         <1 x i1> %2)
+  %i = extractelement <1 x $1> %incl, i32 0
+  %lane = call i32 @__program_index()
+  %src = sub i32 %lane, 1
+  %sh = call $1 @__scan_shfl_$1($1 %i, i32 %src)
+  %mask = extractelement <1 x i1> %1, i32 0
+  %flag = extractelement <1 x i1> %2, i32 0
+  %f = and i1 %flag, %mask
+  %first = icmp eq i32 %lane, 0
+  %restart = or i1 %first, %f
+  %e = select i1 %restart, $1 $3, $1 %sh
+  %r = insertelement <1 x $1> undef, $1 %e, i32 0
+  ret <1 x $1> %r
+}
+')
+
+define(`scans', `
+scan_shfl(i32)
+scan_shfl(float)
+scan_shfl(i64)
+scan_shfl(double)
+
+inclusive_scan(i32, add, 0, add_i32)
+inclusive_scan(float, fadd, 0.0, add_float)
+inclusive_scan(i64, add, 0, add_i64)
+inclusive_scan(double, fadd, 0.0, add_double)
+
+inclusive_scan(i32, and, -1, and_i32)
+inclusive_scan(i64, and, -1, and_i64)
+
+inclusive_scan(i32, or, 0, or_i32)
+inclusive_scan(i64, or, 0, or_i64)
+
+inclusive_scan(i32, smin, 2147483647, min_int32)
+inclusive_scan(i32, umin, -1, min_uint32)
+inclusive_scan(float, fmin, 0x7FF0000000000000, min_float)
+inclusive_scan(i64, smin, 9223372036854775807, min_int64)
+inclusive_scan(i64, umin, -1, min_uint64)
+inclusive_scan(double, fmin, 0x7FF0000000000000, min_double)
+exclusive_scan(i32, smin, 2147483647, min_int32)
+exclusive_scan(i32, umin, -1, min_uint32)
+exclusive_scan(float, fmin, 0x7FF0000000000000, min_float)
+exclusive_scan(i64, smin, 9223372036854775807, min_int64)
+exclusive_scan(i64, umin, -1, min_uint64)
+exclusive_scan(double, fmin, 0x7FF0000000000000, min_double)
+
+inclusive_scan(i32, smax, -2147483648, max_int32)
+inclusive_scan(i32, umax, 0, max_uint32)
+inclusive_scan(float, fmax, 0xFFF0000000000000, max_float)
+inclusive_scan(i64, smax, -9223372036854775808, max_int64)
+inclusive_scan(i64, umax, 0, max_uint64)
+inclusive_scan(double, fmax, 0xFFF0000000000000, max_double)
+exclusive_scan(i32, smax, -2147483648, max_int32)
+exclusive_scan(i32, umax, 0, max_uint32)
+exclusive_scan(float, fmax, 0xFFF0000000000000, max_float)
+exclusive_scan(i64, smax, -9223372036854775808, max_int64)
+exclusive_scan(i64, umax, 0, max_uint64)
+exclusive_scan(double, fmax, 0xFFF0000000000000, max_double)
+
+segmented_scan(i32, add, 0, add_i32)
+segmented_scan(float, fadd, 0.0, add_float)
+segmented_scan(i64, add, 0, add_i64)
+segmented_scan(double, fadd, 0.0, add_double)
+')
+
+
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;; streaming stores
+;;
+;; There are no cache-bypassing stores to use here; these are regular stores
+;; so that the stdlib streaming_store() functions work on this target too.
+;;
+;; $1: element type
+;; $2: suffix for the function names
+;; $3: alignment of the element type
+
+define(`streaming_store_type', `
+define void @__streaming_store_uniform_$2($1 * %ptr, $1 %val) nounwind alwaysinline {
+  store $1 %val, $1 * %ptr, align $3
+  ret void
+}
+
+define void @__streaming_store_varying_$2($1 * %ptr, <1 x $1> %val,
+                                          <1 x i1> %mask) nounwind alwaysinline {
+  %active = extractelement <1 x i1> %mask, i32 0
+  br i1 %active, label %store, label %done
+
+store:
+  %v = extractelement <1 x $1> %val, i32 0
+  store $1 %v, $1 * %ptr, align $3
+  br label %done
+
+done:
+  ret void
+}
+')
+
+define(`define_streaming_stores', `
+streaming_store_type(i8, i8, 1)
+streaming_store_type(i16, i16, 2)
+streaming_store_type(i32, i32, 4)
+streaming_store_type(float, float, 4)
+streaming_store_type(i64, i64, 8)
+streaming_store_type(double, double, 8)
+
+define void @__streaming_store_fence() nounwind alwaysinline {
+  call void @__memory_barrier()
+  ret void
+}
+')
+
+
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; reduce_equal
 
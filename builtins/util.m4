@@ -1732,6 +1732,121 @@ define void @__prefetch_read_varying_nt(<WIDTH x i64> %addr, <WIDTH x MASK> %mas
 declare void @__prefetch_read_varying_nt_native(i8 * %base, i32 %scale, <WIDTH x i32> %offsets, <WIDTH x MASK> %mask) nounwind
 ')
 
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;; streaming stores
+;;
+;; Non-temporal stores, which write around the caches (movnt* on x86).
+;; The varying versions store a vector to consecutive elements; they only
+;; use a non-temporal store if all of the program instances are running
+;; and the pointer is aligned to the size of the vector (or of a vector
+;; register, if that is smaller), and otherwise do a regular masked store.
+;;
+;; $1: size of the target's vector registers in bytes
+;; $2: sfence if the fence that orders non-temporal stores should be an
+;;     x86 sfence; otherwise it is a full memory barrier
+
+define(`streaming_store_align',
+`ifelse(eval(WIDTH * $1 > $2), `1', `$2', `eval(WIDTH * $1)')')
+
+;; $1: element type
+;; $2: suffix for the function names
+;; $3: size of the element type in bytes
+;; $4: alignment needed for a non-temporal vector store
+
+define(`streaming_store_type', `
+define void @__streaming_store_uniform_$2($1 * %ptr, $1 %val) nounwind alwaysinline {
+  store $1 %val, $1 * %ptr, align $3, !nontemporal !{i32 1}
+  ret void
+}
+
+define void @__streaming_store_varying_$2($1 * %ptr, <WIDTH x $1> %val,
+                                          <WIDTH x MASK> %mask) nounwind alwaysinline {
+  %vptr = bitcast $1 * %ptr to <WIDTH x $1> *
+  %mm = call i64 @__movmsk(<WIDTH x MASK> %mask)
+  %allon = icmp eq i64 %mm, ALL_ON_MASK
+  br i1 %allon, label %all_on, label %masked
+
+all_on:
+  %iptr = ptrtoint $1 * %ptr to i64
+  %misaligned = and i64 %iptr, eval($4 - 1)
+  %aligned = icmp eq i64 %misaligned, 0
+  br i1 %aligned, label %stream, label %unaligned
+
+stream:
+  store <WIDTH x $1> %val, <WIDTH x $1> * %vptr, align $4, !nontemporal !{i32 1}
+  ret void
+
+unaligned:
+  store <WIDTH x $1> %val, <WIDTH x $1> * %vptr, align $3
+  ret void
+
+masked:
+  call void @__masked_store_$2(<WIDTH x $1> * %vptr, <WIDTH x $1> %val,
+                               <WIDTH x MASK> %mask)
+  ret void
+}
+')
+
+define(`define_streaming_stores', `
+streaming_store_type(i8, i8, 1, streaming_store_align(1, $1))
+streaming_store_type(i16, i16, 2, streaming_store_align(2, $1))
+streaming_store_type(i32, i32, 4, streaming_store_align(4, $1))
+streaming_store_type(float, float, 4, streaming_store_align(4, $1))
+streaming_store_type(i64, i64, 8, streaming_store_align(8, $1))
+streaming_store_type(double, double, 8, streaming_store_align(8, $1))
+
+ifelse(`$2', `sfence', `
+declare void @llvm.x86.sse.sfence() nounwind
+
+define void @__streaming_store_fence() nounwind alwaysinline {
+  call void @llvm.x86.sse.sfence()
+  ret void
+}
+', `
+define void @__streaming_store_fence() nounwind alwaysinline {
+  call void @__memory_barrier()
+  ret void
+}
+')
+')
+
+;; For targets that don't have non-temporal stores, the streaming store
+;; functions are just regular (masked) stores, so that the stdlib's
+;; streaming_store() functions are available everywhere.
+;;
+;; $1: element type
+;; $2: suffix for the function names
+;; $3: size of the element type in bytes
+
+define(`regular_streaming_store_type', `
+define void @__streaming_store_uniform_$2($1 * %ptr, $1 %val) nounwind alwaysinline {
+  store $1 %val, $1 * %ptr, align $3
+  ret void
+}
+
+define void @__streaming_store_varying_$2($1 * %ptr, <WIDTH x $1> %val,
+                                          <WIDTH x MASK> %mask) nounwind alwaysinline {
+  %vptr = bitcast $1 * %ptr to <WIDTH x $1> *
+  call void @__masked_store_$2(<WIDTH x $1> * %vptr, <WIDTH x $1> %val,
+                               <WIDTH x MASK> %mask)
+  ret void
+}
+')
+
+define(`define_regular_streaming_stores', `
+regular_streaming_store_type(i8, i8, 1)
+regular_streaming_store_type(i16, i16, 2)
+regular_streaming_store_type(i32, i32, 4)
+regular_streaming_store_type(float, float, 4)
+regular_streaming_store_type(i64, i64, 8)
+regular_streaming_store_type(double, double, 8)
+
+define void @__streaming_store_fence() nounwind alwaysinline {
+  call void @__memory_barrier()
+  ret void
+}
+')
+
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; AOS/SOA conversion primitives
 
@@ -2783,6 +2898,18 @@ define void @__keep_funcs_live(i8 * %ptr, <WIDTH x i8> %v8, <WIDTH x i16> %v16,
   call void @__masked_store_blend_double(<WIDTH x double> * %pvd, <WIDTH x double> %vd,
                                          <WIDTH x MASK> %mask)
 
+  %ps16 = bitcast i8 * %ptr to i16 *
+  %ps32 = bitcast i8 * %ptr to i32 *
+  %psf = bitcast i8 * %ptr to float *
+  %ps64 = bitcast i8 * %ptr to i64 *
+  %psd = bitcast i8 * %ptr to double *
+  call void @__streaming_store_varying_i8(i8 * %ptr, <WIDTH x i8> %v8, <WIDTH x MASK> %mask)
+  call void @__streaming_store_varying_i16(i16 * %ps16, <WIDTH x i16> %v16, <WIDTH x MASK> %mask)
+  call void @__streaming_store_varying_i32(i32 * %ps32, <WIDTH x i32> %v32, <WIDTH x MASK> %mask)
+  call void @__streaming_store_varying_float(float * %psf, <WIDTH x float> %vf, <WIDTH x MASK> %mask)
+  call void @__streaming_store_varying_i64(i64 * %ps64, <WIDTH x i64> %v64, <WIDTH x MASK> %mask)
+  call void @__streaming_store_varying_double(double * %psd, <WIDTH x double> %vd, <WIDTH x MASK> %mask)
+
   ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
   ;; gathers
 
@@ -3741,6 +3868,80 @@ errprint(`BUILD_OS should be defined to either UNIX or WINDOWS
 m4exit(`1')
 ')
 
+;; Versions of new/delete that call the user-supplied ISPCNew() and
+;; ISPCDelete() functions, for --new-delete-hooks.  Both of them take
+;; arrays of count pointers (and sizes), only the elements of which that
+;; are set in the lane mask are used, so that all of the program
+;; instances that allocate or free memory are handled with a single call.
+;; Define:
+;; - __new_uniform_hook
+;; - __new_varying32_hook
+;; - __new_varying64_hook
+;; - __delete_uniform_hook
+;; - __delete_varying_hook
+
+declare void @ISPCNew(i8 **, i64 *, i32, i32, i64)
+declare void @ISPCDelete(i8 **, i32, i64)
+
+ifelse(RUNTIME, `32', `define(`PTR_INT', `i32')', `define(`PTR_INT', `i64')')
+
+define noalias i8 * @__new_uniform_hook(i64 %size) {
+  %ptr = alloca i8*
+  store i8 * null, i8 ** %ptr
+  %sizes = alloca i64
+  store i64 %size, i64 * %sizes
+  %alignment = load PTR_OP_ARGS(`i32')  @memory_alignment
+  call void @ISPCNew(i8 ** %ptr, i64 * %sizes, i32 1, i32 %alignment, i64 1)
+  %ptr_val = load PTR_OP_ARGS(`i8*')  %ptr
+  ret i8* %ptr_val
+}
+
+define <WIDTH x i64> @__new_varying64_hook(<WIDTH x i64> %size, <WIDTH x MASK> %mask) {
+  %ptrs = alloca <WIDTH x PTR_INT>
+  store <WIDTH x PTR_INT> zeroinitializer, <WIDTH x PTR_INT> * %ptrs
+  %ptrs_arg = bitcast <WIDTH x PTR_INT> * %ptrs to i8 **
+  %sizes = alloca <WIDTH x i64>
+  store <WIDTH x i64> %size, <WIDTH x i64> * %sizes
+  %sizes_arg = bitcast <WIDTH x i64> * %sizes to i64 *
+  %alignment = load PTR_OP_ARGS(`i32')  @memory_alignment
+  %mm = call i64 @__movmsk(<WIDTH x MASK> %mask)
+  call void @ISPCNew(i8 ** %ptrs_arg, i64 * %sizes_arg, i32 WIDTH, i32 %alignment, i64 %mm)
+  %r = load PTR_OP_ARGS(`<WIDTH x PTR_INT> ')  %ptrs
+ifelse(RUNTIME, `32', `
+  %r64 = zext <WIDTH x i32> %r to <WIDTH x i64>
+  ret <WIDTH x i64> %r64
+', `
+  ret <WIDTH x i64> %r
+')
+}
+
+define <WIDTH x i64> @__new_varying32_hook(<WIDTH x i32> %size, <WIDTH x MASK> %mask) {
+  %size64 = zext <WIDTH x i32> %size to <WIDTH x i64>
+  %r = call <WIDTH x i64> @__new_varying64_hook(<WIDTH x i64> %size64, <WIDTH x MASK> %mask)
+  ret <WIDTH x i64> %r
+}
+
+define void @__delete_uniform_hook(i8 * %ptr) {
+  %ptrs = alloca i8*
+  store i8 * %ptr, i8 ** %ptrs
+  call void @ISPCDelete(i8 ** %ptrs, i32 1, i64 1)
+  ret void
+}
+
+define void @__delete_varying_hook(<WIDTH x i64> %ptr, <WIDTH x MASK> %mask) {
+  %ptrs = alloca <WIDTH x PTR_INT>
+ifelse(RUNTIME, `32', `
+  %ptr32 = trunc <WIDTH x i64> %ptr to <WIDTH x i32>
+  store <WIDTH x i32> %ptr32, <WIDTH x i32> * %ptrs
+', `
+  store <WIDTH x i64> %ptr, <WIDTH x i64> * %ptrs
+')
+  %ptrs_arg = bitcast <WIDTH x PTR_INT> * %ptrs to i8 **
+  %mm = call i64 @__movmsk(<WIDTH x MASK> %mask)
+  call void @ISPCDelete(i8 ** %ptrs_arg, i32 WIDTH, i64 %mm)
+  ret void
+}
+
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; read hw clock
 
@@ -4231,13 +4432,17 @@ define void @__masked_store_blend_i16(<16 x i16>* nocapture, <16 x i16>,
 ;; destination array.  For packed load, each lane that has an active mask
 ;; loads a sequential value from the array.
 ;;
-;; $1: vector width of the target
+;; Targets that have faster implementations for 32-bit or 64-bit elements
+;; define HAVE_PACKED_32 or HAVE_PACKED_64 to 1 and provide their own.
 ;;
 ;; FIXME: use the per_lane macro, defined below, to implement these!
 
-define(`packed_load_and_store', `
+; $1: element type
+; $2: suffix for the function names (empty for i32)
+; $3: element alignment
 
-define i32 @__packed_load_active(i32 * %startptr, <WIDTH x i32> * %val_ptr,
+define(`packed_load_active_type', `
+define i32 @__packed_load_active$2($1 * %startptr, <WIDTH x $1> * %val_ptr,
                                  <WIDTH x MASK> %full_mask) nounwind alwaysinline {
 entry:
   %mask = call i64 @__movmsk(<WIDTH x MASK> %full_mask)
@@ -4251,9 +4456,9 @@ known_mask:
 all_on:
   ;; everyone wants to load, so just load an entire vector width in a single
   ;; vector load
-  %vecptr = bitcast i32 *%startptr to <WIDTH x i32> *
-  %vec_load = load PTR_OP_ARGS(`<WIDTH x i32> ') %vecptr, align 4
-  store <WIDTH x i32> %vec_load, <WIDTH x i32> * %val_ptr, align 4
+  %vecptr = bitcast $1 *%startptr to <WIDTH x $1> *
+  %vec_load = load PTR_OP_ARGS(`<WIDTH x $1> ') %vecptr, align $3
+  store <WIDTH x $1> %vec_load, <WIDTH x $1> * %val_ptr, align $3
   ret i32 WIDTH
 
 unknown_mask:
@@ -4270,11 +4475,11 @@ loop:
   br i1 %do_load, label %load, label %loopend 
 
 load:
-  %loadptr = getelementptr PTR_OP_ARGS(`i32') %startptr, i32 %offset
-  %loadval = load PTR_OP_ARGS(`i32 ') %loadptr
-  %val_ptr_i32 = bitcast <WIDTH x i32> * %val_ptr to i32 *
-  %storeptr = getelementptr PTR_OP_ARGS(`i32') %val_ptr_i32, i32 %lane
-  store i32 %loadval, i32 *%storeptr
+  %loadptr = getelementptr PTR_OP_ARGS(`$1') %startptr, i32 %offset
+  %loadval = load PTR_OP_ARGS(`$1 ') %loadptr
+  %val_ptr_elt = bitcast <WIDTH x $1> * %val_ptr to $1 *
+  %storeptr = getelementptr PTR_OP_ARGS(`$1') %val_ptr_elt, i32 %lane
+  store $1 %loadval, $1 *%storeptr
   %offset1 = add i32 %offset, 1
   br label %loopend
 
@@ -4290,8 +4495,10 @@ loopend:
 done:
   ret i32 %nextoffset
 }
+')
 
-define i32 @__packed_store_active(i32 * %startptr, <WIDTH x i32> %vals,
+define(`packed_store_active_type', `
+define i32 @__packed_store_active$2($1 * %startptr, <WIDTH x $1> %vals,
                                    <WIDTH x MASK> %full_mask) nounwind alwaysinline {
 entry:
   %mask = call i64 @__movmsk(<WIDTH x MASK> %full_mask)
@@ -4303,8 +4510,8 @@ known_mask:
   br i1 %allon, label %all_on, label %unknown_mask
 
 all_on:
-  %vecptr = bitcast i32 *%startptr to <WIDTH x i32> *
-  store <WIDTH x i32> %vals, <WIDTH x i32> * %vecptr, align 4
+  %vecptr = bitcast $1 *%startptr to <WIDTH x $1> *
+  store <WIDTH x $1> %vals, <WIDTH x $1> * %vecptr, align $3
   ret i32 WIDTH
 
 unknown_mask:
@@ -4321,9 +4528,9 @@ loop:
   br i1 %do_store, label %store, label %loopend 
 
 store:
-  %storeval = extractelement <WIDTH x i32> %vals, i32 %lane
-  %storeptr = getelementptr PTR_OP_ARGS(`i32') %startptr, i32 %offset
-  store i32 %storeval, i32 *%storeptr
+  %storeval = extractelement <WIDTH x $1> %vals, i32 %lane
+  %storeptr = getelementptr PTR_OP_ARGS(`$1') %startptr, i32 %offset
+  store $1 %storeval, $1 *%storeptr
   %offset1 = add i32 %offset, 1
   br label %loopend
 
@@ -4339,6 +4546,24 @@ loopend:
 done:
   ret i32 %nextoffset
 }
+')
+
+define(`packed_load_and_store_type', `
+packed_load_active_type($1, $2, $3)
+packed_store_active_type($1, $2, $3)
+')
+
+define(`packed_load_and_store', `
+ifelse(HAVE_PACKED_32, `1', `', `
+packed_load_and_store_type(i32, `', 4)
+packed_load_and_store_type(float, _float, 4)
+')
+ifelse(HAVE_PACKED_64, `1', `', `
+packed_load_and_store_type(i64, _i64, 8)
+packed_load_and_store_type(double, _double, 8)
+')
+packed_load_and_store_type(i8, _i8, 1)
+packed_load_and_store_type(i16, _i16, 2)
 
 define MASK @__packed_store_active2(i32 * %startptr, <WIDTH x i32> %vals,
                                    <WIDTH x MASK> %full_mask) nounwind alwaysinline {
@@ -4386,6 +4611,36 @@ done:
 }
 ')
 
+;; Table entries for targets that pack and unpack the values with a single
+;; variable permute rather than going lane by lane.  For a mask of $2
+;; lanes, packed_store_perm() gives the lanes of the active program
+;; instances, in order, and packed_load_perm() gives, for each lane, the
+;; number of active lanes before it (i.e. which of the packed values an
+;; active lane gets).  Both are packed into 4-bit fields, with the first
+;; one in the low bits.
+;;
+;; $1: the mask
+;; $2: number of lanes (at most 8)
+
+define(`packed_store_perm', `_packed_store_perm($1, $2, 0, 0, 0)')
+define(`_packed_store_perm', `ifelse($3, $2, $5,
+  `ifelse(eval(($1 >> $3) & 1), 1,
+    `_packed_store_perm($1, $2, incr($3), incr($4), eval($5 | ($3 << (4 * $4))))',
+    `_packed_store_perm($1, $2, incr($3), $4, $5)')')')
+
+define(`packed_load_perm', `_packed_load_perm($1, $2, 0, 0, 0)')
+define(`_packed_load_perm', `ifelse($3, $2, $5,
+  `_packed_load_perm($1, $2, incr($3), eval($4 + (($1 >> $3) & 1)),
+                     eval($5 | ($4 << (4 * $3))))')')
+
+;; The pshufb control that moves 32-bit elements as given by one of the
+;; 4-lane entries above.
+;; $1: table entry
+
+define(`packed_pshufb_bytes', `forloop(b, 0, 14,
+  `i8 eval(4 * (($1 >> (4 * (b / 4))) & 15) + b % 4), ')
+  i8 eval(4 * (($1 >> 12) & 15) + 3)')
+
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; reduce_equal
 
@@ -4491,62 +4746,162 @@ reduce_equal_aux($1, double, double, i64, fcmp, 64, oeq)
 
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;; prefix sum stuff
+;;
+;; The scans take one step for each power of two up to the vector width;
+;; each step shifts the running partial results up by that many lanes
+;; (shifting in the identity value) and combines them with the unshifted
+;; ones.  The shifts are constant shufflevector instructions, which the
+;; code generator turns into the target's own permutes (pshufd/palignr
+;; with SSE, vpermd/valignd with AVX2 and AVX-512, and so forth).
+
+; Number of steps needed for a scan across the given vector width.
+
+define(`scan_steps_for_width', `ifelse($1, 1, 0, $1, 2, 1, $1, 4, 2, $1, 8, 3,
+  $1, 16, 4, $1, 32, 5, $1, 64, 6,
+  `errprint(`ERROR: scan_steps_for_width() called with unsupported width = '$1
+)m4exit(`1')')')
+
+; $1: vector width
+; $2: vector element type
+; $3: element value
+
+define(`scan_splat', `< forloop(i, 0, eval($1-2), `$2 $3, ') $2 $3 >')
+
+; Shuffle indices that shift a vector up by the given number of lanes,
+; taking lanes shifted in from the first element of the second operand.
+; $1: vector width
+; $2: number of lanes to shift by
+
+define(`scan_shift_indices', `< forloop(i, 0, eval($1-2),
+  `i32 ifelse(eval(i < $2), 1, $1, eval(i - $2)), ')
+  i32 ifelse(eval($1-1 < $2), 1, $1, eval($1 - 1 - $2)) >')
+
+; Combine two vectors of partial results; min and max are done with a
+; compare and a select, everything else is a single instruction.
+; $1: vector width
+; $2: vector element type
+; $3: operator (add, fadd, and, or, smin, smax, umin, umax, fmin or fmax)
+; $4: name of the result
+; $5, $6: names of the operands
+
+define(`scan_select', `%$4_cmp = $3 <$1 x $2> %$5, %$6
+  %$4 = select <$1 x i1> %$4_cmp, <$1 x $2> %$5, <$1 x $2> %$6')
+
+define(`scan_combine', `ifelse($3, `smin', `scan_select($1, $2, icmp slt, $4, $5, $6)',
+  $3, `smax', `scan_select($1, $2, icmp sgt, $4, $5, $6)',
+  $3, `umin', `scan_select($1, $2, icmp ult, $4, $5, $6)',
+  $3, `umax', `scan_select($1, $2, icmp ugt, $4, $5, $6)',
+  $3, `fmin', `scan_select($1, $2, fcmp olt, $4, $5, $6)',
+  $3, `fmax', `scan_select($1, $2, fcmp ogt, $4, $5, $6)',
+  `%$4 = $3 <$1 x $2> %$5, %$6')')
+
+; $1: vector width
+; $2: vector element type
+; $3: operator to apply (see scan_combine)
+; $4: identity element value (e.g. 0)
+; $5: suffix for function (e.g. add_float)
+
+define(`inclusive_scan', `
+define <$1 x $2> @__inclusive_scan_$5(<$1 x $2> %v,
+                                  <$1 x MASK> %mask) nounwind readnone alwaysinline {
+  ; off lanes contribute the identity value
+  %m = icmp ne <$1 x MASK> %mask, zeroinitializer
+  %s0 = select <$1 x i1> %m, <$1 x $2> %v, <$1 x $2> scan_splat($1, $2, $4)
+  forloop(k, 1, scan_steps_for_width($1), `
+  %sh`'k = shufflevector <$1 x $2> %s`'eval(k-1), <$1 x $2> scan_splat($1, $2, $4),
+      <$1 x i32> scan_shift_indices($1, eval(1 << (k-1)))
+  scan_combine($1, $2, $3, s`'k, sh`'k, s`'eval(k-1))')
+
+  ret <$1 x $2> %s`'scan_steps_for_width($1)
+}
+')
 
-; $1: vector width (e.g. 4)
-; $2: vector element type (e.g. float)
-; $3: bit width of vector element type (e.g. 32)
-; $4: operator to apply (e.g. fadd)
-; $5: identity element value (e.g. 0)
-; $6: suffix for function (e.g. add_float)
+; The exclusive scan is the inclusive one shifted up by one lane.
 
 define(`exclusive_scan', `
-define <$1 x $2> @__exclusive_scan_$6(<$1 x $2> %v,
-                                  <$1 x MASK> %mask) nounwind alwaysinline {
-  ; first, set the value of any off lanes to the identity value
-  %ptr = alloca <$1 x $2>
-  %idvec1 = bitcast $2 $5 to <1 x $2>
-  %idvec = shufflevector <1 x $2> %idvec1, <1 x $2> undef,
-      <$1 x i32> < forloop(i, 0, eval($1-2), `i32 0, ') i32 0 >
-  store <$1 x $2> %idvec, <$1 x $2> * %ptr
-  %ptr`'$3 = bitcast <$1 x $2> * %ptr to <$1 x i`'$3> *
-  %vi = bitcast <$1 x $2> %v to <$1 x i`'$3>
-  call void @__masked_store_blend_i$3(<$1 x i`'$3> * %ptr`'$3, <$1 x i`'$3> %vi,
-                                      <$1 x MASK> %mask)
-  %v_id = load PTR_OP_ARGS(`<$1 x $2> ')  %ptr
-
-  ; extract elements of the vector to use in computing the scan
-  forloop(i, 0, eval($1-1), `
-  %v`'i = extractelement <$1 x $2> %v_id, i32 i')
-
-  ; and just compute the scan directly.
-  ; 0th element is the identity (so nothing to do here),
-  ; 1st element is identity (op) the 0th element of the original vector,
-  ; each successive element is the previous element (op) the previous element
-  ;  of the original vector
-  %s1 = $4 $2 $5, %v0
-  forloop(i, 2, eval($1-1), `
-  %s`'i = $4 $2 %s`'eval(i-1), %v`'eval(i-1)')
-
-  ; and fill in the result vector
-  %r0 = insertelement <$1 x $2> undef, $2 $5, i32 0  ; 0th element gets identity
-  forloop(i, 1, eval($1-1), `
-  %r`'i = insertelement <$1 x $2> %r`'eval(i-1), $2 %s`'i, i32 i')
-
-  ret <$1 x $2> %r`'eval($1-1)
+define <$1 x $2> @__exclusive_scan_$5(<$1 x $2> %v,
+                                  <$1 x MASK> %mask) nounwind readnone alwaysinline {
+  %incl = call <$1 x $2> @__inclusive_scan_$5(<$1 x $2> %v, <$1 x MASK> %mask)
+  %r = shufflevector <$1 x $2> %incl, <$1 x $2> scan_splat($1, $2, $4),
+      <$1 x i32> scan_shift_indices($1, 1)
+  ret <$1 x $2> %r
 }
 ')
 
-define(`scans', `
-exclusive_scan(WIDTH, i32, 32, add, 0, add_i32)
-exclusive_scan(WIDTH, float, 32, fadd, zeroinitializer, add_float)
-exclusive_scan(WIDTH, i64, 64, add, 0, add_i64)
-exclusive_scan(WIDTH, double, 64, fadd, zeroinitializer, add_double)
+; Segmented scans restart at each lane where the given flag is set.  Each
+; step also shifts the flags up, so that a lane stops accumulating values
+; once a flag from any lane between it and the lane it is reading from
+; has been seen.
+; Arguments are the same as for the inclusive and exclusive scans.
+
+define(`segmented_scan', `
+define <$1 x $2> @__segmented_inclusive_scan_$5(<$1 x $2> %v, <$1 x MASK> %mask,
+                                  <$1 x MASK> %flags) nounwind readnone alwaysinline {
+  %m = icmp ne <$1 x MASK> %mask, zeroinitializer
+  %fl = icmp ne <$1 x MASK> %flags, zeroinitializer
+  %s0 = select <$1 x i1> %m, <$1 x $2> %v, <$1 x $2> scan_splat($1, $2, $4)
+  %f0 = and <$1 x i1> %fl, %m
+  forloop(k, 1, scan_steps_for_width($1), `
+  %sh`'k = shufflevector <$1 x $2> %s`'eval(k-1), <$1 x $2> scan_splat($1, $2, $4),
+      <$1 x i32> scan_shift_indices($1, eval(1 << (k-1)))
+  scan_combine($1, $2, $3, c`'k, sh`'k, s`'eval(k-1))
+  %s`'k = select <$1 x i1> %f`'eval(k-1), <$1 x $2> %s`'eval(k-1), <$1 x $2> %c`'k
+  %fsh`'k = shufflevector <$1 x i1> %f`'eval(k-1), <$1 x i1> zeroinitializer,
+      <$1 x i32> scan_shift_indices($1, eval(1 << (k-1)))
+  %f`'k = or <$1 x i1> %f`'eval(k-1), %fsh`'k')
+
+  ret <$1 x $2> %s`'scan_steps_for_width($1)
+}
+
+define <$1 x $2> @__segmented_exclusive_scan_$5(<$1 x $2> %v, <$1 x MASK> %mask,
+                                  <$1 x MASK> %flags) nounwind readnone alwaysinline {
+  %incl = call <$1 x $2> @__segmented_inclusive_scan_$5(<$1 x $2> %v,
+                  <$1 x MASK> %mask, <$1 x MASK> %flags)
+  %sh = shufflevector <$1 x $2> %incl, <$1 x $2> scan_splat($1, $2, $4),
+      <$1 x i32> scan_shift_indices($1, 1)
+  %m = icmp ne <$1 x MASK> %mask, zeroinitializer
+  %fl = icmp ne <$1 x MASK> %flags, zeroinitializer
+  %f = and <$1 x i1> %fl, %m
+  %r = select <$1 x i1> %f, <$1 x $2> scan_splat($1, $2, $4), <$1 x $2> %sh
+  ret <$1 x $2> %r
+}
+')
 
-exclusive_scan(WIDTH, i32, 32, and, -1, and_i32)
-exclusive_scan(WIDTH, i64, 64, and, -1, and_i64)
+define(`scan_both', `
+inclusive_scan($1, $2, $3, $4, $5)
+exclusive_scan($1, $2, $3, $4, $5)
+')
 
-exclusive_scan(WIDTH, i32, 32, or, 0, or_i32)
-exclusive_scan(WIDTH, i64, 64, or, 0, or_i64)
+define(`scans', `
+scan_both(WIDTH, i32, add, 0, add_i32)
+scan_both(WIDTH, float, fadd, 0.0, add_float)
+scan_both(WIDTH, i64, add, 0, add_i64)
+scan_both(WIDTH, double, fadd, 0.0, add_double)
+
+scan_both(WIDTH, i32, and, -1, and_i32)
+scan_both(WIDTH, i64, and, -1, and_i64)
+
+scan_both(WIDTH, i32, or, 0, or_i32)
+scan_both(WIDTH, i64, or, 0, or_i64)
+
+scan_both(WIDTH, i32, smin, 2147483647, min_int32)
+scan_both(WIDTH, i32, umin, -1, min_uint32)
+scan_both(WIDTH, float, fmin, 0x7FF0000000000000, min_float)
+scan_both(WIDTH, i64, smin, 9223372036854775807, min_int64)
+scan_both(WIDTH, i64, umin, -1, min_uint64)
+scan_both(WIDTH, double, fmin, 0x7FF0000000000000, min_double)
+
+scan_both(WIDTH, i32, smax, -2147483648, max_int32)
+scan_both(WIDTH, i32, umax, 0, max_uint32)
+scan_both(WIDTH, float, fmax, 0xFFF0000000000000, max_float)
+scan_both(WIDTH, i64, smax, -9223372036854775808, max_int64)
+scan_both(WIDTH, i64, umax, 0, max_uint64)
+scan_both(WIDTH, double, fmax, 0xFFF0000000000000, max_double)
+
+segmented_scan(WIDTH, i32, add, 0, add_i32)
+segmented_scan(WIDTH, float, fadd, 0.0, add_float)
+segmented_scan(WIDTH, i64, add, 0, add_i64)
+segmented_scan(WIDTH, double, fadd, 0.0, add_double)
 ')
 
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
@@ -0,0 +1,416 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file cache.cpp
+    @brief Implementation of the on-disk compilation cache.
+*/
+
+#include "cache.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef ISPC_IS_WINDOWS
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#define getpid _getpid
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_3_4 // LLVM 3.4+
+  #include <llvm/ADT/SmallString.h>
+  #include <llvm/Support/MD5.h>
+#endif
+
+// Version of the format of the entry files; it's part of their header so
+// that entries written by a different version of the format are ignored.
+#define CACHE_ENTRY_VERSION 1
+
+static const char *lEntrySuffix = ".entry";
+
+
+/** Creates the given directory, along with any of its parents that don't
+    exist yet. */
+static void
+lMakeDirectory(const std::string &path) {
+    for (size_t i = 1; i <= path.size(); ++i) {
+        if (i < path.size() && path[i] != '/' && path[i] != '\\')
+            continue;
+        std::string prefix = path.substr(0, i);
+#ifdef ISPC_IS_WINDOWS
+        _mkdir(prefix.c_str());
+#else
+        mkdir(prefix.c_str(), 0777);
+#endif
+    }
+}
+
+
+/** Reads the entire contents of the given file; returns false if it can't
+    be read. */
+static bool
+lReadFile(const std::string &path, std::vector<char> *data) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == NULL)
+        return false;
+
+    data->clear();
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data->insert(data->end(), buf, buf + n);
+    bool ok = (ferror(f) == 0);
+    fclose(f);
+    return ok;
+}
+
+
+/** Writes the given data to the given file, replacing its contents. */
+static bool
+lWriteFile(const std::string &path, const std::vector<char> &data) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == NULL)
+        return false;
+    bool ok = data.empty() ||
+        (fwrite(&data[0], 1, data.size(), f) == data.size());
+    if (fclose(f) != 0)
+        ok = false;
+    return ok;
+}
+
+
+/** Atomically (where the platform allows) replaces dst with src. */
+static bool
+lReplaceFile(const std::string &src, const std::string &dst) {
+#ifdef ISPC_IS_WINDOWS
+    return MoveFileExA(src.c_str(), dst.c_str(),
+                       MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(src.c_str(), dst.c_str()) == 0;
+#endif
+}
+
+
+/** Returns a name for a temporary file next to the given one that won't
+    collide with ones from other ispc processes. */
+static std::string
+lTempPath(const std::string &path) {
+    char suffix[32];
+    sprintf(suffix, ".tmp%d", (int)getpid());
+    return path + suffix;
+}
+
+
+struct CacheEntryInfo {
+    std::string path;
+    int64_t size;
+    time_t lastUse;
+
+    bool operator<(const CacheEntryInfo &other) const {
+        return lastUse < other.lastUse;
+    }
+};
+
+
+/** Finds all of the entries in the given cache directory. */
+static void
+lListEntries(const std::string &dir, std::vector<CacheEntryInfo> *entries) {
+    std::vector<std::string> names;
+#ifdef ISPC_IS_WINDOWS
+    WIN32_FIND_DATAA fd;
+    std::string pattern = dir + "\\*" + lEntrySuffix;
+    HANDLE h = FindFirstFileA(pattern.c_str(), &fd);
+    if (h == INVALID_HANDLE_VALUE)
+        return;
+    do {
+        names.push_back(fd.cFileName);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+        return;
+    struct dirent *de;
+    size_t suffixLength = strlen(lEntrySuffix);
+    while ((de = readdir(d)) != NULL) {
+        size_t length = strlen(de->d_name);
+        if (length > suffixLength &&
+            strcmp(de->d_name + length - suffixLength, lEntrySuffix) == 0)
+            names.push_back(de->d_name);
+    }
+    closedir(d);
+#endif
+
+    for (unsigned int i = 0; i < names.size(); ++i) {
+        CacheEntryInfo info;
+        info.path = dir + "/" + names[i];
+        struct stat st;
+        if (stat(info.path.c_str(), &st) != 0)
+            continue;
+        info.size = st.st_size;
+        info.lastUse = st.st_mtime;
+        entries->push_back(info);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+// CompileCache
+
+CompileCache::CompileCache(const std::string &d, int64_t max)
+    : dir(d), maxSize(max), lastFetchHit(false) {
+    lMakeDirectory(dir);
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_3_4 // LLVM 3.4+
+    hash = new llvm::MD5;
+#else
+    hash = NULL;
+    FATAL("The compilation cache requires LLVM 3.4 or later.");
+#endif
+}
+
+
+CompileCache::~CompileCache() {
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_3_4 // LLVM 3.4+
+    delete hash;
+#endif
+}
+
+
+void
+CompileCache::AddToKey(const std::string &s) {
+    Assert(key.empty());
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_3_4 // LLVM 3.4+
+    // Prefix each string with its length so that different sequences of
+    // strings with the same concatenation don't hash to the same key.
+    char length[32];
+    sprintf(length, "%d:", (int)s.size());
+    hash->update(length);
+    hash->update(s);
+#endif
+}
+
+
+const std::string &
+CompileCache::getKey() {
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_3_4 // LLVM 3.4+
+    if (key.empty()) {
+        llvm::MD5::MD5Result result;
+        hash->final(result);
+        llvm::SmallString<32> str;
+        llvm::MD5::stringifyResult(result, str);
+        key = std::string(str.begin(), str.end());
+    }
+#endif
+    return key;
+}
+
+
+std::string
+CompileCache::getEntryPath() {
+    return dir + "/" + getKey() + lEntrySuffix;
+}
+
+
+/* An entry file starts with a line with "ispc-cache-entry", the format
+   version and the number of files in it.  Each file then has a line with
+   the length of its path and its size, followed by the path and the
+   file's contents. */
+bool
+CompileCache::Fetch() {
+    std::string entryPath = getEntryPath();
+    std::vector<std::string> paths;
+    std::vector<std::vector<char> > contents;
+    bool hit = false;
+
+    FILE *f = fopen(entryPath.c_str(), "rb");
+    if (f != NULL) {
+        int version = 0, numFiles = 0;
+        hit = (fscanf(f, "ispc-cache-entry %d %d\n", &version, &numFiles) == 2 &&
+               version == CACHE_ENTRY_VERSION);
+        for (int i = 0; hit && i < numFiles; ++i) {
+            int pathLength = 0;
+            long long size = 0;
+            if (fscanf(f, "%d %lld\n", &pathLength, &size) != 2 ||
+                pathLength <= 0 || size < 0) {
+                hit = false;
+                break;
+            }
+            std::string path(pathLength, '\0');
+            std::vector<char> data((size_t)size);
+            hit = (fread(&path[0], 1, pathLength, f) == (size_t)pathLength) &&
+                (size == 0 || fread(&data[0], 1, (size_t)size, f) == (size_t)size);
+            paths.push_back(path);
+            contents.push_back(data);
+        }
+        fclose(f);
+    }
+
+    // Only write out the files once we know that the entry is complete.
+    for (unsigned int i = 0; hit && i < paths.size(); ++i)
+        hit = lWriteFile(paths[i], contents[i]);
+
+    if (hit)
+        // Mark the entry as recently used, for eviction.
+        utime(entryPath.c_str(), NULL);
+
+    lastFetchHit = hit;
+    updateStats(hit ? 1 : 0, hit ? 0 : 1, 0);
+    return hit;
+}
+
+
+void
+CompileCache::Store(const std::vector<std::string> &files) {
+    std::string entryPath = getEntryPath();
+    std::string tempPath = lTempPath(entryPath);
+
+    FILE *f = fopen(tempPath.c_str(), "wb");
+    if (f == NULL) {
+        Warning(SourcePos(), "Unable to write compilation cache entry \"%s\".",
+                tempPath.c_str());
+        return;
+    }
+
+    bool ok = fprintf(f, "ispc-cache-entry %d %d\n", CACHE_ENTRY_VERSION,
+                      (int)files.size()) > 0;
+    for (unsigned int i = 0; ok && i < files.size(); ++i) {
+        std::vector<char> data;
+        ok = lReadFile(files[i], &data) &&
+            fprintf(f, "%d %lld\n", (int)files[i].size(),
+                    (long long)data.size()) > 0 &&
+            fwrite(files[i].c_str(), 1, files[i].size(), f) == files[i].size() &&
+            (data.empty() ||
+             fwrite(&data[0], 1, data.size(), f) == data.size());
+    }
+    if (fclose(f) != 0)
+        ok = false;
+
+    // Write the entry under a temporary name and then move it into place,
+    // so that other ispc processes never see partially-written entries.
+    if (!ok || !lReplaceFile(tempPath, entryPath)) {
+        remove(tempPath.c_str());
+        Warning(SourcePos(), "Unable to write compilation cache entry \"%s\".",
+                entryPath.c_str());
+        return;
+    }
+
+    evict();
+}
+
+
+/** Removes the least-recently-used entries from the cache until its total
+    size is within its maximum size. */
+void
+CompileCache::evict() {
+    std::vector<CacheEntryInfo> entries;
+    lListEntries(dir, &entries);
+
+    int64_t totalSize = 0;
+    for (unsigned int i = 0; i < entries.size(); ++i)
+        totalSize += entries[i].size;
+    if (totalSize <= maxSize)
+        return;
+
+    std::sort(entries.begin(), entries.end());
+    int numEvicted = 0;
+    for (unsigned int i = 0; i < entries.size() && totalSize > maxSize; ++i) {
+        if (remove(entries[i].path.c_str()) == 0) {
+            totalSize -= entries[i].size;
+            ++numEvicted;
+        }
+    }
+    updateStats(0, 0, numEvicted);
+}
+
+
+/** Adds the given counts to the statistics stored in the cache
+    directory. */
+void
+CompileCache::updateStats(int64_t hits, int64_t misses, int64_t evictions) {
+    std::string statsPath = dir + "/stats";
+    long long total[3] = { 0, 0, 0 };
+    FILE *f = fopen(statsPath.c_str(), "r");
+    if (f != NULL) {
+        if (fscanf(f, "hits %lld\nmisses %lld\nevictions %lld\n",
+                   &total[0], &total[1], &total[2]) != 3)
+            total[0] = total[1] = total[2] = 0;
+        fclose(f);
+    }
+    total[0] += hits;
+    total[1] += misses;
+    total[2] += evictions;
+
+    // Concurrent updates from other ispc processes may be lost here; that's
+    // fine since the statistics are only informational.
+    std::string tempPath = lTempPath(statsPath);
+    f = fopen(tempPath.c_str(), "w");
+    if (f == NULL)
+        return;
+    fprintf(f, "hits %lld\nmisses %lld\nevictions %lld\n", total[0],
+            total[1], total[2]);
+    if (fclose(f) != 0 || !lReplaceFile(tempPath, statsPath))
+        remove(tempPath.c_str());
+}
+
+
+void
+CompileCache::PrintStats() {
+    long long total[3] = { 0, 0, 0 };
+    FILE *f = fopen((dir + "/stats").c_str(), "r");
+    if (f != NULL) {
+        if (fscanf(f, "hits %lld\nmisses %lld\nevictions %lld\n",
+                   &total[0], &total[1], &total[2]) != 3)
+            total[0] = total[1] = total[2] = 0;
+        fclose(f);
+    }
+
+    std::vector<CacheEntryInfo> entries;
+    lListEntries(dir, &entries);
+    int64_t totalSize = 0;
+    for (unsigned int i = 0; i < entries.size(); ++i)
+        totalSize += entries[i].size;
+
+    printf("Compilation cache \"%s\": %s\n", dir.c_str(),
+           lastFetchHit ? "hit" : "miss");
+    printf("    %lld hits, %lld misses, %lld evictions\n", total[0], total[1],
+           total[2]);
+    printf("    %d entries, %.1f of %.1f MB used\n", (int)entries.size(),
+           totalSize / (1024. * 1024.), maxSize / (1024. * 1024.));
+}
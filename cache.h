@@ -0,0 +1,101 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file cache.h
+    @brief Declaration of the CompileCache class, which implements the
+           on-disk cache of compiled outputs used with --cache-dir.
+*/
+
+#ifndef ISPC_CACHE_H
+#define ISPC_CACHE_H 1
+
+#include "ispc.h"
+
+namespace llvm {
+    class MD5;
+}
+
+/** @brief On-disk cache of the files generated by a compilation.
+
+    Each entry in the cache holds all of the output files (object files,
+    assembly, bitcode, and headers) from one compilation, stored under a key
+    that is a hash of everything that determines their contents: the
+    preprocessed source for each target, the target, the command-line
+    options, and the compiler version.  When the same compilation is run
+    again, the files are copied from the cache rather than being compiled.
+
+    The directory holds one file per entry, named by its key, along with a
+    file with hit/miss statistics.  When storing a new entry takes the cache
+    over its maximum size, the least-recently-used entries are evicted.
+    Failures to read or write the cache are never fatal; they just lead to
+    a regular compilation.
+ */
+class CompileCache {
+public:
+    /** Creates a cache in the given directory (which is created if it
+        doesn't exist), with the given maximum total size in bytes. */
+    CompileCache(const std::string &dir, int64_t maxSize);
+    ~CompileCache();
+
+    /** Adds the given string to the key for the current compilation.  All
+        of the calls to AddToKey() must happen before the first call to
+        Fetch(). */
+    void AddToKey(const std::string &s);
+
+    /** Looks for an entry for the current key.  If there is one, its files
+        are written back to where they were originally written to and true
+        is returned. */
+    bool Fetch();
+
+    /** Stores the given files as the entry for the current key, and then
+        evicts entries as needed to keep the cache under its maximum size. */
+    void Store(const std::vector<std::string> &files);
+
+    /** Prints whether the last lookup was a hit along with the overall
+        statistics for the cache. */
+    void PrintStats();
+
+private:
+    const std::string &getKey();
+    std::string getEntryPath();
+    void updateStats(int64_t hits, int64_t misses, int64_t evictions);
+    void evict();
+
+    std::string dir;
+    int64_t maxSize;
+    llvm::MD5 *hash;
+    std::string key;
+    bool lastFetchHit;
+};
+
+#endif // ISPC_CACHE_H
@@ -48,11 +48,13 @@
 #include <llvm/Support/Dwarf.h>
 #if ISPC_LLVM_VERSION == ISPC_LLVM_3_2
   #include <llvm/Metadata.h>
+  #include <llvm/MDBuilder.h>
   #include <llvm/Module.h>
   #include <llvm/Instructions.h>
   #include <llvm/DerivedTypes.h>
 #else
   #include <llvm/IR/Metadata.h>
+  #include <llvm/IR/MDBuilder.h>
   #include <llvm/IR/Module.h>
   #include <llvm/IR/Instructions.h>
   #include <llvm/IR/DerivedTypes.h>
@@ -278,6 +280,7 @@ FunctionEmitContext::FunctionEmitContext(Function *func, Symbol *funSym,
               launchGroupHandlePtr);
 
     disableGSWarningCount = 0;
+    versionedLoopDepth = 0;
 
     const Type *returnType = function->GetReturnType();
     if (!returnType || returnType->IsVoidType())
@@ -496,6 +499,21 @@ FunctionEmitContext::GetFullMaskPointer() {
 }
 
 
+bool
+FunctionEmitContext::IsFullMaskKnownAllOn() {
+    if (functionMaskValue != LLVMMaskAllOn || bblock == NULL)
+        return false;
+
+    llvm::BasicBlock::reverse_iterator iter = bblock->rbegin();
+    for (; iter != bblock->rend(); ++iter) {
+        llvm::StoreInst *st = llvm::dyn_cast<llvm::StoreInst>(&*iter);
+        if (st != NULL && st->getPointerOperand() == internalMaskPointer)
+            return (st->getValueOperand() == LLVMMaskAllOn);
+    }
+    return false;
+}
+
+
 void
 FunctionEmitContext::SetFunctionMask(llvm::Value *value) {
     functionMaskValue = value;
@@ -1265,6 +1283,25 @@ FunctionEmitContext::EnableGatherScatterWarnings() {
 }
 
 
+void
+FunctionEmitContext::StartVersionedLoop() {
+    ++versionedLoopDepth;
+}
+
+
+void
+FunctionEmitContext::EndVersionedLoop() {
+    AssertPos(currentPos, versionedLoopDepth > 0);
+    --versionedLoopDepth;
+}
+
+
+bool
+FunctionEmitContext::InVersionedLoop() const {
+    return versionedLoopDepth > 0;
+}
+
+
 
 bool
 FunctionEmitContext::initLabelBBlocks(ASTNode *node, void *data) {
@@ -1649,12 +1686,73 @@ lGetStringAsValue(llvm::BasicBlock *bblock, const char *s) {
 }
 
 
+/** Adds the given value to the given counter for the instrumentation
+    point with the given note at the current source position and returns
+    the counter's new value. */
+static llvm::Value *
+lAddToInstrumentationCounter(FunctionEmitContext *ctx, const char *note,
+                             Module::InstrumentationCounter counter,
+                             llvm::Value *value) {
+    llvm::Value *ptr =
+        m->GetInstrumentationCounter(ctx->GetDebugPos(), note, counter);
+    llvm::Value *oldValue = ctx->LoadInst(ptr, "counter");
+    llvm::Value *newValue =
+        ctx->BinaryOperator(llvm::Instruction::Add, oldValue, value,
+                            "counter_inc");
+    ctx->StoreInst(newValue, ptr);
+    return newValue;
+}
+
+
 void
-FunctionEmitContext::AddInstrumentationPoint(const char *note) {
+FunctionEmitContext::AddInstrumentationPoint(const char *note,
+                                             llvm::Value *mask) {
     AssertPos(currentPos, note != NULL);
     if (!g->emitInstrumentation)
         return;
 
+    if (mask == NULL)
+        mask = GetFullMask();
+
+    if (g->instrumentMode == Globals::Instrument_Counters) {
+        // Update the counters for this point in place, rather than
+        // calling out to the runtime.
+        llvm::Value *laneMask = LaneMask(mask);
+        llvm::Function *fpopcnt = m->module->getFunction("__popcnt_int64");
+        AssertPos(currentPos, fpopcnt != NULL);
+        llvm::Value *lanes = CallInst(fpopcnt, NULL, laneMask, "lanes");
+        llvm::Value *allOff =
+            ZExtInst(CmpInst(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_EQ,
+                             laneMask, LLVMInt64(0), "all_off"),
+                     LLVMTypes::Int64Type, "all_off64");
+
+        lAddToInstrumentationCounter(this, note, Module::Counter_Count,
+                                     LLVMInt64(1));
+        lAddToInstrumentationCounter(this, note, Module::Counter_Lanes, lanes);
+        lAddToInstrumentationCounter(this, note, Module::Counter_AllOff, allOff);
+        return;
+    }
+
+    llvm::BasicBlock *bDone = NULL;
+    if (g->instrumentMode == Globals::Instrument_Sampled) {
+        // Only call out to the runtime every instrumentSamplePeriod'th
+        // time that this point is reached.
+        llvm::Value *count =
+            lAddToInstrumentationCounter(this, note, Module::Counter_Count,
+                                         LLVMInt64(1));
+        llvm::Value *phase =
+            BinaryOperator(llvm::Instruction::URem, count,
+                           LLVMInt64(g->instrumentSamplePeriod), "phase");
+        llvm::Value *sample =
+            CmpInst(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_EQ, phase,
+                    LLVMInt64(0), "sample");
+        llvm::BasicBlock *bSample = CreateBasicBlock("instrument_sample");
+        bDone = CreateBasicBlock("instrument_done");
+        BranchInst(bSample, bDone, sample);
+        SetBranchWeights(1, g->instrumentSamplePeriod - 1);
+        SetCurrentBasicBlock(bSample);
+    }
+
     std::vector<llvm::Value *> args;
     // arg 1: filename as string
     args.push_back(lGetStringAsValue(bblock, currentPos.name));
@@ -1663,10 +1761,41 @@ FunctionEmitContext::AddInstrumentationPoint(const char *note) {
     // arg 3: line number
     args.push_back(LLVMInt32(currentPos.first_line));
     // arg 4: current mask, movmsk'ed down to an int64
-    args.push_back(LaneMask(GetFullMask()));
+    args.push_back(LaneMask(mask));
 
     llvm::Function *finst = m->module->getFunction("ISPCInstrument");
     CallInst(finst, NULL, args, "");
+
+    if (bDone != NULL) {
+        BranchInst(bDone);
+        SetCurrentBasicBlock(bDone);
+    }
+}
+
+
+void
+FunctionEmitContext::SetBranchWeights(uint64_t trueWeight,
+                                      uint64_t falseWeight) {
+    if (bblock == NULL)
+        return;
+    llvm::BranchInst *bi =
+        llvm::dyn_cast_or_null<llvm::BranchInst>(bblock->getTerminator());
+    if (bi == NULL || !bi->isConditional())
+        return;
+
+    // The weights are 32-bit, so scale large counts down, keeping both
+    // of them non-zero so that neither target is taken to be never
+    // executed.
+    while (trueWeight > 0xffffffffull || falseWeight > 0xffffffffull) {
+        trueWeight >>= 1;
+        falseWeight >>= 1;
+    }
+    uint32_t trueW = trueWeight > 0 ? (uint32_t)trueWeight : 1;
+    uint32_t falseW = falseWeight > 0 ? (uint32_t)falseWeight : 1;
+
+    llvm::MDBuilder mdBuilder(*g->ctx);
+    bi->setMetadata(llvm::LLVMContext::MD_prof,
+                    mdBuilder.createBranchWeights(trueW, falseW));
 }
 
 
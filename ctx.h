@@ -113,6 +113,12 @@ public:
         mask. */
     llvm::Value *GetFullMaskPointer();
 
+    /** Returns true if the full mask at the current point is known at
+        compile time to be all on: the function mask is the constant "all
+        on" value, as is the last value stored to the internal mask in the
+        current basic block. */
+    bool IsFullMaskKnownAllOn();
+
     /** Provides the value of the mask at function entry */
     void SetFunctionMask(llvm::Value *val);
 
@@ -255,6 +261,15 @@ public:
     /** Reenables emission of gather/scatter performance warnings. */
     void EnableGatherScatterWarnings();
 
+    /** Called before and after emitting the two versions of a loop that
+        has been versioned on whether the mask is all on. */
+    void StartVersionedLoop();
+    void EndVersionedLoop();
+
+    /** Indicates whether code is currently being emitted for either
+        version of a loop versioned on the mask. */
+    bool InVersionedLoop() const;
+
     void SetContinueTarget(llvm::BasicBlock *bb) { continueTarget = bb; }
 
     /** Step through the code and find label statements; create a basic
@@ -329,8 +344,15 @@ public:
 
     /** If the user has asked to compile the program with instrumentation,
         this inserts a callback to the user-supplied instrumentation
-        function at the current point in the code. */
-    void AddInstrumentationPoint(const char *note);
+        function at the current point in the code.  The mask of active
+        program instances that is reported is the given one, if non-NULL,
+        or the current full mask. */
+    void AddInstrumentationPoint(const char *note, llvm::Value *mask = NULL);
+
+    /** Attaches branch weight metadata to the conditional branch at the
+        end of the current basic block, giving the relative frequencies
+        with which its true and false targets are taken. */
+    void SetBranchWeights(uint64_t trueWeight, uint64_t falseWeight);
     /** @} */
 
     /** @name Debugging support
@@ -723,6 +745,10 @@ private:
         not yet reenabled) gather/scatter performance warnings. */
     int disableGSWarningCount;
 
+    /** Nesting count of loops versioned on the mask that we're currently
+        emitting code for. */
+    int versionedLoopDepth;
+
     std::map<std::string, llvm::BasicBlock *> labelMap;
 
     static bool initLabelBBlocks(ASTNode *node, void *data);
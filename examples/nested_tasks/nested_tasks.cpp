@@ -0,0 +1,114 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#define NOMINMAX
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+#include "../timing.h"
+#include "nested_tasks_ispc.h"
+using namespace ispc;
+
+
+static void usage() {
+    fprintf(stderr, "usage: nested_tasks [tiles depth fanout leaf_work tile_work] "
+            "[iterations]\n");
+    exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+    int numTiles = 64, depth = 4, fanout = 4;
+    int leafWork = 2000, tileWork = 2000000;
+    int iterations = 5;
+
+    if (argc != 1 && argc != 6 && argc != 7)
+        usage();
+    if (argc >= 6) {
+        numTiles = atoi(argv[1]);
+        depth = atoi(argv[2]);
+        fanout = atoi(argv[3]);
+        leafWork = atoi(argv[4]);
+        tileWork = atoi(argv[5]);
+    }
+    if (argc == 7)
+        iterations = atoi(argv[6]);
+    if (numTiles <= 0 || depth <= 0 || fanout <= 0 || iterations <= 0)
+        usage();
+
+    int leavesPerTile = 1;
+    for (int i = 0; i < depth; ++i)
+        leavesPerTile *= fanout;
+
+    printf("%d tiles, each launching a tree of depth %d with fanout %d "
+           "(%d leaves)\n", numTiles, depth, fanout, leavesPerTile);
+
+    std::vector<float> leafOut(numTiles * leavesPerTile);
+    std::vector<float> tileOut(numTiles);
+    std::vector<int64_t> syncLatency(numTiles);
+    std::vector<double> latencies;
+
+    double minTotal = 1e30;
+    for (int i = 0; i < iterations; ++i) {
+        reset_and_start_timer();
+        nested_tasks_ispc(numTiles, depth, fanout, leafWork, tileWork,
+                          leavesPerTile, &leafOut[0], &tileOut[0],
+                          &syncLatency[0]);
+        double dt = get_elapsed_mcycles();
+        printf("@time of ISPC + TASKS run:\t\t\t[%.3f] million cycles\n", dt);
+        minTotal = std::min(minTotal, dt);
+
+        for (int j = 0; j < numTiles; ++j)
+            latencies.push_back(syncLatency[j] * 1e-6);
+    }
+
+    // Report the distribution of the time each tile waited for its own
+    // tree of tasks, over all iterations.
+    std::sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    printf("[nested tasks sync latency median]:\t[%.3f] million cycles\n",
+           latencies[n / 2]);
+    printf("[nested tasks sync latency p90]:\t[%.3f] million cycles\n",
+           latencies[(n * 9) / 10]);
+    printf("[nested tasks sync latency max]:\t[%.3f] million cycles\n",
+           latencies[n - 1]);
+    printf("[nested tasks]:\t\t\t[%.3f] million cycles\n", minTotal);
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Checks that a program compiled with --new-delete-hooks calls ISPCNew()
+   and ISPCDelete() for its "new" and "delete" statements, and that the
+   memory it gets from the slab allocator in ../util/ispc_slab.cpp works.
+   The allocator's functions are renamed to ISPCSlabNew() and
+   ISPCSlabDelete() when it is compiled for this example (see the
+   Makefile), so that the ISPCNew() and ISPCDelete() here can count the
+   calls and the program instances they allocate and free memory for
+   before passing them on.
+ */
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#include <windows.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "newdelete_ispc.h"
+using namespace ispc;
+
+extern "C" {
+    void ISPCSlabNew(void **ptrs, const uint64_t *sizes, int32_t count,
+                     int32_t alignment, uint64_t mask);
+    void ISPCSlabDelete(void **ptrs, int32_t count, uint64_t mask);
+}
+
+static volatile int32_t newCalls, deleteCalls;
+static volatile int32_t liveAllocations;
+
+
+static int32_t
+lAtomicAdd(volatile int32_t *v, int32_t delta) {
+#ifdef _MSC_VER
+    return InterlockedExchangeAdd((volatile LONG *)v, delta) + delta;
+#else
+    return __sync_add_and_fetch(v, delta);
+#endif
+}
+
+
+static int32_t
+lCountLanes(int32_t count, uint64_t mask) {
+    int32_t n = 0;
+    for (int i = 0; i < count; ++i)
+        if (mask & (1ull << i))
+            ++n;
+    return n;
+}
+
+
+extern "C" void
+ISPCNew(void **ptrs, const uint64_t *sizes, int32_t count,
+        int32_t alignment, uint64_t mask) {
+    lAtomicAdd(&newCalls, 1);
+    lAtomicAdd(&liveAllocations, lCountLanes(count, mask));
+    ISPCSlabNew(ptrs, sizes, count, alignment, mask);
+}
+
+
+extern "C" void
+ISPCDelete(void **ptrs, int32_t count, uint64_t mask) {
+    lAtomicAdd(&deleteCalls, 1);
+    lAtomicAdd(&liveAllocations, -lCountLanes(count, mask));
+    ISPCSlabDelete(ptrs, count, mask);
+}
+
+
+static bool
+lCheck(const char *name, const float input[], const float output[],
+       int count) {
+    for (int i = 0; i < count; ++i) {
+        float expected = 0;
+        for (int j = 0; j < (i % 5) + 1; ++j)
+            expected += input[j];
+        if (output[i] != expected) {
+            fprintf(stderr, "%s: output[%d] = %f, expected %f\n", name, i,
+                    output[i], expected);
+            return false;
+        }
+    }
+    if (newCalls == 0 || deleteCalls == 0) {
+        fprintf(stderr, "%s: ISPCNew() called %d times, ISPCDelete() %d "
+                "times\n", name, (int)newCalls, (int)deleteCalls);
+        return false;
+    }
+    if (liveAllocations != 0) {
+        fprintf(stderr, "%s: %d allocations weren't deleted\n", name,
+                (int)liveAllocations);
+        return false;
+    }
+    printf("%s: ISPCNew() called %d times, ISPCDelete() %d times\n", name,
+           (int)newCalls, (int)deleteCalls);
+    return true;
+}
+
+
+int main() {
+    // Not a multiple of any gang size, so that the last iteration of the
+    // foreach loop runs with only some of the program instances active.
+    const int count = 1001;
+    float *input = new float[count];
+    float *output = new float[count];
+    for (int i = 0; i < count; ++i)
+        input[i] = (float)(i + 1);
+
+    bool ok = true;
+    sum_rows_ispc(input, output, count);
+    ok &= lCheck("sum_rows_ispc", input, output, count);
+
+    newCalls = deleteCalls = 0;
+    for (int i = 0; i < count; ++i)
+        output[i] = 0;
+    sum_rows_ispc_tasks(input, output, count, 16);
+    ok &= lCheck("sum_rows_ispc_tasks", input, output, count);
+
+    delete[] input;
+    delete[] output;
+    printf("%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -39,6 +39,8 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <algorithm>
 #include "../timing.h"
 
@@ -74,7 +76,67 @@ static PerfTest tests[] = {
     { ispc::scatters, "scatter", ispc::stores, "vector store", "Memory writes" },
 };
 
-int main() {
+/* Times gathers of a small table with 1 to programCount active program
+   instances, both with the target's gather and with scalar loads, and fits
+   the results to the compiler's gather cost model: a native gather has a
+   fixed cost, while scalar loads cost a fixed amount per active lane. */
+static int
+lCalibrateGatherCost() {
+    const int tableSize = 4096;
+    const int count = 64*1024;
+    const int reps = 100;
+    int width = ispc::gangSize();
+    float *table = new float[tableSize];
+    int *index = new int[count];
+    lInitData(table, tableSize);
+    srand(1);
+    for (int i = 0; i < count; ++i)
+        index[i] = rand() % tableSize;
+
+    double nativeSum = 0, sumK = 0, sumKK = 0, sumT = 0, sumKT = 0;
+    printf("%-8s %20s %20s\n", "active", "gather (cycles)", "scalar (cycles)");
+    for (int k = 1; k <= width; ++k) {
+        float result[1];
+        reset_and_start_timer();
+        for (int j = 0; j < reps; ++j)
+            ispc::gatherActive(table, index, count, k, result);
+        double nativeTime = get_elapsed_mcycles() * 1e6 / (reps * (count / width));
+
+        reset_and_start_timer();
+        for (int j = 0; j < reps; ++j)
+            ispc::scalarLoadsActive(table, index, count, k, result);
+        double scalarTime = get_elapsed_mcycles() * 1e6 / (reps * (count / width));
+
+        printf("%-8d %20.2f %20.2f\n", k, nativeTime, scalarTime);
+        nativeSum += nativeTime;
+        sumK += k;
+        sumKK += k * k;
+        sumT += scalarTime;
+        sumKT += k * scalarTime;
+    }
+
+    // Least-squares fit of scalarTime = overhead + laneCost * k; the
+    // overhead of the loop is common to both versions.
+    double laneCost = (width > 1) ?
+        (width * sumKT - sumK * sumT) / (width * sumKK - sumK * sumK) : sumT;
+    double overhead = (sumT - laneCost * sumK) / width;
+    double nativeCost = nativeSum / width - overhead;
+
+    printf("\nSuggested setting: --opt=gather-cost=%d,%d\n",
+           std::max(0, int(nativeCost + 0.5)), std::max(1, int(laneCost + 0.5)));
+    printf("(The first value is per gather call; divide it by the number of gather\n"
+           "instructions per call for targets wider than the hardware, e.g. by 2\n"
+           "for avx2-i32x16.)\n");
+
+    delete[] table;
+    delete[] index;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && !strcmp(argv[1], "--gather-cost"))
+        return lCalibrateGatherCost();
+
     int count = 3*64*1024;
     float *a = new float[count];
     float zeros[32] = { 0 };
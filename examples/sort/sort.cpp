@@ -135,6 +135,65 @@ int main (int argc, char *argv[])
 
   printf("\t\t\t\t(%.2fx speedup from ISPC, %.2fx speedup from ISPC + tasks)\n", tSerial/tISPC1, tSerial/tISPC2);
 
+  /* the standard library's merge sort against std::sort */
+  double tLib1 = 0.0, tLib2 = 0.0, tStd = 0.0;
+
+  srand (0);
+
+  for (i = 0; i < m; i ++)
+  {
+    for (j = 0; j < n; j ++) code [j] = rand() % l;
+
+    reset_and_start_timer();
+
+    sort_library_ispc (n, code, 1);
+
+    tLib1 += get_elapsed_mcycles();
+
+    if (argc != 3)
+        progressBar (i, m);
+  }
+
+  printf("[sort() ispc]:\t\t[%.3f] million cycles\n", tLib1);
+
+  srand (0);
+
+  for (i = 0; i < m; i ++)
+  {
+    for (j = 0; j < n; j ++) code [j] = rand() % l;
+
+    reset_and_start_timer();
+
+    sort_library_ispc (n, code, 0);
+
+    tLib2 += get_elapsed_mcycles();
+
+    if (argc != 3)
+        progressBar (i, m);
+  }
+
+  printf("[parallel_sort() ispc]:\t[%.3f] million cycles\n", tLib2);
+
+  srand (0);
+
+  for (i = 0; i < m; i ++)
+  {
+    for (j = 0; j < n; j ++) code [j] = rand() % l;
+
+    reset_and_start_timer();
+
+    std::sort (code, code + n);
+
+    tStd += get_elapsed_mcycles();
+
+    if (argc != 3)
+        progressBar (i, m);
+  }
+
+  printf("[std::sort]:\t\t[%.3f] million cycles\n", tStd);
+
+  printf("\t\t\t\t(%.2fx speedup from sort(), %.2fx speedup from parallel_sort())\n", tStd/tLib1, tStd/tLib2);
+
   delete code;
   delete order;
   return 0;
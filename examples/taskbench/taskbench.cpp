@@ -0,0 +1,304 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+*/
+
+/* Benchmarks for the task systems in ../tasksys.cpp: launch throughput,
+   launch/sync round-trip latency, nested launches, ISPCAlloc() throughput,
+   and a stencil for strong scaling (run with different values of
+   ISPC_NUM_THREADS / OMP_NUM_THREADS).  Results are printed in the usual
+   "[name]: [x] million cycles" form that perf.py parses and can also be
+   appended to a CSV file with --csv=<file>.
+ */
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+#include "../timing.h"
+#include "taskbench_ispc.h"
+using namespace ispc;
+
+// Task system entrypoints, from ../tasksys.cpp
+extern "C" {
+    void *ISPCAlloc(void **handlePtr, int64_t size, int32_t alignment);
+    void ISPCSync(void *handle);
+}
+
+
+static const char *
+lBackendName() {
+#if defined(ISPC_USE_WORK_STEALING)
+    return "work_stealing";
+#elif defined(ISPC_USE_PTHREADS_FULLY_SUBSCRIBED)
+    return "pthreads_fully_subscribed";
+#elif defined(ISPC_USE_PTHREADS)
+    return "pthreads";
+#elif defined(ISPC_USE_OMP)
+    return "omp";
+#elif defined(ISPC_USE_TBB_TASK_GROUP)
+    return "tbb_task_group";
+#elif defined(ISPC_USE_TBB_PARALLEL_FOR)
+    return "tbb_parallel_for";
+#elif defined(ISPC_USE_CILK)
+    return "cilk";
+#elif defined(ISPC_USE_CONCRT)
+    return "concrt";
+#elif defined(ISPC_USE_GCD)
+    return "gcd";
+#elif defined(ISPC_USE_HPX)
+    return "hpx";
+#else
+    return "default";
+#endif
+}
+
+
+/* Returns the number of threads the task system was asked to use. */
+static int
+lNumThreads() {
+    const char *env = getenv("ISPC_NUM_THREADS");
+    if (env == NULL)
+        env = getenv("OMP_NUM_THREADS");
+    if (env != NULL && atoi(env) > 0)
+        return atoi(env);
+#ifdef _MSC_VER
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+
+struct BenchOptions {
+    int iterations;
+    FILE *csv;
+};
+
+
+/* Prints the minimum time over all of the runs of a benchmark and adds it
+   to the CSV file, along with the cost per operation. */
+static void
+lReport(const BenchOptions &opts, const char *bench, int size, double mcycles,
+        double numOps, const char *op) {
+    printf("[taskbench %s]:\t[%.3f] million cycles\n", bench, mcycles);
+    printf("\t\t\t\t(%.1f cycles per %s)\n", mcycles * 1e6 / numOps, op);
+    if (opts.csv != NULL) {
+        fprintf(opts.csv, "%s,%d,%s,%d,%.6f,%.3f,%s\n", lBackendName(),
+                lNumThreads(), bench, size, mcycles, mcycles * 1e6 / numOps, op);
+        fflush(opts.csv);
+    }
+}
+
+
+static void
+lBenchLaunch(const BenchOptions &opts) {
+    const int count = 100000;
+    double minTime = 1e30;
+    for (int i = 0; i < opts.iterations; ++i) {
+        reset_and_start_timer();
+        launch_empty(count);
+        double dt = get_elapsed_mcycles();
+        printf("@time of launch run:\t\t\t[%.3f] million cycles\n", dt);
+        minTime = std::min(minTime, dt);
+    }
+    lReport(opts, "launch", count, minTime, count, "task");
+}
+
+
+static void
+lBenchLatency(const BenchOptions &opts) {
+    const int roundTrips = 10000;
+    double minTime = 1e30;
+    for (int i = 0; i < opts.iterations; ++i) {
+        reset_and_start_timer();
+        launch_sync_roundtrip(roundTrips);
+        double dt = get_elapsed_mcycles();
+        printf("@time of latency run:\t\t\t[%.3f] million cycles\n", dt);
+        minTime = std::min(minTime, dt);
+    }
+    lReport(opts, "latency", roundTrips, minTime, roundTrips, "round trip");
+}
+
+
+static void
+lBenchNested(const BenchOptions &opts) {
+    const int depth = 6, fanout = 6;
+    double numTasks = 0, level = 1;
+    for (int i = 0; i < depth; ++i) {
+        level *= fanout;
+        numTasks += level;
+    }
+
+    double minTime = 1e30;
+    for (int i = 0; i < opts.iterations; ++i) {
+        reset_and_start_timer();
+        launch_nested(depth, fanout);
+        double dt = get_elapsed_mcycles();
+        printf("@time of nested run:\t\t\t[%.3f] million cycles\n", dt);
+        minTime = std::min(minTime, dt);
+    }
+    lReport(opts, "nested", depth, minTime, numTasks, "task");
+}
+
+
+static void
+lBenchAlloc(const BenchOptions &opts) {
+    // Task groups are recycled, so this measures allocation from an
+    // already-warm arena after the first iteration.
+    const int numAllocs = 100000, allocSize = 64;
+    double minTime = 1e30;
+    for (int i = 0; i < opts.iterations; ++i) {
+        reset_and_start_timer();
+        void *handle = NULL;
+        for (int j = 0; j < numAllocs; ++j) {
+            void *ptr = ISPCAlloc(&handle, allocSize, 32);
+            if (ptr == NULL) {
+                fprintf(stderr, "ISPCAlloc() failed\n");
+                exit(1);
+            }
+        }
+        ISPCSync(handle);
+        double dt = get_elapsed_mcycles();
+        printf("@time of alloc run:\t\t\t[%.3f] million cycles\n", dt);
+        minTime = std::min(minTime, dt);
+    }
+    lReport(opts, "alloc", allocSize, minTime, numAllocs, "allocation");
+}
+
+
+static void
+lBenchStencil(const BenchOptions &opts) {
+    const int Nx = 256, Ny = 256, Nz = 256, steps = 6;
+    std::vector<float> A0(Nx * Ny * Nz), A1(Nx * Ny * Nz);
+    for (int i = 0; i < Nx * Ny * Nz; ++i)
+        A0[i] = A1[i] = (i % 17) * 0.125f;
+
+    double minTime = 1e30;
+    for (int i = 0; i < opts.iterations; ++i) {
+        reset_and_start_timer();
+        stencil_steps(steps, Nx, Ny, Nz, &A0[0], &A1[0]);
+        double dt = get_elapsed_mcycles();
+        printf("@time of stencil run:\t\t\t[%.3f] million cycles\n", dt);
+        minTime = std::min(minTime, dt);
+    }
+    lReport(opts, "stencil", Nx, minTime, steps, "step");
+}
+
+
+struct Benchmark {
+    const char *name;
+    void (*run)(const BenchOptions &opts);
+};
+
+static const Benchmark benchmarks[] = {
+    { "launch", lBenchLaunch },
+    { "latency", lBenchLatency },
+    { "nested", lBenchNested },
+    { "alloc", lBenchAlloc },
+    { "stencil", lBenchStencil },
+};
+static const int numBenchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+
+static void usage() {
+    fprintf(stderr, "usage: taskbench [--bench=<name>|all] [--csv=<file>] "
+            "[--iterations=<n>]\n");
+    fprintf(stderr, "benchmarks:");
+    for (int i = 0; i < numBenchmarks; ++i)
+        fprintf(stderr, " %s", benchmarks[i].name);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+    const char *bench = "all";
+    const char *csvFile = NULL;
+    BenchOptions opts;
+    opts.iterations = 5;
+    opts.csv = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--bench=", 8) == 0)
+            bench = argv[i] + 8;
+        else if (strncmp(argv[i], "--csv=", 6) == 0)
+            csvFile = argv[i] + 6;
+        else if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            opts.iterations = atoi(argv[i] + 13);
+            if (opts.iterations <= 0)
+                usage();
+        }
+        else
+            usage();
+    }
+
+    if (csvFile != NULL) {
+        opts.csv = fopen(csvFile, "a+");
+        if (opts.csv == NULL) {
+            perror(csvFile);
+            return 1;
+        }
+        // Write a header if we're starting a new file.
+        fseek(opts.csv, 0, SEEK_END);
+        if (ftell(opts.csv) == 0)
+            fprintf(opts.csv, "backend,threads,benchmark,size,mcycles,"
+                    "cycles_per_op,op\n");
+    }
+
+    printf("Task system: %s, %d threads\n", lBackendName(), lNumThreads());
+
+    bool found = false;
+    for (int i = 0; i < numBenchmarks; ++i) {
+        if (strcmp(bench, "all") == 0 || strcmp(bench, benchmarks[i].name) == 0) {
+            benchmarks[i].run(opts);
+            found = true;
+        }
+    }
+    if (!found)
+        usage();
+
+    if (opts.csv != NULL)
+        fclose(opts.csv);
+    return 0;
+}
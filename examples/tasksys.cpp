@@ -43,7 +43,8 @@
   There are several task systems in this file, built using:
     - Microsoft's Concurrency Runtime (ISPC_USE_CONCRT)
     - Apple's Grand Central Dispatch (ISPC_USE_GCD)
-    - bare pthreads (ISPC_USE_PTHREADS, ISPC_USE_PTHREADS_FULLY_SUBSCRIBED)
+    - bare pthreads (ISPC_USE_PTHREADS, ISPC_USE_PTHREADS_FULLY_SUBSCRIBED,
+      ISPC_USE_WORK_STEALING)
     - Cilk Plus (ISPC_USE_CILK)
     - TBB (ISPC_USE_TBB_TASK_GROUP, ISPC_USE_TBB_PARALLEL_FOR)
     - OpenMP (ISPC_USE_OMP)
@@ -69,6 +70,21 @@
   for task management.  This model is useful for KNC where tasks can take over 
   the machine, but less so when there are other tasks that need running on the machine.
 
+#define ISPC_USE_WORK_STEALING
+  The work-stealing model gives each thread its own Chase-Lev deque of task
+  index ranges.  A launch pushes a single range onto the launching thread's
+  deque; whoever runs a range splits it in half repeatedly, exposing the
+  upper halves to idle threads, which steal them without taking any locks.
+  There is no global mutex on the launch or task pickup paths.  Each
+  application thread that launches or syncs tasks gets its own deque and a
+  thread index after the worker threads' ones; threadCount covers all of
+  the threads that have a deque when the task runs.
+
+  With ISPC_USE_PTHREADS and ISPC_USE_WORK_STEALING, the total number of
+  threads that run tasks (including the application thread that syncs) can
+  be set with the ISPC_NUM_THREADS environment variable; it defaults to the
+  number of online cores.
+
 #define ISPC_USE_CREW
 #define ISPC_USE_HPX
   The HPX model requires the HPX runtime environment to be set up. This can be
@@ -77,13 +93,24 @@
   Number of threads can be specified as commandline parameter with
   --hpx:threads, use "all" to spawn one thread per processing unit.
 
+#define ISPC_USE_AFFINITY
+  Can be defined in addition to ISPC_USE_PTHREADS or ISPC_USE_WORK_STEALING
+  on Linux.  The NUMA topology is read from /sys/devices/system/node, and
+  worker threads are pinned to cores, filling one node before moving on to
+  the next.  With ISPC_USE_PTHREADS, the tasks of each launch are split into
+  contiguous index ranges, one per node, and workers prefer tasks from their
+  own node's range; with ISPC_USE_WORK_STEALING, idle workers try to steal
+  from threads on their own node first.  Task groups (and so the memory
+  that serves ISPCAlloc()) are recycled through per-node pools, so that
+  they stay on the node that first touched them.
+
 */
 
 #if !(defined ISPC_USE_CONCRT          || defined ISPC_USE_GCD              || \
       defined ISPC_USE_PTHREADS        || defined ISPC_USE_PTHREADS_FULLY_SUBSCRIBED || \
       defined ISPC_USE_TBB_TASK_GROUP  || defined ISPC_USE_TBB_PARALLEL_FOR || \
       defined ISPC_USE_OMP             || defined ISPC_USE_CILK             || \
-      defined ISPC_USE_HPX)
+      defined ISPC_USE_HPX             || defined ISPC_USE_WORK_STEALING)
 
     // If no task model chosen from the compiler cmdline, pick a reasonable default
     #if defined(_WIN32) || defined(_WIN64)
@@ -110,6 +137,15 @@
 #define ISPC_IS_KNC
 #endif
 
+#ifdef ISPC_USE_AFFINITY
+  #if !defined(ISPC_IS_LINUX)
+    #error "ISPC_USE_AFFINITY is only supported on Linux"
+  #endif
+  #if !defined(ISPC_USE_PTHREADS) && !defined(ISPC_USE_WORK_STEALING)
+    #error "ISPC_USE_AFFINITY requires ISPC_USE_PTHREADS or ISPC_USE_WORK_STEALING"
+  #endif
+#endif // ISPC_USE_AFFINITY
+
 
 #define DBG(x) 
 
@@ -127,7 +163,7 @@
 #endif // ISPC_USE_GCD
 #ifdef ISPC_USE_PTHREADS
   #include <pthread.h>
-  #include <semaphore.h>
+  #include <sched.h>
   #include <unistd.h>
   #include <fcntl.h>
   #include <errno.h>
@@ -153,6 +189,12 @@
 //#include <stdexcept>
 #include <stack>
 #endif // ISPC_USE_PTHREADS_FULLY_SUBSCRIBED
+#ifdef ISPC_USE_WORK_STEALING
+  #include <pthread.h>
+  #include <sched.h>
+  #include <unistd.h>
+  #include <errno.h>
+#endif // ISPC_USE_WORK_STEALING
 #ifdef ISPC_USE_TBB_PARALLEL_FOR
   #include <tbb/parallel_for.h>
 #endif // ISPC_USE_TBB_PARALLEL_FOR
@@ -169,8 +211,18 @@
 #include <hpx/include/async.hpp>
 #include <hpx/lcos/wait_all.hpp>
 #endif // ISPC_USE_HPX
+#ifdef ISPC_USE_AFFINITY
+  #include <pthread.h>
+  #include <sched.h>
+  #include <unistd.h>
+  #include <vector>
+#endif // ISPC_USE_AFFINITY
 #ifdef ISPC_IS_LINUX
   #include <malloc.h>
+  #ifdef ISPC_USE_PTHREADS
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+  #endif // ISPC_USE_PTHREADS
 #endif // ISPC_IS_LINUX
 
 #include <stdio.h>
@@ -179,6 +231,7 @@
 #include <assert.h>
 #include <string.h>
 #include <algorithm>
+#include <vector>
 
 // Signature of ispc-generated 'task' functions
 typedef void (*TaskFuncType)(void *data, int threadIndex, int threadCount,
@@ -221,6 +274,22 @@ __attribute__((aligned(32)));
 #endif
 ;
 
+/** Runs task number taskIndex of the launch described by the given
+    TaskInfo.  Used by task systems that support bulk launches, where a
+    single TaskInfo (with taskIndex zero) describes all of the tasks of a
+    launch and the per-task indices are computed when each task runs.
+ */
+static inline void
+lRunLaunchTask(const TaskInfo *launch, int taskIndex, int threadIndex,
+               int threadCount) {
+    int count0 = launch->taskCount0(), count1 = launch->taskCount1();
+    launch->func(launch->data, threadIndex, threadCount, taskIndex,
+                 launch->taskCount(),
+                 taskIndex % count0, (taskIndex / count0) % count1,
+                 taskIndex / (count0 * count1),
+                 count0, count1, launch->taskCount2());
+}
+
 // ispc expects these functions to have C linkage / not be mangled
 extern "C" { 
     void ISPCLaunch(void **handlePtr, void *f, void *data, int countx, int county, int countz);
@@ -232,15 +301,21 @@ extern "C" {
 // TaskGroupBase
 
 #define LOG_TASK_QUEUE_CHUNK_SIZE 14
-#define MAX_TASK_QUEUE_CHUNKS 8
 #define TASK_QUEUE_CHUNK_SIZE (1<<LOG_TASK_QUEUE_CHUNK_SIZE)
+/* Chunk i holds TASK_QUEUE_CHUNK_SIZE << i TaskInfos, so this many chunks
+   are enough to cover every non-negative int task index. */
+#define MAX_TASK_QUEUE_CHUNKS (32 - LOG_TASK_QUEUE_CHUNK_SIZE)
 
-#define MAX_LAUNCHED_TASKS (MAX_TASK_QUEUE_CHUNKS * TASK_QUEUE_CHUNK_SIZE)
-
+/* Initial number of ISPCAlloc() memory buffers we reserve room for; more
+   are added as needed. */
 #define NUM_MEM_BUFFERS 16
+/* Memory buffers double in size up to this (log2) size. */
+#define LOG_MAX_MEM_BUFFER_SIZE 30
 
 class TaskGroup;
 
+static void *lAtomicCompareAndSwapPointer(void **v, void *newValue, void *oldValue);
+
 /** The TaskGroupBase structure provides common functionality for "task
     groups"; a task group is the set of tasks launched from within a single
     ispc function.  When the function is ready to return, it waits for all
@@ -262,21 +337,24 @@ protected:
     int nextTaskInfoIndex;
 
 private:
-    /* We allocate blocks of TASK_QUEUE_CHUNK_SIZE TaskInfo structures as
-       needed by the calling function.  We hold up to MAX_TASK_QUEUE_CHUNKS
-       of these (and then exit at runtime if more than this many tasks are
-       launched.)
+    /* We allocate blocks of TaskInfo structures as needed by the calling
+       function, doubling the block size each time: taskInfo[i] holds
+       TASK_QUEUE_CHUNK_SIZE << i TaskInfos.  Blocks are published with a
+       compare-and-swap, so GetTaskInfo() may be called concurrently by
+       worker threads while the launching thread is adding more tasks.
      */
-    TaskInfo *taskInfo[MAX_TASK_QUEUE_CHUNKS];
+    TaskInfo * volatile taskInfo[MAX_TASK_QUEUE_CHUNKS];
 
     /* We also allocate chunks of memory to service ISPCAlloc() calls.  The
        memBuffers[] array holds pointers to this memory.  The first element
        of this array is initialized to point to mem and then any subsequent
-       elements required are initialized with dynamic allocation.
+       elements required are initialized with dynamic allocation; buffers
+       are kept (and reused if they're large enough) across Reset() calls.
      */
-    int curMemBuffer, curMemBufferOffset;
-    int memBufferSize[NUM_MEM_BUFFERS];
-    char *memBuffers[NUM_MEM_BUFFERS];
+    int curMemBuffer;
+    int64_t curMemBufferOffset;
+    std::vector<int64_t> memBufferSize;
+    std::vector<char *> memBuffers;
     char mem[256];
 };
 
@@ -286,12 +364,10 @@ inline TaskGroupBase::TaskGroupBase() {
 
     curMemBuffer = 0; 
     curMemBufferOffset = 0;
-    memBuffers[0] = mem;
-    memBufferSize[0] = sizeof(mem) / sizeof(mem[0]);
-    for (int i = 1; i < NUM_MEM_BUFFERS; ++i) {
-        memBuffers[i] = NULL;
-        memBufferSize[i] = 0;
-    }
+    memBuffers.reserve(NUM_MEM_BUFFERS);
+    memBufferSize.reserve(NUM_MEM_BUFFERS);
+    memBuffers.push_back(mem);
+    memBufferSize.push_back(sizeof(mem) / sizeof(mem[0]));
 
     for (int i = 0; i < MAX_TASK_QUEUE_CHUNKS; ++i)
         taskInfo[i] = NULL;
@@ -301,8 +377,10 @@ inline TaskGroupBase::TaskGroupBase() {
 inline TaskGroupBase::~TaskGroupBase() {
     // Note: don't delete memBuffers[0], since it points to the start of
     // the "mem" member!
-    for (int i = 1; i < NUM_MEM_BUFFERS; ++i)
+    for (int i = 1; i < (int)memBuffers.size(); ++i)
         delete[](memBuffers[i]);
+    for (int i = 0; i < MAX_TASK_QUEUE_CHUNKS; ++i)
+        delete[](taskInfo[i]);
 }
 
 
@@ -322,48 +400,73 @@ TaskGroupBase::AllocTaskInfo(int count) {
 }
 
 
+/** Returns the index of the most significant set bit of v, which must be
+    non-zero. */
+static inline int
+lLog2(uint32_t v) {
+#ifdef ISPC_IS_WINDOWS
+    unsigned long index;
+    _BitScanReverse(&index, v);
+    return (int)index;
+#else
+    return 31 - __builtin_clz(v);
+#endif // ISPC_IS_WINDOWS
+}
+
+
 inline TaskInfo *
 TaskGroupBase::GetTaskInfo(int index) {
-    int chunk = (index >> LOG_TASK_QUEUE_CHUNK_SIZE);
-    int offset = index & (TASK_QUEUE_CHUNK_SIZE-1);
-
-    if (chunk == MAX_TASK_QUEUE_CHUNKS) {
-        fprintf(stderr, "A total of %d tasks have been launched from the "
-                "current function--the simple built-in task system can handle "
-                "no more. You can increase the values of TASK_QUEUE_CHUNK_SIZE "
-                "and LOG_TASK_QUEUE_CHUNK_SIZE to work around this limitation.  "
-                "Sorry!  Exiting.\n", index);
-        exit(1);
+    // Chunk i starts at index TASK_QUEUE_CHUNK_SIZE * (2^i - 1).
+    uint32_t biased = ((uint32_t)index >> LOG_TASK_QUEUE_CHUNK_SIZE) + 1;
+    int chunk = lLog2(biased);
+    int offset = index - TASK_QUEUE_CHUNK_SIZE * ((1 << chunk) - 1);
+
+    TaskInfo *chunkInfo = taskInfo[chunk];
+    if (chunkInfo == NULL) {
+        TaskInfo *newChunk = new TaskInfo[(size_t)TASK_QUEUE_CHUNK_SIZE << chunk];
+        chunkInfo = (TaskInfo *)lAtomicCompareAndSwapPointer((void **)&taskInfo[chunk],
+                                                             newChunk, NULL);
+        if (chunkInfo == NULL)
+            chunkInfo = newChunk;
+        else
+            // Someone else published this chunk first
+            delete[] newChunk;
     }
-
-    if (taskInfo[chunk] == NULL)
-        taskInfo[chunk] = new TaskInfo[TASK_QUEUE_CHUNK_SIZE];
-    return &taskInfo[chunk][offset];
+    return &chunkInfo[offset];
 }
 
 
 inline void *
 TaskGroupBase::AllocMemory(int64_t size, int32_t alignment) {
-    char *basePtr = memBuffers[curMemBuffer];
-    intptr_t iptr = (intptr_t)(basePtr + curMemBufferOffset);
-    iptr = (iptr + (alignment-1)) & ~(alignment-1);
-
-    int newOffset = int(iptr - (intptr_t)basePtr + size);
-    if (newOffset < memBufferSize[curMemBuffer]) {
-        curMemBufferOffset = newOffset;
-        return (char *)iptr;
-    }
+    while (1) {
+        char *basePtr = memBuffers[curMemBuffer];
+        intptr_t iptr = (intptr_t)(basePtr + curMemBufferOffset);
+        iptr = (iptr + (alignment-1)) & ~(alignment-1);
+
+        int64_t newOffset = int64_t(iptr - (intptr_t)basePtr) + size;
+        if (newOffset < memBufferSize[curMemBuffer]) {
+            curMemBufferOffset = newOffset;
+            return (char *)iptr;
+        }
 
-    ++curMemBuffer;
-    curMemBufferOffset = 0;
-    assert(curMemBuffer < NUM_MEM_BUFFERS);
+        ++curMemBuffer;
+        curMemBufferOffset = 0;
 
-    int allocSize = 1 << (12 + curMemBuffer);
-    allocSize = std::max(int(size+alignment), allocSize);
-    char *newBuf = new char[allocSize];
-    memBufferSize[curMemBuffer] = allocSize;
-    memBuffers[curMemBuffer] = newBuf;
-    return AllocMemory(size, alignment);
+        int64_t allocSize = int64_t(1) << std::min(12 + curMemBuffer,
+                                                   LOG_MAX_MEM_BUFFER_SIZE);
+        allocSize = std::max(size + alignment, allocSize);
+        if (curMemBuffer == (int)memBuffers.size()) {
+            memBuffers.push_back(NULL);
+            memBufferSize.push_back(0);
+        }
+        if (memBufferSize[curMemBuffer] <= size + alignment) {
+            // The buffer left over from before the last Reset() (if any)
+            // is too small for this request; replace it.
+            delete[](memBuffers[curMemBuffer]);
+            memBuffers[curMemBuffer] = new char[allocSize];
+            memBufferSize[curMemBuffer] = allocSize;
+        }
+    }
 }
 
 
@@ -410,6 +513,168 @@ lAtomicAdd(volatile int32_t *v, int32_t delta) {
 #endif
 }
 
+#if defined(ISPC_USE_PTHREADS) || defined(ISPC_USE_WORK_STEALING)
+/** Returns the number of worker threads to launch: one fewer than the
+    number of cores (or than ISPC_NUM_THREADS, if set), since the thread
+    that syncs with a task group also runs tasks itself. */
+static int
+lNumWorkerThreads() {
+    int nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *env = getenv("ISPC_NUM_THREADS");
+    if (env != NULL && atoi(env) > 0)
+        nThreads = atoi(env);
+    return nThreads - 1;
+}
+#endif // ISPC_USE_PTHREADS || ISPC_USE_WORK_STEALING
+
+///////////////////////////////////////////////////////////////////////////
+// CPU and NUMA topology
+
+#ifdef ISPC_USE_AFFINITY
+
+/* Task groups are recycled through one pool per NUMA node, up to this many
+   nodes. */
+#define MAX_TASK_GROUP_POOLS 8
+
+/** Online CPUs and the NUMA node they belong to, as reported by sysfs.
+    Node numbers here are dense indices (0..numNodes-1), not the kernel's
+    node ids, which may have gaps.
+ */
+struct CpuTopology {
+    CpuTopology() : numNodes(0) { }
+
+    int numNodes;
+    /* Online CPU ids, ordered node by node. */
+    std::vector<int> cpus;
+    /* Dense node index for each CPU id, or -1 if unknown. */
+    std::vector<int> nodeOfCpu;
+};
+
+static CpuTopology topology;
+
+
+/** Parses a sysfs CPU or node list like "0-3,8-11" into the given vector.
+    Returns false if the file can't be read. */
+static bool
+lReadIdList(const char *path, std::vector<int> *ids) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+
+    char buf[4096];
+    bool ok = (fgets(buf, sizeof(buf), f) != NULL);
+    fclose(f);
+    if (!ok)
+        return false;
+
+    char *p = buf;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1)
+                return false;
+            p = end;
+        }
+        for (long i = first; i <= last; ++i)
+            ids->push_back((int)i);
+        if (*p == ',')
+            ++p;
+    }
+    return true;
+}
+
+
+static void
+lAddTopologyNode(const std::vector<int> &nodeCpus) {
+    if (nodeCpus.empty())
+        return;
+    for (size_t i = 0; i < nodeCpus.size(); ++i) {
+        int cpu = nodeCpus[i];
+        if (cpu >= (int)topology.nodeOfCpu.size())
+            topology.nodeOfCpu.resize(cpu + 1, -1);
+        topology.nodeOfCpu[cpu] = topology.numNodes;
+        topology.cpus.push_back(cpu);
+    }
+    ++topology.numNodes;
+}
+
+
+/** Reads the machine's topology from /sys.  If that isn't available, all
+    CPUs are treated as a single node. */
+static void
+lInitTopology() {
+    std::vector<int> nodes;
+    if (lReadIdList("/sys/devices/system/node/online", &nodes)) {
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            char path[128];
+            sprintf(path, "/sys/devices/system/node/node%d/cpulist", nodes[i]);
+            std::vector<int> nodeCpus;
+            if (lReadIdList(path, &nodeCpus))
+                lAddTopologyNode(nodeCpus);
+        }
+    }
+
+    if (topology.numNodes == 0) {
+        std::vector<int> allCpus;
+        if (!lReadIdList("/sys/devices/system/cpu/online", &allCpus)) {
+            int nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+            for (int i = 0; i < nCpus; ++i)
+                allCpus.push_back(i);
+        }
+        lAddTopologyNode(allCpus);
+    }
+    DBG(fprintf(stderr, "%d NUMA nodes, %d cpus\n", topology.numNodes,
+                (int)topology.cpus.size()));
+}
+
+
+/** Returns the (dense) NUMA node that the given CPU belongs to. */
+static inline int
+lNodeOfCpu(int cpu) {
+    if (cpu < 0 || cpu >= (int)topology.nodeOfCpu.size() ||
+        topology.nodeOfCpu[cpu] < 0)
+        return 0;
+    return topology.nodeOfCpu[cpu];
+}
+
+
+/** Returns the NUMA node the calling thread is currently running on. */
+static inline int
+lCurrentNode() {
+    return lNodeOfCpu(sched_getcpu());
+}
+
+
+/** Returns the CPU that the worker thread in the given slot is pinned to.
+    Slot 0 is left to the application's main thread, and slots are assigned
+    node by node so that consecutive workers share a node. */
+static inline int
+lCpuForWorkerSlot(int slot) {
+    return topology.cpus[slot % topology.cpus.size()];
+}
+
+
+/** Sets up the given thread attributes to pin the thread to the given
+    CPU. */
+static void
+lSetThreadAffinity(pthread_attr_t *attr, int cpu) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    int err = pthread_attr_setaffinity_np(attr, sizeof(cpuset), &cpuset);
+    if (err != 0)
+        fprintf(stderr, "Warning: unable to pin thread to cpu %d: %s\n", cpu,
+                strerror(err));
+}
+
+#endif // ISPC_USE_AFFINITY
+
 ///////////////////////////////////////////////////////////////////////////
 
 #ifdef ISPC_USE_CONCRT
@@ -443,35 +708,107 @@ private:
 #ifdef ISPC_USE_PTHREADS
 static void *lTaskEntry(void *arg);
 
+// Task groups keep one TaskInfo per launch and hand out tasks in chunks.
+#define TASKSYS_HAS_BULK_LAUNCH
+
+/** A range [begin, end) of the task indices of the launch described by
+    the TaskInfo at launchIndex.  Tasks are taken from the range grain at a
+    time. */
+struct TaskRange {
+    int launchIndex;
+    int begin, end;
+    int grain;
+};
+
 class TaskGroup : public TaskGroupBase {
 public:
     TaskGroup() {
         numUnfinishedTasks = 0;
-        waitingTasks.reserve(128);
+        parent = NULL;
+#ifdef ISPC_USE_AFFINITY
+        nodeWaitingTasks.resize(topology.numNodes);
+        for (int i = 0; i < topology.numNodes; ++i)
+            nodeWaitingTasks[i].reserve(8);
+        numWaitingTasks = 0;
+#else
+        waitingTasks.reserve(8);
+#endif // ISPC_USE_AFFINITY
         inActiveList = false;
     }
 
     void Reset() {
         TaskGroupBase::Reset();
         numUnfinishedTasks = 0;
+        parent = NULL;
         assert(inActiveList == false);
         lMemFence();
     }
 
-    void Launch(int baseIndex, int count);
+    void LaunchBulk(int launchIndex, int count);
     void Sync();
 
 private:
     friend void *lTaskEntry(void *arg);
 
+    // These must be called with taskSysMutex held.
+    int AddWaitingTasks(int launchIndex, int count);
+    bool HasWaitingTasks() const;
+    TaskRange PopWaitingTasks(int node);
+    bool IsDescendantOf(const TaskGroup *tg) const;
+
+    void RunTasks(const TaskRange &tasks, int threadIndex, int threadCount);
+
     int32_t numUnfinishedTasks;
     int32_t pad[3];
-    std::vector<int> waitingTasks;
+    /* The task group of the task that launched this group's tasks, or NULL
+       if they were launched from outside of any task.  A parent can't
+       finish syncing until all of its descendants have finished. */
+    TaskGroup *parent;
+#ifdef ISPC_USE_AFFINITY
+    /* Task ranges waiting to run, bucketed by the NUMA node whose workers
+       should preferably run them. */
+    std::vector<std::vector<TaskRange> > nodeWaitingTasks;
+    int numWaitingTasks;
+#else
+    std::vector<TaskRange> waitingTasks;
+#endif // ISPC_USE_AFFINITY
     bool inActiveList;
 };
 
 #endif // ISPC_USE_PTHREADS
 
+#ifdef ISPC_USE_WORK_STEALING
+struct WSWorker;
+struct TaskRange;
+static void lWSRunRange(WSWorker *worker, TaskRange *range);
+
+// Task groups keep one TaskInfo per launch; ranges of its tasks are split
+// lazily.
+#define TASKSYS_HAS_BULK_LAUNCH
+
+class TaskGroup : public TaskGroupBase {
+public:
+    TaskGroup() {
+        numUnfinishedTasks = 0;
+    }
+
+    void Reset() {
+        TaskGroupBase::Reset();
+        numUnfinishedTasks = 0;
+        lMemFence();
+    }
+
+    void LaunchBulk(int launchIndex, int count);
+    void Sync();
+
+private:
+    friend void lWSRunRange(WSWorker *worker, TaskRange *range);
+
+    volatile int32_t numUnfinishedTasks;
+};
+
+#endif // ISPC_USE_WORK_STEALING
+
 #ifdef ISPC_USE_CILK
 
 class TaskGroup : public TaskGroupBase {
@@ -485,9 +822,11 @@ public:
 
 #ifdef ISPC_USE_OMP
 
+#define TASKSYS_HAS_BULK_LAUNCH
+
 class TaskGroup : public TaskGroupBase {
 public:
-    void Launch(int baseIndex, int count);
+    void LaunchBulk(int launchIndex, int count);
     void Sync();
 
 };
@@ -653,12 +992,295 @@ static pthread_t *threads = NULL;
 
 static pthread_mutex_t taskSysMutex;
 static std::vector<TaskGroup *> activeTaskGroups;
-static sem_t *workerSemaphore;
+
+/* The task group of the task that the calling thread is running, if
+   any. */
+static __thread TaskGroup *currentTaskGroup = NULL;
+
+/* Number of times an idle worker polls for work before going to sleep. */
+#define WORKER_SPIN_COUNT 256
+
+/** Counting semaphore used to wake up worker threads when tasks are
+    launched.  Unlike a POSIX semaphore, Post() can release many waiters
+    with a single call (a single FUTEX_WAKE on Linux) and only wakes as
+    many threads as are actually asleep; the rest of the count is picked
+    up by workers that are still spinning in Wait().
+ */
+class WorkerSemaphore {
+public:
+    void Init();
+
+    void Post(int count);
+    void Wait();
+
+private:
+    bool TryDecrement();
+
+    volatile int32_t value;
+    volatile int32_t numSleeping;
+#ifndef ISPC_IS_LINUX
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif // !ISPC_IS_LINUX
+};
+
+
+void
+WorkerSemaphore::Init() {
+    value = 0;
+    numSleeping = 0;
+#ifndef ISPC_IS_LINUX
+    int err;
+    if ((err = pthread_mutex_init(&mutex, NULL)) != 0) {
+        fprintf(stderr, "Error creating mutex: %s\n", strerror(err));
+        exit(1);
+    }
+    if ((err = pthread_cond_init(&cond, NULL)) != 0) {
+        fprintf(stderr, "Error creating condition variable: %s\n", strerror(err));
+        exit(1);
+    }
+#endif // !ISPC_IS_LINUX
+    lMemFence();
+}
+
+
+inline bool
+WorkerSemaphore::TryDecrement() {
+    int32_t v = value;
+    while (v > 0) {
+        int32_t old = lAtomicCompareAndSwap32(&value, v - 1, v);
+        if (old == v)
+            return true;
+        v = old;
+    }
+    return false;
+}
+
+
+void
+WorkerSemaphore::Post(int count) {
+    if (count <= 0)
+        return;
+
+#ifdef ISPC_IS_LINUX
+    lAtomicAdd(&value, count);
+    // The add above is a full barrier, so any thread that went to sleep
+    // before it is accounted for in numSleeping, and any thread that goes
+    // to sleep after it will see the new value and not block.
+    int32_t sleeping = numSleeping;
+    if (sleeping > 0)
+        syscall(SYS_futex, &value, FUTEX_WAKE_PRIVATE, std::min(count, (int)sleeping),
+                NULL, NULL, 0);
+#else
+    int err;
+    if ((err = pthread_mutex_lock(&mutex)) != 0) {
+        fprintf(stderr, "Error from pthread_mutex_lock: %s\n", strerror(err));
+        exit(1);
+    }
+    lAtomicAdd(&value, count);
+    if (numSleeping > 0) {
+        if (count >= numSleeping)
+            err = pthread_cond_broadcast(&cond);
+        else {
+            for (int i = 0; i < count && err == 0; ++i)
+                err = pthread_cond_signal(&cond);
+        }
+        if (err != 0) {
+            fprintf(stderr, "Error from pthread_cond_signal: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    if ((err = pthread_mutex_unlock(&mutex)) != 0) {
+        fprintf(stderr, "Error from pthread_mutex_unlock: %s\n", strerror(err));
+        exit(1);
+    }
+#endif // ISPC_IS_LINUX
+}
+
+
+void
+WorkerSemaphore::Wait() {
+    // Spin for a while first: with fine-grained tasks, more work usually
+    // shows up before it would be worth going to sleep.
+    for (int i = 0; i < WORKER_SPIN_COUNT; ++i) {
+        if (TryDecrement())
+            return;
+        if (i >= WORKER_SPIN_COUNT / 2)
+            sched_yield();
+    }
+
+#ifdef ISPC_IS_LINUX
+    lAtomicAdd(&numSleeping, 1);
+    while (!TryDecrement())
+        // Only blocks if value is still zero when the kernel checks it.
+        syscall(SYS_futex, &value, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+    lAtomicAdd(&numSleeping, -1);
+#else
+    int err;
+    if ((err = pthread_mutex_lock(&mutex)) != 0) {
+        fprintf(stderr, "Error from pthread_mutex_lock: %s\n", strerror(err));
+        exit(1);
+    }
+    ++numSleeping;
+    while (!TryDecrement()) {
+        if ((err = pthread_cond_wait(&cond, &mutex)) != 0) {
+            fprintf(stderr, "Error from pthread_cond_wait: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    --numSleeping;
+    if ((err = pthread_mutex_unlock(&mutex)) != 0) {
+        fprintf(stderr, "Error from pthread_mutex_unlock: %s\n", strerror(err));
+        exit(1);
+    }
+#endif // ISPC_IS_LINUX
+}
+
+
+static WorkerSemaphore workerSemaphore;
+
+/* Launches are split into about this many chunks per thread. */
+#define CHUNKS_PER_THREAD 4
+
+/** Returns the number of tasks that workers should take at a time from a
+    launch of the given size, and (in *numChunks) how many chunks that
+    works out to. */
+static inline int
+lLaunchGrain(int count, int *numChunks) {
+    int grain = std::max(1, count / (CHUNKS_PER_THREAD * (nThreads + 1)));
+    *numChunks = (count + grain - 1) / grain;
+    return grain;
+}
+
+
+#ifdef ISPC_USE_AFFINITY
+
+inline int
+TaskGroup::AddWaitingTasks(int launchIndex, int count) {
+    // Give each node a contiguous range of the launch's task indices,
+    // since neighboring tasks usually touch neighboring data.
+    int numChunks = 0;
+    for (int node = 0; node < topology.numNodes; ++node) {
+        TaskRange range;
+        range.launchIndex = launchIndex;
+        range.begin = (int)(((int64_t)node * count) / topology.numNodes);
+        range.end = (int)(((int64_t)(node + 1) * count) / topology.numNodes);
+        if (range.begin == range.end)
+            continue;
+        int n;
+        range.grain = lLaunchGrain(range.end - range.begin, &n);
+        numChunks += n;
+        nodeWaitingTasks[node].push_back(range);
+        ++numWaitingTasks;
+    }
+    return numChunks;
+}
+
+
+inline bool
+TaskGroup::HasWaitingTasks() const {
+    return numWaitingTasks > 0;
+}
+
+
+inline TaskRange
+TaskGroup::PopWaitingTasks(int node) {
+    assert(numWaitingTasks > 0);
+    // Take tasks from our own node's range if there is one; otherwise
+    // help out with the nearest other node (in index order).
+    for (int i = 0; i < topology.numNodes; ++i) {
+        std::vector<TaskRange> &ranges = nodeWaitingTasks[(node + i) % topology.numNodes];
+        if (ranges.size() > 0) {
+            TaskRange &range = ranges.back();
+            TaskRange chunk = range;
+            chunk.begin = std::max(range.begin, range.end - range.grain);
+            range.end = chunk.begin;
+            if (range.begin == range.end) {
+                ranges.pop_back();
+                --numWaitingTasks;
+            }
+            return chunk;
+        }
+    }
+    assert(!"unreachable: no waiting tasks");
+    return TaskRange();
+}
+
+#else
+
+inline int
+TaskGroup::AddWaitingTasks(int launchIndex, int count) {
+    TaskRange range;
+    range.launchIndex = launchIndex;
+    range.begin = 0;
+    range.end = count;
+    int numChunks;
+    range.grain = lLaunchGrain(count, &numChunks);
+    waitingTasks.push_back(range);
+    return numChunks;
+}
+
+
+inline bool
+TaskGroup::HasWaitingTasks() const {
+    return waitingTasks.size() > 0;
+}
+
+
+inline TaskRange
+TaskGroup::PopWaitingTasks(int /* node */) {
+    assert(waitingTasks.size() > 0);
+    TaskRange &range = waitingTasks.back();
+    TaskRange chunk = range;
+    chunk.begin = std::max(range.begin, range.end - range.grain);
+    range.end = chunk.begin;
+    if (range.begin == range.end)
+        waitingTasks.pop_back();
+    return chunk;
+}
+
+#endif // ISPC_USE_AFFINITY
+
+
+inline bool
+TaskGroup::IsDescendantOf(const TaskGroup *tg) const {
+    for (const TaskGroup *p = parent; p != NULL; p = p->parent)
+        if (p == tg)
+            return true;
+    return false;
+}
+
+
+inline void
+TaskGroup::RunTasks(const TaskRange &tasks, int threadIndex, int threadCount) {
+    DBG(fprintf(stderr, "running tasks %d-%d of launch %d from group %p\n",
+                tasks.begin, tasks.end, tasks.launchIndex, this));
+    const TaskInfo *launch = GetTaskInfo(tasks.launchIndex);
+    TaskGroup *savedTaskGroup = currentTaskGroup;
+    currentTaskGroup = this;
+    for (int i = tasks.begin; i < tasks.end; ++i)
+        lRunLaunchTask(launch, i, threadIndex, threadCount);
+    currentTaskGroup = savedTaskGroup;
+
+    //
+    // Decrement the "number of unfinished tasks" counter in the task
+    // group.
+    //
+    lMemFence();
+    lAtomicAdd(&numUnfinishedTasks, -(tasks.end - tasks.begin));
+}
+
 
 static void *
 lTaskEntry(void *arg) {
     int threadIndex = (int)((int64_t)arg);
     int threadCount = nThreads;
+#ifdef ISPC_USE_AFFINITY
+    // Workers are pinned, so our node never changes.
+    int node = lNodeOfCpu(lCpuForWorkerSlot(threadIndex + 1));
+#else
+    int node = 0;
+#endif // ISPC_USE_AFFINITY
 
     while (1) {
         int err;
@@ -666,10 +1288,7 @@ lTaskEntry(void *arg) {
         // Wait on the semaphore until we're woken up due to the arrival of
         // more work.
         //
-        if ((err = sem_wait(workerSemaphore)) != 0) {
-            fprintf(stderr, "Error from sem_wait: %s\n", strerror(err));
-            exit(1);
-        }
+        workerSemaphore.Wait();
 
         //
         // Acquire the mutex
@@ -691,15 +1310,14 @@ lTaskEntry(void *arg) {
         }
 
         //
-        // Get the last task group on the active list and the last task
-        // from its waiting tasks list.
+        // Get the last task group on the active list and the last chunk
+        // of tasks from its waiting tasks list.
         //
         TaskGroup *tg = activeTaskGroups.back();
-        assert(tg->waitingTasks.size() > 0);
-        int taskNumber = tg->waitingTasks.back();
-        tg->waitingTasks.pop_back();
+        assert(tg->HasWaitingTasks());
+        TaskRange tasks = tg->PopWaitingTasks(node);
 
-        if (tg->waitingTasks.size() == 0) {
+        if (!tg->HasWaitingTasks()) {
             // We just took the last task from this task group, so remove
             // it from the active list.
             activeTaskGroups.pop_back();
@@ -712,21 +1330,9 @@ lTaskEntry(void *arg) {
         }
 
         //
-        // And now actually run the task
+        // And now actually run the tasks
         //
-        DBG(fprintf(stderr, "running task %d from group %p\n", taskNumber, tg));
-        TaskInfo *myTask = tg->GetTaskInfo(taskNumber);
-        myTask->func(myTask->data, threadIndex, threadCount, myTask->taskIndex,
-                     myTask->taskCount(),
-            myTask->taskIndex0(), myTask->taskIndex1(), myTask->taskIndex2(),
-            myTask->taskCount0(), myTask->taskCount1(), myTask->taskCount2());
-
-        //
-        // Decrement the "number of unfinished tasks" counter in the task
-        // group.
-        //
-        lMemFence();
-        lAtomicAdd(&tg->numUnfinishedTasks, -1);
+        tg->RunTasks(tasks, threadIndex, threadCount);
     }
 
     pthread_exit(NULL);
@@ -743,7 +1349,10 @@ InitTaskSystem() {
                     // We launch one fewer thread than there are cores,
                     // since the main thread here will also grab jobs from
                     // the task queue itself.
-                    nThreads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+                    nThreads = lNumWorkerThreads();
+#ifdef ISPC_USE_AFFINITY
+                    lInitTopology();
+#endif // ISPC_USE_AFFINITY
 
                     int err;
                     if ((err = pthread_mutex_init(&taskSysMutex, NULL)) != 0) {
@@ -751,27 +1360,17 @@ InitTaskSystem() {
                         exit(1);
                     }
 
-                    char name[32];
-                    bool success = false;
-                    srand(time(NULL));
-                    for (int i = 0; i < 10; i++) {
-                        sprintf(name, "ispc_task.%d.%d", (int)getpid(), (int)rand());
-                        workerSemaphore = sem_open(name, O_CREAT, S_IRUSR|S_IWUSR, 0);
-                        if (workerSemaphore != SEM_FAILED) {
-                            success = true;
-                            break;
-                        }
-                        fprintf(stderr, "Failed to create %s\n", name);
-                    }
-
-                    if (!success) {
-                        fprintf(stderr, "Error creating semaphore (%s): %s\n", name, strerror(errno));
-                        exit(1);
-                    }
+                    workerSemaphore.Init();
 
                     threads = (pthread_t *)malloc(nThreads * sizeof(pthread_t));
                     for (int i = 0; i < nThreads; ++i) {
-                      err = pthread_create(&threads[i], NULL, &lTaskEntry, (void *)((long long)i));
+                        pthread_attr_t attr;
+                        pthread_attr_init(&attr);
+#ifdef ISPC_USE_AFFINITY
+                        lSetThreadAffinity(&attr, lCpuForWorkerSlot(i + 1));
+#endif // ISPC_USE_AFFINITY
+                        err = pthread_create(&threads[i], &attr, &lTaskEntry, (void *)((long long)i));
+                        pthread_attr_destroy(&attr);
                         if (err != 0) {
                             fprintf(stderr, "Error creating pthread %d: %s\n", i, strerror(err));
                             exit(1);
@@ -793,7 +1392,7 @@ InitTaskSystem() {
 
 
 inline void
-TaskGroup::Launch(int baseCoord, int count) {
+TaskGroup::LaunchBulk(int launchIndex, int count) {
     //
     // Acquire mutex, add task
     //
@@ -810,8 +1409,8 @@ TaskGroup::Launch(int baseCoord, int count) {
     // only need to make sure no one else is accessing this task group's
     // waitingTasks list.  (But a small experiment in switching to a
     // per-TaskGroup mutex showed worse performance!)
-    for (int i = 0; i < count; ++i)
-        waitingTasks.push_back(baseCoord + i);
+    int numChunks = AddWaitingTasks(launchIndex, count);
+    parent = currentTaskGroup;
 
     // Add the task group to the global active list if it isn't there
     // already.
@@ -834,13 +1433,10 @@ TaskGroup::Launch(int baseCoord, int count) {
 
     //
     // Post to the worker semaphore to wake up worker threads that are
-    // sleeping waiting for tasks to show up
+    // sleeping waiting for tasks to show up; this wakes at most
+    // min(numChunks, number of sleeping workers) threads in one go.
     //
-    for (int i = 0; i < count; ++i)
-        if ((err = sem_post(workerSemaphore)) != 0) {
-            fprintf(stderr, "Error from sem_post: %s\n", strerror(err));
-            exit(1);
-        }
+    workerSemaphore.Post(numChunks);
 }
 
 
@@ -864,29 +1460,38 @@ TaskGroup::Sync() {
             exit(1);
         }
 
-        TaskInfo *myTask = NULL;
+#ifdef ISPC_USE_AFFINITY
+        int node = lCurrentNode();
+#else
+        int node = 0;
+#endif // ISPC_USE_AFFINITY
+        TaskRange tasks;
         TaskGroup *runtg = this;
-        if (waitingTasks.size() > 0) {
-            int taskNumber = waitingTasks.back();
-            waitingTasks.pop_back();
+        if (HasWaitingTasks()) {
+            tasks = PopWaitingTasks(node);
 
-            if (waitingTasks.size() == 0) {
+            if (!HasWaitingTasks()) {
                 // There's nothing left to start running from this group,
                 // so remove it from the active task list.
                 activeTaskGroups.erase(std::find(activeTaskGroups.begin(),
                                                  activeTaskGroups.end(), this));
                 inActiveList = false;
             }
-            myTask = GetTaskInfo(taskNumber);
-            DBG(fprintf(stderr, "running task %d from group %p in sync\n", taskNumber, tg));
         }
         else {
             // Other threads are already working on all of the tasks in
             // this group, so we can't help out by running one ourself.
-            // We'll try to run one from another group to make ourselves
-            // useful here.
-            if (activeTaskGroups.size() == 0) {
-                // No active task groups left--there's nothing for us to do.
+            // We'll try to run one from a group that was launched (directly
+            // or indirectly) by one of our tasks, since those have to
+            // finish before we can.  Running tasks from unrelated groups
+            // here could delay our return by however long they take.
+            int helpIndex = (int)activeTaskGroups.size() - 1;
+            while (helpIndex >= 0 && !activeTaskGroups[helpIndex]->IsDescendantOf(this))
+                --helpIndex;
+
+            if (helpIndex < 0) {
+                // None of our descendants have tasks waiting to be
+                // started--there's nothing for us to do.
                 if ((err = pthread_mutex_unlock(&taskSysMutex)) != 0) {
                     fprintf(stderr, "Error from pthread_mutex_unlock: %s\n", strerror(err));
                     exit(1);
@@ -904,21 +1509,17 @@ TaskGroup::Sync() {
                 continue;
             }
 
-            // Get a task to run from another task group.
-            runtg = activeTaskGroups.back();
-            assert(runtg->waitingTasks.size() > 0);
+            // Get a task to run from the descendant task group.
+            runtg = activeTaskGroups[helpIndex];
+            assert(runtg->HasWaitingTasks());
 
-            int taskNumber = runtg->waitingTasks.back();
-            runtg->waitingTasks.pop_back();
-            if (runtg->waitingTasks.size() == 0) {
-                // There's left to start running from this group, so remove
-                // it from the active task list.
-                activeTaskGroups.pop_back();
+            tasks = runtg->PopWaitingTasks(node);
+            if (!runtg->HasWaitingTasks()) {
+                // There's nothing left to start running from this group, so
+                // remove it from the active task list.
+                activeTaskGroups.erase(activeTaskGroups.begin() + helpIndex);
                 runtg->inActiveList = false;
             }
-            myTask = runtg->GetTaskInfo(taskNumber);
-            DBG(fprintf(stderr, "running task %d from other group %p in sync\n", 
-                        taskNumber, runtg));
         }
 
         if ((err = pthread_mutex_unlock(&taskSysMutex)) != 0) {
@@ -927,24 +1528,499 @@ TaskGroup::Sync() {
         }
     
         //
-        // Do work for _myTask_
+        // Do work for _tasks_
         //
         // FIXME: bogus values for thread index/thread count here as well..
-        myTask->func(myTask->data, 0, 1, myTask->taskIndex, myTask->taskCount(),
-            myTask->taskIndex0(), myTask->taskIndex1(), myTask->taskIndex2(),
-            myTask->taskCount0(), myTask->taskCount1(), myTask->taskCount2());
-
-        //
-        // Decrement the number of unfinished tasks counter
-        //
-        lMemFence();
-        lAtomicAdd(&runtg->numUnfinishedTasks, -1);
+        runtg->RunTasks(tasks, 0, 1);
     }
     DBG(fprintf(stderr, "sync for %p done!n", tg));
 }
 
 #endif // ISPC_USE_PTHREADS
 
+///////////////////////////////////////////////////////////////////////////
+// Work-stealing pthreads
+
+#ifdef ISPC_USE_WORK_STEALING
+
+/* Maximum number of threads (workers plus application threads that launch
+   or sync tasks) that can own a deque. */
+#define WS_MAX_WORKERS 1024
+/* Initial number of slots in each deque; deques grow as needed. */
+#define WS_LOG_INITIAL_DEQUE_SIZE 8
+/* Launches are split into at most this many ranges per thread. */
+#define WS_SPLITS_PER_THREAD 4
+/* Number of unsuccessful rounds of stealing before an idle worker sleeps. */
+#define WS_SPIN_ROUNDS 64
+/* Maximum number of TaskRanges cached on each thread's free list. */
+#define WS_MAX_FREE_RANGES 256
+
+/** A contiguous range [begin, end) of the task indices of the launch
+    described by the TaskInfo at launchIndex in the given task group.
+    Ranges larger than grain are split in half before they are run.
+ */
+struct TaskRange {
+    TaskGroup *group;
+    int launchIndex;
+    int begin, end;
+    int grain;
+    TaskRange *nextFree;
+};
+
+
+static inline int64_t
+lAtomicCompareAndSwap64(volatile int64_t *v, int64_t newValue, int64_t oldValue) {
+    int64_t result = __sync_val_compare_and_swap(v, oldValue, newValue);
+    lMemFence();
+    return result;
+}
+
+
+/** Chase-Lev work-stealing deque of TaskRanges.  The owning thread pushes
+    and pops at the bottom; other threads steal from the top with a single
+    compare-and-swap.  When the circular array fills up it is replaced with
+    one twice as large; old arrays are kept around (and freed with the
+    deque) since a concurrent thief may still be reading from them.
+ */
+class TaskDeque {
+public:
+    TaskDeque() {
+        top = bottom = 0;
+        array = new RangeArray(WS_LOG_INITIAL_DEQUE_SIZE, NULL);
+    }
+
+    ~TaskDeque() {
+        RangeArray *a = array;
+        while (a != NULL) {
+            RangeArray *prev = a->prev;
+            delete a;
+            a = prev;
+        }
+    }
+
+    void Push(TaskRange *range) {
+        int64_t b = bottom;
+        int64_t t = top;
+        RangeArray *a = array;
+        if (b - t >= a->Size() - 1) {
+            a = a->Grow(b, t);
+            lMemFence();
+            array = a;
+        }
+        a->Put(b, range);
+        lMemFence();
+        bottom = b + 1;
+    }
+
+    TaskRange *Pop() {
+        int64_t b = bottom - 1;
+        RangeArray *a = array;
+        bottom = b;
+        lMemFence();
+        int64_t t = top;
+
+        if (t > b) {
+            // The deque was already empty
+            bottom = t;
+            return NULL;
+        }
+
+        TaskRange *range = a->Get(b);
+        if (t == b) {
+            // Taking the last element; race against thieves for it.
+            if (lAtomicCompareAndSwap64(&top, t + 1, t) != t)
+                range = NULL;
+            bottom = t + 1;
+        }
+        return range;
+    }
+
+    TaskRange *Steal() {
+        int64_t t = top;
+        lMemFence();
+        int64_t b = bottom;
+        if (t >= b)
+            return NULL;
+
+        RangeArray *a = array;
+        TaskRange *range = a->Get(t);
+        if (lAtomicCompareAndSwap64(&top, t + 1, t) != t)
+            // Lost the race to the owner or another thief
+            return NULL;
+        return range;
+    }
+
+private:
+    struct RangeArray {
+        RangeArray(int logSize, RangeArray *p) {
+            logSlots = logSize;
+            slots = new TaskRange *[1 << logSize];
+            prev = p;
+        }
+        ~RangeArray() { delete[] slots; }
+
+        int64_t Size() const { return int64_t(1) << logSlots; }
+        TaskRange *Get(int64_t i) const { return slots[i & (Size() - 1)]; }
+        void Put(int64_t i, TaskRange *r) { slots[i & (Size() - 1)] = r; }
+
+        RangeArray *Grow(int64_t b, int64_t t) {
+            RangeArray *a = new RangeArray(logSlots + 1, this);
+            for (int64_t i = t; i < b; ++i)
+                a->Put(i, Get(i));
+            return a;
+        }
+
+        int logSlots;
+        TaskRange * volatile *slots;
+        RangeArray *prev;
+    };
+
+    volatile int64_t top;
+    // Keep the thieves' and the owner's indices on separate cache lines.
+    char pad[64];
+    volatile int64_t bottom;
+    RangeArray * volatile array;
+};
+
+
+/** Per-thread state: the thread's deque and a free list of TaskRanges.
+    TaskRanges are only ever touched by the thread that pushed them or the
+    single thread that successfully popped or stole them, so the free list
+    needs no synchronization.
+ */
+struct WSWorker {
+    WSWorker(int index, int n) {
+        threadIndex = index;
+        node = n;
+        freeRanges = NULL;
+        numFreeRanges = 0;
+        randomState = 2166136261u ^ (unsigned int)index;
+    }
+
+    TaskDeque deque;
+    int threadIndex;
+    /* NUMA node the thread runs on (always 0 without ISPC_USE_AFFINITY) */
+    int node;
+    TaskRange *freeRanges;
+    int numFreeRanges;
+    unsigned int randomState;
+};
+
+
+static volatile int32_t lock = 0;
+
+static int nThreads;
+static pthread_t *threads = NULL;
+
+static WSWorker *wsWorkers[WS_MAX_WORKERS];
+static volatile int32_t wsNumWorkers = 0;
+static __thread WSWorker *wsCurrentWorker = NULL;
+
+static pthread_mutex_t wsSleepMutex;
+static pthread_cond_t wsSleepCond;
+static volatile int32_t wsWorkEpoch = 0;
+static volatile int32_t wsNumSleeping = 0;
+
+
+/** Returns the calling thread's WSWorker, registering a deque for
+    application threads the first time they launch or sync. */
+static WSWorker *
+lWSGetWorker() {
+    if (wsCurrentWorker != NULL)
+        return wsCurrentWorker;
+
+    int index = lAtomicAdd(&wsNumWorkers, 1);
+    if (index >= WS_MAX_WORKERS) {
+        fprintf(stderr, "More than %d threads have launched tasks--the "
+                "work-stealing task system can handle no more.  You can "
+                "increase the value of WS_MAX_WORKERS to work around this "
+                "limitation.  Sorry!  Exiting.\n", WS_MAX_WORKERS);
+        exit(1);
+    }
+
+    // Each application thread gets its own deque slot, and its thread
+    // index is the index of that slot, after the worker threads' ones.
+#ifdef ISPC_USE_AFFINITY
+    int node = lCurrentNode();
+#else
+    int node = 0;
+#endif // ISPC_USE_AFFINITY
+    WSWorker *worker = new WSWorker(index, node);
+    lMemFence();
+    wsWorkers[index] = worker;
+    wsCurrentWorker = worker;
+    return worker;
+}
+
+
+static inline TaskRange *
+lWSAllocRange(WSWorker *worker) {
+    TaskRange *range = worker->freeRanges;
+    if (range == NULL)
+        return new TaskRange;
+    worker->freeRanges = range->nextFree;
+    --worker->numFreeRanges;
+    return range;
+}
+
+
+static inline void
+lWSFreeRange(WSWorker *worker, TaskRange *range) {
+    if (worker->numFreeRanges == WS_MAX_FREE_RANGES) {
+        delete range;
+        return;
+    }
+    range->nextFree = worker->freeRanges;
+    worker->freeRanges = range;
+    ++worker->numFreeRanges;
+}
+
+
+/** Wakes up sleeping workers after new work has been pushed.  The
+    (shared) work epoch and the mutex are only touched if some worker is
+    actually asleep, so that splitting ranges doesn't contend on them.
+    Workers count themselves as sleeping before their last check for work,
+    so either they find the work that was just pushed or we see them here.
+ */
+static inline void
+lWSWakeWorkers() {
+    lMemFence();
+    if (wsNumSleeping == 0)
+        return;
+
+    pthread_mutex_lock(&wsSleepMutex);
+    lAtomicAdd(&wsWorkEpoch, 1);
+    pthread_cond_broadcast(&wsSleepCond);
+    pthread_mutex_unlock(&wsSleepMutex);
+}
+
+
+/** Tries to steal a range from some other thread's deque, starting with a
+    randomly-chosen victim.  With ISPC_USE_AFFINITY, threads on the thief's
+    own NUMA node are tried before all of the others. */
+static TaskRange *
+lWSSteal(WSWorker *worker) {
+    int n = wsNumWorkers;
+    if (n > WS_MAX_WORKERS)
+        n = WS_MAX_WORKERS;
+
+    worker->randomState = worker->randomState * 1103515245u + 12345u;
+    int start = (worker->randomState >> 16) % n;
+#ifdef ISPC_USE_AFFINITY
+    for (int i = 0; i < n; ++i) {
+        WSWorker *victim = wsWorkers[(start + i) % n];
+        if (victim == NULL || victim == worker || victim->node != worker->node)
+            continue;
+        TaskRange *range = victim->deque.Steal();
+        if (range != NULL)
+            return range;
+    }
+#endif // ISPC_USE_AFFINITY
+    for (int i = 0; i < n; ++i) {
+        WSWorker *victim = wsWorkers[(start + i) % n];
+        if (victim == NULL || victim == worker)
+            continue;
+        TaskRange *range = victim->deque.Steal();
+        if (range != NULL)
+            return range;
+    }
+    return NULL;
+}
+
+
+static inline TaskRange *
+lWSFindWork(WSWorker *worker) {
+    TaskRange *range = worker->deque.Pop();
+    if (range != NULL)
+        return range;
+    return lWSSteal(worker);
+}
+
+
+static void
+lWSRunRange(WSWorker *worker, TaskRange *range) {
+    TaskGroup *tg = range->group;
+
+    // Keep the lower half of the range for ourselves and make the upper
+    // half available to other threads until what's left is small enough
+    // to run directly.
+    while (range->end - range->begin > range->grain) {
+        int mid = range->begin + (range->end - range->begin) / 2;
+        TaskRange *upper = lWSAllocRange(worker);
+        upper->group = tg;
+        upper->launchIndex = range->launchIndex;
+        upper->begin = mid;
+        upper->end = range->end;
+        upper->grain = range->grain;
+        range->end = mid;
+        worker->deque.Push(upper);
+        lWSWakeWorkers();
+    }
+
+    int begin = range->begin, end = range->end;
+    const TaskInfo *launch = tg->GetTaskInfo(range->launchIndex);
+    lWSFreeRange(worker, range);
+
+    DBG(fprintf(stderr, "running tasks %d-%d from group %p\n", begin, end, tg));
+    // Every thread that has a deque so far has a distinct thread index
+    // below this.
+    int threadCount = std::min((int)wsNumWorkers, WS_MAX_WORKERS);
+    for (int i = begin; i < end; ++i)
+        lRunLaunchTask(launch, i, worker->threadIndex, threadCount);
+
+    lMemFence();
+    lAtomicAdd(&tg->numUnfinishedTasks, -(end - begin));
+}
+
+
+static void *
+lWSWorkerEntry(void *arg) {
+    WSWorker *worker = wsWorkers[(int)((int64_t)arg)];
+    wsCurrentWorker = worker;
+
+    while (1) {
+        TaskRange *range = NULL;
+        for (int i = 0; i < WS_SPIN_ROUNDS && range == NULL; ++i) {
+            range = lWSFindWork(worker);
+            if (range == NULL)
+                sched_yield();
+        }
+
+        if (range == NULL) {
+            // Nothing to do; go to sleep until someone launches more work.
+            // We count ourselves as sleeping and then check for work once
+            // more with the mutex held; work pushed after that check is
+            // followed by an epoch bump that has to wait for the mutex,
+            // which pthread_cond_wait() only releases once we're waiting.
+            pthread_mutex_lock(&wsSleepMutex);
+            lAtomicAdd(&wsNumSleeping, 1);
+            int32_t epoch = wsWorkEpoch;
+            range = lWSFindWork(worker);
+            if (range == NULL) {
+                while (wsWorkEpoch == epoch)
+                    pthread_cond_wait(&wsSleepCond, &wsSleepMutex);
+            }
+            lAtomicAdd(&wsNumSleeping, -1);
+            pthread_mutex_unlock(&wsSleepMutex);
+            if (range == NULL)
+                continue;
+        }
+
+        lWSRunRange(worker, range);
+    }
+
+    pthread_exit(NULL);
+    return 0;
+}
+
+
+static void
+InitTaskSystem() {
+    if (threads == NULL) {
+        while (1) {
+            if (lAtomicCompareAndSwap32(&lock, 1, 0) == 0) {
+                if (threads == NULL) {
+                    // As with the pthreads task system, we launch one
+                    // fewer thread than there are cores, since the
+                    // launching thread runs tasks while it syncs.
+                    nThreads = lNumWorkerThreads();
+                    nThreads = std::max(0, std::min(nThreads, WS_MAX_WORKERS / 2));
+#ifdef ISPC_USE_AFFINITY
+                    lInitTopology();
+#endif // ISPC_USE_AFFINITY
+
+                    int err;
+                    if ((err = pthread_mutex_init(&wsSleepMutex, NULL)) != 0) {
+                        fprintf(stderr, "Error creating mutex: %s\n", strerror(err));
+                        exit(1);
+                    }
+                    if ((err = pthread_cond_init(&wsSleepCond, NULL)) != 0) {
+                        fprintf(stderr, "Error creating condition variable: %s\n",
+                                strerror(err));
+                        exit(1);
+                    }
+
+                    // Worker threads take the first nThreads deque slots
+                    // so that their thread indices are dense.
+                    for (int i = 0; i < nThreads; ++i) {
+#ifdef ISPC_USE_AFFINITY
+                        int node = lNodeOfCpu(lCpuForWorkerSlot(i + 1));
+#else
+                        int node = 0;
+#endif // ISPC_USE_AFFINITY
+                        wsWorkers[i] = new WSWorker(i, node);
+                    }
+                    wsNumWorkers = nThreads;
+                    lMemFence();
+
+                    pthread_t *newThreads = (pthread_t *)malloc(nThreads * sizeof(pthread_t));
+                    for (int i = 0; i < nThreads; ++i) {
+                        pthread_attr_t attr;
+                        pthread_attr_init(&attr);
+#ifdef ISPC_USE_AFFINITY
+                        lSetThreadAffinity(&attr, lCpuForWorkerSlot(i + 1));
+#endif // ISPC_USE_AFFINITY
+                        err = pthread_create(&newThreads[i], &attr, &lWSWorkerEntry,
+                                             (void *)((long long)i));
+                        pthread_attr_destroy(&attr);
+                        if (err != 0) {
+                            fprintf(stderr, "Error creating pthread %d: %s\n", i, strerror(err));
+                            exit(1);
+                        }
+                    }
+                    lMemFence();
+                    threads = newThreads;
+                }
+
+                // Make sure all of the above goes to memory before we
+                // clear the lock.
+                lMemFence();
+                lock = 0;
+                break;
+            }
+        }
+    }
+}
+
+
+inline void
+TaskGroup::LaunchBulk(int launchIndex, int count) {
+    // Account for the tasks before any of them can possibly finish.
+    lMemFence();
+    lAtomicAdd(&numUnfinishedTasks, count);
+
+    WSWorker *worker = lWSGetWorker();
+    TaskRange *range = lWSAllocRange(worker);
+    range->group = this;
+    range->launchIndex = launchIndex;
+    range->begin = 0;
+    range->end = count;
+    range->grain = std::max(1, count / (WS_SPLITS_PER_THREAD * (nThreads + 1)));
+    worker->deque.Push(range);
+
+    lWSWakeWorkers();
+}
+
+
+inline void
+TaskGroup::Sync() {
+    DBG(fprintf(stderr, "syncing %p - %d unfinished\n", this, numUnfinishedTasks));
+
+    WSWorker *worker = lWSGetWorker();
+    while (numUnfinishedTasks > 0) {
+        // Help out: our own deque holds the most recently launched (and
+        // so typically our own) ranges; otherwise steal from someone else.
+        TaskRange *range = lWSFindWork(worker);
+        if (range != NULL)
+            lWSRunRange(worker, range);
+        else
+            sched_yield();
+    }
+    DBG(fprintf(stderr, "sync for %p done!\n", this));
+}
+
+#endif // ISPC_USE_WORK_STEALING
+
 ///////////////////////////////////////////////////////////////////////////
 // Cilk Plus
 
@@ -985,7 +2061,8 @@ InitTaskSystem() {
 }
 
 inline void
-TaskGroup::Launch(int baseIndex, int count) {
+TaskGroup::LaunchBulk(int launchIndex, int count) {
+    const TaskInfo *launch = GetTaskInfo(launchIndex);
 #pragma omp parallel
   {
     const int threadIndex = omp_get_thread_num();
@@ -994,12 +2071,8 @@ TaskGroup::Launch(int baseIndex, int count) {
 #pragma omp for schedule(runtime)
     for(int i = 0; i < count; i++) 
     {
-        TaskInfo *ti = GetTaskInfo(baseIndex + i);
-
         // Actually run the task. 
-        ti->func(ti->data, threadIndex, threadCount, ti->taskIndex, ti->taskCount(),
-            ti->taskIndex0(), ti->taskIndex1(), ti->taskIndex2(),
-            ti->taskCount0(), ti->taskCount1(), ti->taskCount2());
+        lRunLaunchTask(launch, i, threadIndex, threadCount);
     }
   }
 }
@@ -1106,14 +2179,32 @@ TaskGroup::Sync() {
 #ifndef ISPC_USE_PTHREADS_FULLY_SUBSCRIBED
 
 #define MAX_FREE_TASK_GROUPS 64
-static TaskGroup *freeTaskGroups[MAX_FREE_TASK_GROUPS];
+
+#ifndef ISPC_USE_AFFINITY
+#define MAX_TASK_GROUP_POOLS 1
+#endif // !ISPC_USE_AFFINITY
+
+/* With ISPC_USE_AFFINITY, there's one pool of free task groups per NUMA
+   node; a task group's memory stays on the node of the thread that first
+   used it, so it should only be reused by threads on that same node. */
+static TaskGroup *freeTaskGroups[MAX_TASK_GROUP_POOLS][MAX_FREE_TASK_GROUPS];
+
+static inline TaskGroup **
+lTaskGroupPool() {
+#ifdef ISPC_USE_AFFINITY
+    return freeTaskGroups[lCurrentNode() % MAX_TASK_GROUP_POOLS];
+#else
+    return freeTaskGroups[0];
+#endif // ISPC_USE_AFFINITY
+}
 
 static inline TaskGroup *
 AllocTaskGroup() {
+    TaskGroup **pool = lTaskGroupPool();
     for (int i = 0; i < MAX_FREE_TASK_GROUPS; ++i) {
-        TaskGroup *tg = freeTaskGroups[i];
+        TaskGroup *tg = pool[i];
         if (tg != NULL) {
-            void *ptr = lAtomicCompareAndSwapPointer((void **)(&freeTaskGroups[i]), NULL, tg);
+            void *ptr = lAtomicCompareAndSwapPointer((void **)(&pool[i]), NULL, tg);
             if (ptr != NULL) {
                 return (TaskGroup *)ptr;
             }
@@ -1128,9 +2219,10 @@ static inline void
 FreeTaskGroup(TaskGroup *tg) {
     tg->Reset();
 
+    TaskGroup **pool = lTaskGroupPool();
     for (int i = 0; i < MAX_FREE_TASK_GROUPS; ++i) {
-        if (freeTaskGroups[i] == NULL) {
-            void *ptr = lAtomicCompareAndSwapPointer((void **)&freeTaskGroups[i], tg, NULL);
+        if (pool[i] == NULL) {
+            void *ptr = lAtomicCompareAndSwapPointer((void **)&pool[i], tg, NULL);
             if (ptr == NULL)
                 return;
         }
@@ -1153,6 +2245,19 @@ ISPCLaunch(void **taskGroupPtr, void *func, void *data, int count0, int count1,
     else
         taskGroup = (TaskGroup *)(*taskGroupPtr);
 
+#ifdef TASKSYS_HAS_BULK_LAUNCH
+    // A single TaskInfo describes the whole launch; the task system splits
+    // it up into individual tasks as it runs them.
+    int launchIndex = taskGroup->AllocTaskInfo(1);
+    TaskInfo *ti = taskGroup->GetTaskInfo(launchIndex);
+    ti->func = (TaskFuncType)func;
+    ti->data = data;
+    ti->taskIndex = 0;
+    ti->taskCount3d[0] = count0;
+    ti->taskCount3d[1] = count1;
+    ti->taskCount3d[2] = count2;
+    taskGroup->LaunchBulk(launchIndex, count);
+#else
     int baseIndex = taskGroup->AllocTaskInfo(count);
     for (int i = 0; i < count; ++i) {
         TaskInfo *ti = taskGroup->GetTaskInfo(baseIndex+i);
@@ -1164,6 +2269,7 @@ ISPCLaunch(void **taskGroupPtr, void *func, void *data, int count0, int count1,
         ti->taskCount3d[2] = count2;
     }
     taskGroup->Launch(baseIndex, count);
+#endif // TASKSYS_HAS_BULK_LAUNCH
 }
 
 
@@ -0,0 +1,217 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ispc_profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <vector>
+#ifdef _MSC_VER
+#include <windows.h>
+#endif
+
+struct SiteKey {
+    SiteKey(const char *f, const char *n, int l) : fn(f), note(n), line(l) { }
+    bool operator<(const SiteKey &k) const {
+        if (fn != k.fn) return fn < k.fn;
+        if (note != k.note) return note < k.note;
+        return line < k.line;
+    }
+    // The strings are constants in the compiled program, so the pointers
+    // identify them.
+    const char *fn;
+    const char *note;
+    int line;
+};
+
+struct SiteInfo {
+    SiteInfo() { count = laneCount = allOff = 0; }
+    uint64_t count;
+    uint64_t laneCount;
+    uint64_t allOff;
+};
+
+// Layout of the elements of the table of instrumentation points that is
+// passed to ISPCInstrumentRegister().
+struct ISPCInstrumentSite {
+    const char *fn;
+    const char *note;
+    int32_t line;
+};
+
+// Each instrumentation point has three counters: the number of times it
+// was reached, the total number of active program instances and the
+// number of times that none were active.
+struct CounterTable {
+    const ISPCInstrumentSite *sites;
+    uint64_t *counters;
+    int count;
+};
+
+static std::map<SiteKey, SiteInfo> *siteInfo;
+static std::vector<CounterTable> *counterTables;
+static volatile long profileLock;
+static bool registeredAtExit;
+
+
+static void
+lLock() {
+#ifdef _MSC_VER
+    while (InterlockedExchange(&profileLock, 1) != 0)
+        ;
+#else
+    while (__sync_lock_test_and_set(&profileLock, 1) != 0)
+        ;
+#endif
+}
+
+
+static void
+lUnlock() {
+#ifdef _MSC_VER
+    InterlockedExchange(&profileLock, 0);
+#else
+    __sync_lock_release(&profileLock);
+#endif
+}
+
+
+static int
+lCountBits(uint64_t i) {
+    int ret = 0;
+    while (i) {
+        i &= i - 1;
+        ++ret;
+    }
+    return ret;
+}
+
+
+static void
+lWriteProfileAtExit() {
+    const char *filename = getenv("ISPC_PROFILE");
+    ISPCWriteProfile(filename != NULL ? filename : "ispc.profile");
+}
+
+
+static void
+lRegisterAtExit() {
+    if (!registeredAtExit) {
+        atexit(lWriteProfileAtExit);
+        registeredAtExit = true;
+    }
+}
+
+
+void
+ISPCInstrument(const char *fn, const char *note, int line, uint64_t mask) {
+    lLock();
+    if (siteInfo == NULL) {
+        siteInfo = new std::map<SiteKey, SiteInfo>;
+        lRegisterAtExit();
+    }
+
+    SiteInfo &si = (*siteInfo)[SiteKey(fn, note, line)];
+    ++si.count;
+    if (mask == 0)
+        ++si.allOff;
+    si.laneCount += lCountBits(mask);
+    lUnlock();
+}
+
+
+void
+ISPCInstrumentRegister(const void *sites, uint64_t *counters, int32_t count) {
+    CounterTable table;
+    table.sites = (const ISPCInstrumentSite *)sites;
+    table.counters = counters;
+    table.count = count;
+
+    lLock();
+    if (counterTables == NULL) {
+        counterTables = new std::vector<CounterTable>;
+        lRegisterAtExit();
+    }
+    counterTables->push_back(table);
+    lUnlock();
+}
+
+
+void
+ISPCWriteProfile(const char *filename) {
+    lLock();
+    if ((siteInfo == NULL || siteInfo->empty()) && counterTables == NULL) {
+        lUnlock();
+        return;
+    }
+
+    FILE *f = fopen(filename, "a");
+    if (f == NULL) {
+        fprintf(stderr, "Unable to open profile file \"%s\".\n", filename);
+        lUnlock();
+        return;
+    }
+
+    // See profile.h in the ispc sources for a description of the format.
+    fprintf(f, "# count\tlanes\tall off\tline\tfile\tnote\n");
+    if (siteInfo != NULL) {
+        std::map<SiteKey, SiteInfo>::iterator iter;
+        for (iter = siteInfo->begin(); iter != siteInfo->end(); ++iter)
+            fprintf(f, "%llu\t%llu\t%llu\t%d\t%s\t%s\n",
+                    (unsigned long long)iter->second.count,
+                    (unsigned long long)iter->second.laneCount,
+                    (unsigned long long)iter->second.allOff,
+                    iter->first.line, iter->first.fn, iter->first.note);
+        siteInfo->clear();
+    }
+
+    if (counterTables != NULL) {
+        for (size_t i = 0; i < counterTables->size(); ++i) {
+            const CounterTable &table = (*counterTables)[i];
+            for (int j = 0; j < table.count; ++j) {
+                uint64_t *c = table.counters + 3 * j;
+                // Points in code for targets that weren't used (when
+                // compiling for multiple targets) are never reached.
+                if (c[0] != 0)
+                    fprintf(f, "%llu\t%llu\t%llu\t%d\t%s\t%s\n",
+                            (unsigned long long)c[0], (unsigned long long)c[1],
+                            (unsigned long long)c[2], table.sites[j].line,
+                            table.sites[j].fn, table.sites[j].note);
+                c[0] = c[1] = c[2] = 0;
+            }
+        }
+    }
+    fclose(f);
+
+    lUnlock();
+}
@@ -0,0 +1,63 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+  An implementation of the runtime functions for ispc's --instrument flag
+  that gathers an execution profile that can be used to optimize the
+  program with ispc's --profile-use flag.  ISPCInstrument() is called at
+  each instrumentation point with --instrument or --instrument=calls, and
+  every so often with --instrument=sample.  With --instrument=counters,
+  the compiled code keeps the statistics itself and each ispc file passes
+  its table of them to ISPCInstrumentRegister() when the program starts.
+
+  The profile is written when the program exits, to the file given by the
+  ISPC_PROFILE environment variable or to "ispc.profile" if it isn't set;
+  statistics for instrumentation points that are already in the file are
+  added to.
+*/
+
+#ifndef ISPC_PROFILE_RUNTIME_H
+#define ISPC_PROFILE_RUNTIME_H 1
+
+#include <stdint.h>
+
+extern "C" {
+    void ISPCInstrument(const char *fn, const char *note, int line, uint64_t mask);
+    void ISPCInstrumentRegister(const void *sites, uint64_t *counters, int32_t count);
+}
+
+/* Writes the profile gathered so far to the given file, appending to it,
+   and resets the statistics. */
+void ISPCWriteProfile(const char *filename);
+
+#endif // ISPC_PROFILE_RUNTIME_H
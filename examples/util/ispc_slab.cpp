@@ -0,0 +1,298 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ispc_slab.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef _MSC_VER
+#include <windows.h>
+#include <malloc.h>
+#define THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#define THREAD_LOCAL __thread
+#endif
+
+// Slabs are SLAB_SIZE bytes, aligned to SLAB_SIZE, so that the slab that
+// an allocation came from can be found by masking its address.  Requests
+// larger than the largest size class get a block of their own, which
+// starts with the same header, as do allocations that need more alignment
+// than the slabs' headers leave them with.
+#define SLAB_SIZE        (256 * 1024)
+#define SLAB_HEADER_SIZE 256
+#define MIN_CLASS_SHIFT  4
+#define NUM_CLASSES      8   // 16, 32, ..., 2048 bytes
+#define LARGE_CLASS      (-1)
+
+struct Slab {
+    int32_t sizeClass;
+    // Allocations from the slab that haven't been deleted, plus one while
+    // it is a thread's current slab for its size class.
+    volatile int32_t live;
+    char *cursor;
+    char *end;
+};
+
+static THREAD_LOCAL Slab *currentSlabs[NUM_CLASSES];
+static THREAD_LOCAL bool threadExitRegistered;
+
+
+static void *
+lAlignedAlloc(size_t size, size_t alignment) {
+#ifdef _MSC_VER
+    return _aligned_malloc(size, alignment);
+#else
+    void *ptr;
+    if (posix_memalign(&ptr, alignment, size) != 0)
+        return NULL;
+    return ptr;
+#endif
+}
+
+
+static void
+lAlignedFree(void *ptr) {
+#ifdef _MSC_VER
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+
+/* Subtracts n from the slab's count of live allocations and frees it if
+   that was the last of them. */
+static void
+lRelease(Slab *slab, int32_t n) {
+#ifdef _MSC_VER
+    int32_t live = InterlockedExchangeAdd((volatile long *)&slab->live, -n) - n;
+#else
+    int32_t live = __sync_sub_and_fetch(&slab->live, n);
+#endif
+    if (live == 0)
+        lAlignedFree(slab);
+}
+
+
+/* Gives up the current thread's current slabs when it exits, so that they
+   are freed once the allocations from them have been deleted. */
+#ifdef _MSC_VER
+static VOID WINAPI
+#else
+static void
+#endif
+lReleaseCurrentSlabs(void *) {
+    for (int c = 0; c < NUM_CLASSES; ++c) {
+        if (currentSlabs[c] != NULL) {
+            lRelease(currentSlabs[c], 1);
+            currentSlabs[c] = NULL;
+        }
+    }
+}
+
+
+#ifdef _MSC_VER
+static INIT_ONCE threadExitOnce = INIT_ONCE_STATIC_INIT;
+static DWORD threadExitKey;
+
+static BOOL CALLBACK
+lCreateThreadExitKey(PINIT_ONCE, PVOID, PVOID *) {
+    threadExitKey = FlsAlloc(lReleaseCurrentSlabs);
+    return TRUE;
+}
+#else
+static pthread_once_t threadExitOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t threadExitKey;
+
+static void
+lCreateThreadExitKey() {
+    pthread_key_create(&threadExitKey, lReleaseCurrentSlabs);
+}
+#endif
+
+
+/* Arranges for lReleaseCurrentSlabs() to be called when the current
+   thread exits; the value stored for the key just needs to be non-NULL
+   for that to happen. */
+static void
+lRegisterThreadExit() {
+    if (threadExitRegistered)
+        return;
+    threadExitRegistered = true;
+#ifdef _MSC_VER
+    InitOnceExecuteOnce(&threadExitOnce, lCreateThreadExitKey, NULL, NULL);
+    FlsSetValue(threadExitKey, (PVOID)1);
+#else
+    pthread_once(&threadExitOnce, lCreateThreadExitKey);
+    pthread_setspecific(threadExitKey, (void *)1);
+#endif
+}
+
+
+static Slab *
+lNewSlab(int32_t sizeClass, size_t size) {
+    Slab *slab = (Slab *)lAlignedAlloc(size, SLAB_SIZE);
+    if (slab == NULL)
+        return NULL;
+    slab->sizeClass = sizeClass;
+    slab->live = 1;
+    slab->cursor = (char *)slab + SLAB_HEADER_SIZE;
+    slab->end = (char *)slab + size;
+    return slab;
+}
+
+
+/* Returns memory for an allocation that gets a block of its own, with
+   the data following the header at the given alignment. */
+static void *
+lLargeAlloc(uint64_t size, int32_t alignment) {
+    // ISPCDelete() finds the block's header by masking the pointer it's
+    // given, which only works if the data starts in its first SLAB_SIZE
+    // bytes.
+    assert(alignment < SLAB_SIZE);
+    size_t offset = (alignment > SLAB_HEADER_SIZE) ? alignment :
+        SLAB_HEADER_SIZE;
+    Slab *slab = lNewSlab(LARGE_CLASS, offset + size);
+    return slab ? (char *)slab + offset : NULL;
+}
+
+
+static int
+lSizeClass(uint64_t size, int32_t alignment) {
+    if (size < (uint64_t)alignment)
+        size = alignment;
+    int sizeClass = 0;
+    while (sizeClass < NUM_CLASSES &&
+           ((uint64_t)1 << (sizeClass + MIN_CLASS_SHIFT)) < size)
+        ++sizeClass;
+    return sizeClass < NUM_CLASSES ? sizeClass : LARGE_CLASS;
+}
+
+
+/* Returns memory for n allocations from the given size class, taken from
+   the current thread's slab for it with a single bump. */
+static char *
+lBump(int sizeClass, int n, int32_t alignment) {
+    size_t bytes = (size_t)n << (sizeClass + MIN_CLASS_SHIFT);
+    Slab *slab = currentSlabs[sizeClass];
+    char *ptr = NULL;
+    if (slab != NULL) {
+        ptr = (char *)(((uintptr_t)slab->cursor + alignment - 1) &
+                       ~(uintptr_t)(alignment - 1));
+        if (ptr + bytes > slab->end) {
+            lRelease(slab, 1);
+            slab = NULL;
+        }
+    }
+    if (slab == NULL) {
+        lRegisterThreadExit();
+        slab = currentSlabs[sizeClass] = lNewSlab(sizeClass, SLAB_SIZE);
+        if (slab == NULL)
+            return NULL;
+        ptr = slab->cursor;
+    }
+
+#ifdef _MSC_VER
+    InterlockedExchangeAdd((volatile long *)&slab->live, n);
+#else
+    __sync_fetch_and_add(&slab->live, n);
+#endif
+    slab->cursor = ptr + bytes;
+    return ptr;
+}
+
+
+void
+ISPCNew(void **ptrs, const uint64_t *sizes, int32_t count,
+        int32_t alignment, uint64_t mask) {
+    int laneClass[64];
+    int classCount[NUM_CLASSES];
+    memset(classCount, 0, sizeof(classCount));
+
+    for (int i = 0; i < count; ++i) {
+        if ((mask & (1ull << i)) == 0)
+            continue;
+        // Memory in the slabs is only aligned to SLAB_HEADER_SIZE, so
+        // allocations that need more get blocks of their own.
+        laneClass[i] = (alignment > SLAB_HEADER_SIZE) ? LARGE_CLASS :
+            lSizeClass(sizes[i], alignment);
+        if (laneClass[i] == LARGE_CLASS)
+            ptrs[i] = lLargeAlloc(sizes[i], alignment);
+        else
+            ++classCount[laneClass[i]];
+    }
+
+    // Bump each size class's slab once for all of the lanes that need
+    // memory from it and then hand out the pieces.
+    char *next[NUM_CLASSES];
+    for (int c = 0; c < NUM_CLASSES; ++c)
+        if (classCount[c] > 0)
+            next[c] = lBump(c, classCount[c], alignment);
+
+    for (int i = 0; i < count; ++i) {
+        if ((mask & (1ull << i)) == 0 || laneClass[i] == LARGE_CLASS)
+            continue;
+        int c = laneClass[i];
+        ptrs[i] = next[c];
+        if (next[c] != NULL)
+            next[c] += (size_t)1 << (c + MIN_CLASS_SHIFT);
+    }
+}
+
+
+void
+ISPCDelete(void **ptrs, int32_t count, uint64_t mask) {
+    // Consecutive lanes' memory usually comes from the same slab, so
+    // release them together.
+    Slab *slab = NULL;
+    int32_t n = 0;
+    for (int i = 0; i < count; ++i) {
+        if ((mask & (1ull << i)) == 0 || ptrs[i] == NULL)
+            continue;
+        Slab *s = (Slab *)((uintptr_t)ptrs[i] & ~(uintptr_t)(SLAB_SIZE - 1));
+        if (s->sizeClass == LARGE_CLASS) {
+            lAlignedFree(s);
+            continue;
+        }
+        if (s != slab) {
+            if (slab != NULL)
+                lRelease(slab, n);
+            slab = s;
+            n = 0;
+        }
+        ++n;
+    }
+    if (slab != NULL)
+        lRelease(slab, n);
+}
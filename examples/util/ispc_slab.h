@@ -0,0 +1,60 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+  A size-class slab allocator that implements the ISPCNew() and
+  ISPCDelete() functions that ispc calls for "new" and "delete" when
+  programs are compiled with --new-delete-hooks.
+
+  Each thread has a current slab for each size class; the memory for all
+  of the program instances in a varying "new" that fall in the same size
+  class is taken from it with a single bump of its cursor.  A slab counts
+  the allocations from it that haven't yet been deleted and is freed when
+  there are none left and it is no longer a thread's current slab (a
+  thread's current slabs are given up when it exits), so memory isn't
+  reused until everything allocated alongside it has been deleted.  This suits allocations that are made in bulk and then freed
+  together, like the nodes of a tree that is being built.
+*/
+
+#ifndef ISPC_SLAB_H
+#define ISPC_SLAB_H 1
+
+#include <stdint.h>
+
+extern "C" {
+    void ISPCNew(void **ptrs, const uint64_t *sizes, int32_t count,
+                 int32_t alignment, uint64_t mask);
+    void ISPCDelete(void **ptrs, int32_t count, uint64_t mask);
+}
+
+#endif // ISPC_SLAB_H
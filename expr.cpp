@@ -8635,9 +8635,14 @@ NewExpr::GetValue(FunctionEmitContext *ctx) const {
 
     // Determine which allocation builtin function to call: uniform or
     // varying, and taking 32-bit or 64-bit allocation counts.
+    // With --new-delete-hooks, the allocation is done by the
+    // user-supplied ISPCNew() function instead.
     llvm::Function *func;
     if (isVarying) {
-        if (g->target->is32Bit()) {
+        if (g->newDeleteHooks) {
+            func = m->module->getFunction(do32Bit ? "__new_varying32_hook" :
+                                                    "__new_varying64_hook");
+        } else if (g->target->is32Bit()) {
             func = m->module->getFunction("__new_varying32_32rt");
         } else if (g->opt.force32BitAddressing) {
             func = m->module->getFunction("__new_varying32_64rt");
@@ -8650,7 +8655,9 @@ NewExpr::GetValue(FunctionEmitContext *ctx) const {
         if (allocSize->getType() != LLVMTypes::Int64Type)
             allocSize = ctx->SExtInst(allocSize, LLVMTypes::Int64Type,
                                       "alloc_size64");
-        if (g->target->is32Bit()) {
+        if (g->newDeleteHooks) {
+            func = m->module->getFunction("__new_uniform_hook");
+        } else if (g->target->is32Bit()) {
             func = m->module->getFunction("__new_uniform_32rt");
         } else {
             func = m->module->getFunction("__new_uniform_64rt");
@@ -89,39 +89,16 @@
 #endif
 #include <llvm/Support/ToolOutputFile.h>
 
-Function::Function(Symbol *s, Stmt *c) {
+Function::Function(Symbol *s, Stmt *c, bool deferTypeCheck) {
     sym = s;
     code = c;
+    typeChecked = false;
 
     maskSymbol = m->symbolTable->LookupVariable("__mask");
     Assert(maskSymbol != NULL);
 
-    if (code != NULL) {
-        code = TypeCheck(code);
-
-        if (code != NULL && g->debugPrint) {
-            printf("After typechecking function \"%s\":\n",
-                    sym->name.c_str());
-            code->Print(0);
-            printf("---------------------\n");
-        }
-
-        if (code != NULL) {
-            code = Optimize(code);
-            if (g->debugPrint) {
-                printf("After optimizing function \"%s\":\n",
-                        sym->name.c_str());
-                code->Print(0);
-                printf("---------------------\n");
-            }
-        }
-    }
-
-    if (g->debugPrint) {
-        printf("Add Function %s\n", sym->name.c_str());
-        code->Print(0);
-        printf("\n\n\n");
-    }
+    if (!deferTypeCheck)
+        typeCheckAndOptimize();
 
     const FunctionType *type = CastType<FunctionType>(sym->type);
     Assert(type != NULL);
@@ -176,6 +153,45 @@ Function::Function(Symbol *s, Stmt *c) {
 }
 
 
+void
+Function::typeCheckAndOptimize() {
+    typeChecked = true;
+
+    if (code != NULL) {
+        {
+            TimePhase timeTypeCheck("type check");
+            code = TypeCheck(code);
+        }
+
+        if (code != NULL && g->debugPrint) {
+            printf("After typechecking function \"%s\":\n",
+                    sym->name.c_str());
+            code->Print(0);
+            printf("---------------------\n");
+        }
+
+        if (code != NULL) {
+            {
+                TimePhase timeOptimize("AST optimize");
+                code = Optimize(code);
+            }
+            if (g->debugPrint) {
+                printf("After optimizing function \"%s\":\n",
+                        sym->name.c_str());
+                code->Print(0);
+                printf("---------------------\n");
+            }
+        }
+    }
+
+    if (g->debugPrint) {
+        printf("Add Function %s\n", sym->name.c_str());
+        code->Print(0);
+        printf("\n\n\n");
+    }
+}
+
+
 const Type *
 Function::GetReturnType() const {
     const FunctionType *type = CastType<FunctionType>(sym->type);
@@ -504,12 +520,33 @@ Function::emitCode(FunctionEmitContext *ctx, llvm::Function *function,
 }
 
 
+bool
+Function::IsReferenced() const {
+    if (sym == NULL || sym->function == NULL)
+        return false;
+    return !sym->function->hasLocalLinkage() || !sym->function->use_empty();
+}
+
+
+void
+Function::EraseDeclaration() {
+    if (sym == NULL || sym->function == NULL)
+        return;
+    Assert(sym->function->empty() && sym->function->use_empty());
+    sym->function->eraseFromParent();
+    sym->function = NULL;
+}
+
+
 void
 Function::GenerateIR() {
     if (sym == NULL)
         // May be NULL due to error earlier in compilation
         return;
 
+    if (!typeChecked)
+        typeCheckAndOptimize();
+
     llvm::Function *function = sym->function;
     Assert(function != NULL);
 
@@ -43,7 +43,11 @@
 
 class Function {
 public:
-    Function(Symbol *sym, Stmt *code);
+    /** If deferTypeCheck is true, type checking and AST optimization of
+        the function's code are left until IR is generated for it, so that
+        they are skipped for standard library functions that are never
+        used. */
+    Function(Symbol *sym, Stmt *code, bool deferTypeCheck = false);
 
     const Type *GetReturnType() const;
     const FunctionType *GetType() const;
@@ -51,13 +55,24 @@ public:
     /** Generate LLVM IR for the function into the current module. */
     void GenerateIR();
 
+    /** Returns true if the function may be called: either it's visible
+        outside of the module or there are references to it in the IR
+        generated so far. */
+    bool IsReferenced() const;
+
+    /** Removes the declaration of a function that IR was never generated
+        for from the module. */
+    void EraseDeclaration();
+
 private:
+    void typeCheckAndOptimize();
     void emitCode(FunctionEmitContext *ctx, llvm::Function *function,
                   SourcePos firstStmtPos);
 
     Symbol *sym;
     std::vector<Symbol *> args;
     Stmt *code;
+    bool typeChecked;
     Symbol *maskSymbol;
     Symbol *threadIndexSym, *threadCountSym;
     Symbol *taskIndexSym,   *taskCountSym;
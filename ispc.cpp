@@ -489,7 +489,9 @@ Target::Target(const char *arch, const char *cpu, const char *isa, bool pic, boo
     m_hasTrigonometry(false),
     m_hasRsqrtd(false),
     m_hasRcpd(false),
-    m_hasVecPrefetch(false)
+    m_hasVecPrefetch(false),
+    m_nativeGatherCost(12),
+    m_scalarGatherLaneCost(3)
 {
     CPUtype CPUID = CPU_None, CPUfromISA = CPU_None;
     AllCPUs a;
@@ -1059,6 +1061,31 @@ Target::Target(const char *arch, const char *cpu, const char *isa, bool pic, boo
     }
     this->m_cpu = cpu;
 
+    // Approximate gather costs for the CPU we're generating code for.
+    // Haswell's vpgather is microcoded and barely beats scalar loads;
+    // later cores made it considerably cheaper.  These can be overridden
+    // with --opt=gather-cost (see examples/perfbench for calibration).
+    switch (a.GetTypeFromName(this->m_cpu)) {
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_3_6
+        case CPU_Broadwell:
+            this->m_nativeGatherCost = 7;
+            break;
+#endif
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_3_7
+        case CPU_KNL:
+            this->m_nativeGatherCost = 15;
+            this->m_scalarGatherLaneCost = 4;
+            break;
+#endif
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_3_8
+        case CPU_SKX:
+            this->m_nativeGatherCost = 8;
+            break;
+#endif
+        default:
+            break;
+    }
+
     if (!error) {
         // Create TargetMachine
         std::string triple = GetTripleString();
@@ -1495,6 +1522,7 @@ Opt::Opt() {
     disableAsserts = false;
     disableFMA = false;
     forceAlignedMemory = false;
+    streamingStores = false;
     disableMaskAllOnOptimizations = false;
     disableHandlePseudoMemoryOps = false;
     disableBlendedMaskedStores = false;
@@ -1505,6 +1533,12 @@ Opt::Opt() {
     disableGatherScatterFlattening = false;
     disableUniformMemoryOptimizations = false;
     disableCoalescing = false;
+    disableGatherCostModel = false;
+    disableUniformArgsSpecialization = false;
+    disableLoopVersioning = false;
+    gatherCost = -1;
+    gatherLaneCost = -1;
+    foreachRemainder = Foreach_Auto;
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -1526,6 +1560,9 @@ Globals::Globals() {
     disableLineWrap = false;
     emitPerfWarnings = true;
     emitInstrumentation = false;
+    instrumentMode = Instrument_Calls;
+    instrumentSamplePeriod = 4096;
+    newDeleteHooks = false;
     generateDebuggingSymbols = false;
 #if ISPC_LLVM_VERSION >= ISPC_LLVM_3_5
     generateDWARFVersion = 0;
@@ -1544,6 +1581,12 @@ Globals::Globals() {
 #endif
     forceAlignment = -1;
     dllExport = false;
+    numJobs = 1;
+    cacheMaxSize = (int64_t)1024 * 1024 * 1024;
+    printCacheStats = false;
+    timePasses = false;
+    timePassesFile = NULL;
+    profile = NULL;
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -109,6 +109,7 @@ class Function;
 class FunctionType;
 class Module;
 class PointerType;
+class Profile;
 class Stmt;
 class Symbol;
 class SymbolTable;
@@ -306,6 +307,10 @@ public:
 
     bool hasVecPrefetch() const {return m_hasVecPrefetch;}
 
+    int getNativeGatherCost() const {return m_nativeGatherCost;}
+
+    int getScalarGatherLaneCost() const {return m_scalarGatherLaneCost;}
+
 private:
 
     /** llvm Target object representing this target. */
@@ -414,6 +419,16 @@ private:
 
     /** Indicates whether the target has hardware instruction for vector prefetch. */
     bool m_hasVecPrefetch;
+
+    /** Approximate cost, in cycles, of a single native gather instruction
+        on the target CPU.  Only meaningful if m_hasGather is true; along
+        with m_scalarGatherLaneCost it is used to decide whether a gather
+        with few active lanes should be scalarized instead. */
+    int m_nativeGatherCost;
+
+    /** Approximate cost, in cycles, of gathering one active lane with a
+        scalar load and insert. */
+    int m_scalarGatherLaneCost;
 };
 
 
@@ -464,6 +479,12 @@ struct Opt {
         locations. */
     bool forceAlignedMemory;
 
+    /** Issue non-temporal (cache-bypassing) stores for vector stores to
+        sequential locations that are known to be done with all program
+        instances active, on targets that have them.  This is a win for
+        large output arrays that won't be read again soon. */
+    bool streamingStores;
+
     /** If enabled, disables the various optimizations that kick in when
         the execution mask can be determined to be "all on" at compile
         time. */
@@ -524,6 +545,36 @@ struct Opt {
     /** Disables optimizations that coalesce incoherent scalar memory
         access from gathers into wider vector operations, when possible. */
     bool disableCoalescing;
+
+    /** Disables the cost model that decides, for targets with a native
+        gather instruction, whether a gather with few active lanes is
+        better done with scalar loads. */
+    bool disableGatherCostModel;
+
+    /** Disables specializing internal functions that weren't inlined for
+        the arguments that are the same for all program instances at
+        their call sites. */
+    bool disableUniformArgsSpecialization;
+
+    /** Disables emitting uniform loops twice, once for when the mask is
+        all on going into the loop and once for when it isn't, with a
+        single test of the mask before the loop. */
+    bool disableLoopVersioning;
+
+    /** Overrides of the target's native gather cost and per-lane scalar
+        gather cost (in cycles) used by the gather cost model.  -1 means
+        that the target's default is used. */
+    int gatherCost;
+    int gatherLaneCost;
+
+    /** Strategy for the elements at the end of each dimension of a
+        foreach loop that don't fill a whole vector.  Foreach_Peel emits
+        the loop body twice: once for full vectors with the mask all on
+        and once, masked, for the remainder.  Foreach_Masked emits it only
+        once and runs every iteration with a mask.  Foreach_Auto picks one
+        of the two for each loop. */
+    enum ForeachRemainder { Foreach_Auto, Foreach_Peel, Foreach_Masked };
+    ForeachRemainder foreachRemainder;
 };
 
 /** @brief This structure collects together a number of global variables.
@@ -602,6 +653,23 @@ struct Globals {
         manual.) */
     bool emitInstrumentation;
 
+    /** With instrumentation, there are a number of ways to gather data
+        at each instrumentation point: calling ISPCInstrument() every time
+        it is reached, only updating counters for it in a global array that
+        is handed to ISPCInstrumentRegister() when the program starts, or
+        counting how many times it was reached and calling
+        ISPCInstrument() every instrumentSamplePeriod'th time. */
+    enum InstrumentMode { Instrument_Calls, Instrument_Counters,
+                          Instrument_Sampled };
+    InstrumentMode instrumentMode;
+    int instrumentSamplePeriod;
+
+    /** Indicates whether memory for "new" and "delete" should be
+        allocated and freed by calling the externally-defined ISPCNew()
+        and ISPCDelete() functions, rather than the system's aligned
+        allocation functions. */
+    bool newDeleteHooks;
+
     /** Indicates whether ispc should generate debugging symbols for the
         program in its output. */
     bool generateDebuggingSymbols;
@@ -649,6 +717,39 @@ struct Globals {
 
     /** When true, flag non-static functions with dllexport attribute on Windows. */
     bool dllExport;
+
+    /** Maximum number of targets to optimize and generate code for at the
+        same time when compiling for multiple targets.  Each one is handled
+        in a separate child process; values less than 2 (and all values on
+        Windows) compile the targets one after another. */
+    int numJobs;
+
+    /** If non-empty, the directory of the on-disk cache of compiled
+        outputs (see cache.h). */
+    std::string cacheDir;
+
+    /** Maximum total size of the compilation cache, in bytes. */
+    int64_t cacheMaxSize;
+
+    /** Indicates whether statistics about the compilation cache should be
+        printed after compiling. */
+    bool printCacheStats;
+
+    /** Indicates whether the time spent in each phase of compilation
+        should be measured and reported (see CompilePhase in util.h). */
+    bool timePasses;
+
+    /** File to write the --time-passes report to; if NULL, it's printed
+        to stderr. */
+    const char *timePassesFile;
+
+    /** Execution profile given with --profile-use, or NULL if there
+        isn't one. */
+    Profile *profile;
+
+    /** The command-line arguments that may affect the generated code; they
+        are part of the key for the compilation cache. */
+    std::vector<std::string> cacheKeyArgs;
 };
 
 enum {
@@ -681,6 +782,7 @@ enum {
 
     CHECK_MASK_AT_FUNCTION_START_COST = 16,
     PREDICATE_SAFE_IF_STATEMENT_COST = 6,
+    LOOP_VERSIONING_MAX_BODY_COST = 128,
 };
 
 extern Globals *g;
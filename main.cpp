@@ -39,6 +39,7 @@
 #include "module.h"
 #include "util.h"
 #include "type.h"
+#include "profile.h"
 #include <stdio.h>
 #include <stdlib.h>
 #ifdef ISPC_IS_WINDOWS
@@ -91,6 +92,11 @@ usage(int ret) {
     printf("    [--arch={%s}]\t\tSelect target architecture\n",
            Target::SupportedArchs());
     printf("    [--c++-include-file=<name>]\t\tSpecify name of file to emit in #include statement in generated C++ code.\n");
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_3_4 // LLVM 3.4+
+    printf("    [--cache-dir=<dir>]\t\t\tReuse outputs of identical earlier compilations cached in <dir>\n");
+    printf("    [--cache-max-size=<MB>]\t\tLimit the size of the compilation cache (default 1024 MB)\n");
+    printf("    [--cache-stats]\t\t\tPrint compilation cache statistics\n");
+#endif // LLVM 3.4+
 #ifndef ISPC_IS_WINDOWS
     printf("    [--colored-output]\t\tAlways use terminal colors in error/warning messages.\n");
 #endif
@@ -119,6 +125,13 @@ usage(int ret) {
     printf("    [-h <name>/--header-outfile=<name>]\tOutput filename for header\n");
     printf("    [-I <path>]\t\t\t\tAdd <path> to #include file search path\n");
     printf("    [--instrument]\t\t\tEmit instrumentation to gather performance data\n");
+    printf("    [--instrument=<mode>]\t\tSelect how instrumentation gathers data\n");
+    printf("        calls\t\t\t\tCall ISPCInstrument() at every instrumentation point (default)\n");
+    printf("        counters\t\t\tUpdate per-point counters inline; pass them to ISPCInstrumentRegister()\n");
+    printf("        sample[:<n>]\t\t\tCall ISPCInstrument() every <n>th time a point is reached (default 4096)\n");
+#ifndef ISPC_IS_WINDOWS
+    printf("    [-j <n>/--jobs=<n>]\t\t\tCompile up to <n> targets in parallel when compiling for multiple targets\n");
+#endif // !ISPC_IS_WINDOWS
     printf("    [--math-lib=<option>]\t\tSelect math library\n");
     printf("        default\t\t\t\tUse ispc's built-in math functions\n");
     printf("        fast\t\t\t\tUse high-performance but lower-accuracy math functions\n");
@@ -126,6 +139,7 @@ usage(int ret) {
     printf("        system\t\t\t\tUse the system's math library (*may be quite slow*)\n");
     printf("    [-MMM <filename>\t\t\tWrite #include dependencies to given file.\n");
     printf("    [--no-omit-frame-pointer]\t\tDisable frame pointer omission. It may be useful for profiling\n");
+    printf("    [--new-delete-hooks]\t\tCall user-supplied ISPCNew()/ISPCDelete() for \"new\" and \"delete\"\n");
     printf("    [--nostdlib]\t\t\tDon't make the ispc standard library available\n");
     printf("    [--nocpp]\t\t\t\tDon't run the C preprocessor\n");
     printf("    [-o <name>/--outfile=<name>]\tOutput filename (may be \"-\" for standard output)\n");
@@ -137,15 +151,19 @@ usage(int ret) {
     printf("        fast-masked-vload\t\tFaster masked vector loads on SSE (may go past end of array)\n");
     printf("        fast-math\t\t\tPerform non-IEEE-compliant optimizations of numeric expressions\n");
     printf("        force-aligned-memory\t\tAlways issue \"aligned\" vector load and store instructions\n");
+    printf("        foreach-remainder=<s>\t\tHow foreach handles partial vectors: peel, masked or auto (default)\n");
+    printf("        streaming-stores\t\tUse non-temporal stores for full-width sequential vector stores\n");
 #ifndef ISPC_IS_WINDOWS
     printf("    [--pic]\t\t\t\tGenerate position-independent code\n");
 #endif // !ISPC_IS_WINDOWS
+    printf("    [--profile-use=<file>]\t\tOptimize using a profile gathered with --instrument\n");
     printf("    [--quiet]\t\t\t\tSuppress all output\n");
     printf("    ");
     char targetHelp[2048];
     sprintf(targetHelp, "[--target=<t>]\t\t\tSelect target ISA and width.\n"
             "<t>={%s}", Target::SupportedTargets());
     PrintWithWordBreaks(targetHelp, 24, TerminalWidth(), stdout);
+    printf("    [--time-passes[=<file>]]\t\tReport the time spent in each phase of compilation as JSON\n");
     printf("    [--version]\t\t\t\tPrint ispc version\n");
     printf("    [--werror]\t\t\t\tTreat warnings as errors\n");
     printf("    [--woff]\t\t\t\tDisable warnings\n");
@@ -169,11 +187,15 @@ devUsage(int ret) {
     printf("        disable-blending-removal\t\tDisable eliminating blend at same scope\n");
     printf("        disable-coalescing\t\t\tDisable gather coalescing\n");
     printf("        disable-coherent-control-flow\t\tDisable coherent control flow optimizations\n");
+    printf("        disable-gather-cost-model\t\tAlways use native gathers on targets that have them\n");
     printf("        disable-gather-scatter-flattening\tDisable flattening when all lanes are on\n");
     printf("        disable-gather-scatter-optimizations\tDisable improvements to gather/scatter\n");
     printf("        disable-handle-pseudo-memory-ops\tLeave __pseudo_* calls for gather/scatter/etc. in final IR\n");
+    printf("        disable-loop-versioning\t\t\tDon't emit uniform loops separately for an \"all on\" mask\n");
     printf("        disable-uniform-control-flow\t\tDisable uniform control flow optimizations\n");
+    printf("        disable-uniform-args-specialization\tDon't specialize functions for uniform arguments\n");
     printf("        disable-uniform-memory-optimizations\tDisable uniform-based coherent memory access\n");
+    printf("        gather-cost=<native>,<lane>\t\tSet the cycle costs of a native gather and of one scalarized lane\n");
     printf("    [--yydebug]\t\t\t\tPrint debugging information during parsing\n");
     printf("    [--debug-phase=<value>]\t\tSet optimization phases to dump. --debug-phase=first,210:220,300,305,310:last\n");
 #if ISPC_LLVM_VERSION == ISPC_LLVM_3_4 || ISPC_LLVM_VERSION == ISPC_LLVM_3_5 // 3.4, 3.5
@@ -344,6 +366,7 @@ int main(int Argc, char *Argv[]) {
     const char *depsFileName = NULL;
     const char *hostStubFileName = NULL;
     const char *devStubFileName = NULL;
+    const char *profileFileName = NULL;
     // Initiailize globals early so that we can set various option values
     // as we're parsing below
     g = new Globals;
@@ -409,6 +432,26 @@ int main(int Argc, char *Argv[]) {
             g->NoOmitFramePointer = true;
         else if (!strcmp(argv[i], "--instrument"))
             g->emitInstrumentation = true;
+        else if (!strncmp(argv[i], "--instrument=", 13)) {
+            const char *mode = argv[i] + 13;
+            g->emitInstrumentation = true;
+            if (!strcmp(mode, "calls"))
+                g->instrumentMode = Globals::Instrument_Calls;
+            else if (!strcmp(mode, "counters"))
+                g->instrumentMode = Globals::Instrument_Counters;
+            else if (!strcmp(mode, "sample"))
+                g->instrumentMode = Globals::Instrument_Sampled;
+            else if (!strncmp(mode, "sample:", 7) && atoi(mode + 7) > 0) {
+                g->instrumentMode = Globals::Instrument_Sampled;
+                g->instrumentSamplePeriod = atoi(mode + 7);
+            }
+            else {
+                fprintf(stderr, "Unknown --instrument= option \"%s\".\n", mode);
+                usage(1);
+            }
+        }
+        else if (!strcmp(argv[i], "--new-delete-hooks"))
+            g->newDeleteHooks = true;
         else if (!strcmp(argv[i], "-g")) {
             g->generateDebuggingSymbols = true;
         }
@@ -472,6 +515,22 @@ int main(int Argc, char *Argv[]) {
                 g->opt.disableFMA = true;
             else if (!strcmp(opt, "force-aligned-memory"))
                 g->opt.forceAlignedMemory = true;
+            else if (!strcmp(opt, "streaming-stores"))
+                g->opt.streamingStores = true;
+            else if (!strncmp(opt, "foreach-remainder=", 18)) {
+                const char *strategy = opt + 18;
+                if (!strcmp(strategy, "auto"))
+                    g->opt.foreachRemainder = Opt::Foreach_Auto;
+                else if (!strcmp(strategy, "peel"))
+                    g->opt.foreachRemainder = Opt::Foreach_Peel;
+                else if (!strcmp(strategy, "masked"))
+                    g->opt.foreachRemainder = Opt::Foreach_Masked;
+                else {
+                    fprintf(stderr, "Unknown --opt=foreach-remainder= strategy \"%s\".\n",
+                            strategy);
+                    usage(1);
+                }
+            }
 
             // These are only used for performance tests of specific
             // optimizations
@@ -495,6 +554,21 @@ int main(int Argc, char *Argv[]) {
                 g->opt.disableGatherScatterFlattening = true;
             else if (!strcmp(opt, "disable-uniform-memory-optimizations"))
                 g->opt.disableUniformMemoryOptimizations = true;
+            else if (!strcmp(opt, "disable-gather-cost-model"))
+                g->opt.disableGatherCostModel = true;
+            else if (!strcmp(opt, "disable-uniform-args-specialization"))
+                g->opt.disableUniformArgsSpecialization = true;
+            else if (!strcmp(opt, "disable-loop-versioning"))
+                g->opt.disableLoopVersioning = true;
+            else if (!strncmp(opt, "gather-cost=", 12)) {
+                if (sscanf(opt + 12, "%d,%d", &g->opt.gatherCost,
+                           &g->opt.gatherLaneCost) != 2 ||
+                    g->opt.gatherCost < 0 || g->opt.gatherLaneCost <= 0) {
+                    fprintf(stderr, "Invalid --opt=gather-cost= value \"%s\"; "
+                            "expected <native>,<lane>.\n", opt + 12);
+                    usage(1);
+                }
+            }
             else {
                 fprintf(stderr, "Unknown --opt= option \"%s\".\n", opt);
                 usage(1);
@@ -556,6 +630,33 @@ int main(int Argc, char *Argv[]) {
 #endif // !ISPC_IS_WINDOWS
         else if (!strcmp(argv[i], "--quiet"))
             g->quiet = true;
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_3_4 // LLVM 3.4+
+        else if (!strncmp(argv[i], "--cache-dir=", 12))
+            g->cacheDir = argv[i] + 12;
+        else if (!strncmp(argv[i], "--cache-max-size=", 17))
+            g->cacheMaxSize = (int64_t)atoi(argv[i] + 17) * 1024 * 1024;
+        else if (!strcmp(argv[i], "--cache-stats"))
+            g->printCacheStats = true;
+#endif // LLVM 3.4+
+#ifndef ISPC_IS_WINDOWS
+        else if (!strcmp(argv[i], "-j")) {
+            if (++i == argc) {
+                fprintf(stderr, "No job count specified after -j option.\n");
+                usage(1);
+            }
+            g->numJobs = atoi(argv[i]);
+        }
+        else if (!strncmp(argv[i], "--jobs=", 7))
+            g->numJobs = atoi(argv[i] + 7);
+#endif // !ISPC_IS_WINDOWS
+        else if (!strncmp(argv[i], "--profile-use=", 14))
+            profileFileName = argv[i] + 14;
+        else if (!strcmp(argv[i], "--time-passes"))
+            g->timePasses = true;
+        else if (!strncmp(argv[i], "--time-passes=", 14)) {
+            g->timePasses = true;
+            g->timePassesFile = argv[i] + 14;
+        }
         else if (!strcmp(argv[i], "--yydebug")) {
             extern int yydebug;
             yydebug = 1;
@@ -615,6 +716,20 @@ int main(int Argc, char *Argv[]) {
         }
     }
 
+    // All of the arguments other than the ones that control the cache
+    // itself, the number of jobs and timing are part of the compilation
+    // cache's key.
+    if (!g->cacheDir.empty()) {
+        for (int i = 1; i < argc; ++i) {
+            if (!strcmp(argv[i], "-j"))
+                ++i;
+            else if (strncmp(argv[i], "--cache-", 8) != 0 &&
+                     strncmp(argv[i], "--jobs=", 7) != 0 &&
+                     strncmp(argv[i], "--time-passes", 13) != 0)
+                g->cacheKeyArgs.push_back(argv[i]);
+        }
+    }
+
     if (g->enableFuzzTest) {
         if (g->fuzzTestSeed == -1) {
 #ifdef ISPC_IS_WINDOWS
@@ -633,6 +748,12 @@ int main(int Argc, char *Argv[]) {
 #endif
     }
 
+    if (profileFileName != NULL) {
+        g->profile = Profile::Read(profileFileName);
+        if (g->profile == NULL)
+            return 1;
+    }
+
     if (outFileName == NULL &&
         headerFileName == NULL &&
         depsFileName == NULL &&
@@ -642,12 +763,19 @@ int main(int Argc, char *Argv[]) {
               "Program will be compiled and warnings/errors will "
               "be issued, but no output will be generated.");
 
-    return Module::CompileAndOutput(file, arch, cpu, target, generatePIC,
-                                    ot,
-                                    outFileName,
-                                    headerFileName,
-                                    includeFileName,
-                                    depsFileName,
-                                    hostStubFileName,
-                                    devStubFileName);
+    int ret;
+    {
+        TimePhase timeCompile("compile");
+        ret = Module::CompileAndOutput(file, arch, cpu, target, generatePIC,
+                                       ot,
+                                       outFileName,
+                                       headerFileName,
+                                       includeFileName,
+                                       depsFileName,
+                                       hostStubFileName,
+                                       devStubFileName);
+    }
+    if (g->timePasses && !CompilePhase::WriteReport(g->timePassesFile))
+        ret = 1;
+    return ret;
 }
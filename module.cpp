@@ -47,6 +47,8 @@
 #include "stmt.h"
 #include "opt.h"
 #include "llvmutil.h"
+#include "cache.h"
+#include "profile.h"
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -65,6 +67,10 @@
 #include <windows.h>
 #include <io.h>
 #define strcasecmp stricmp
+#else
+#include <unistd.h>
+#include <sys/wait.h>
+#include <errno.h>
 #endif
 #if ISPC_LLVM_VERSION == ISPC_LLVM_3_2
   #include <llvm/LLVMContext.h>
@@ -98,6 +104,7 @@
 #endif
 #include <llvm/PassRegistry.h>
 #include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 #include <llvm/Support/FormattedStream.h>
 #include <llvm/Support/FileUtilities.h>
 #include <llvm/Target/TargetMachine.h>
@@ -392,6 +399,7 @@ Module::Module(const char *fn) {
     errorCount = 0;
     symbolTable = new SymbolTable;
     ast = new AST;
+    instrumentationCounters = NULL;
 
     lDeclareSizeAndPtrIntTypes(symbolTable);
 
@@ -453,7 +461,7 @@ extern YY_BUFFER_STATE yy_create_buffer(FILE *, int);
 extern void yy_delete_buffer(YY_BUFFER_STATE);
 
 int
-Module::CompileFile() {
+Module::CompileFile(bool optimize) {
     extern void ParserInit();
     ParserInit();
 
@@ -461,7 +469,11 @@ Module::CompileFile() {
     // function ends up calling into routines that expect the global
     // variable 'm' to be initialized and available (which it isn't until
     // the Module constructor returns...)
-    DefineStdlib(symbolTable, g->ctx, module, g->includeStdlib);
+    {
+        TimePhase timeStdlib("stdlib");
+        DefineStdlib(symbolTable, g->ctx, module, g->includeStdlib);
+        ast->MarkStdlibFunctions();
+    }
 
     bool runPreprocessor = g->runCPP;
 
@@ -479,7 +491,11 @@ Module::CompileFile() {
 
         std::string buffer;
         llvm::raw_string_ostream os(buffer);
-        execPreprocessor((filename != NULL) ? filename : "-", &os);
+        {
+            TimePhase timePreprocess("preprocess");
+            execPreprocessor((filename != NULL) ? filename : "-", &os);
+        }
+        TimePhase timeParse("parse");
         YY_BUFFER_STATE strbuf = yy_scan_string(os.str().c_str());
         yyparse();
         yy_delete_buffer(strbuf);
@@ -496,6 +512,7 @@ Module::CompileFile() {
                 return 1;
             }
         }
+        TimePhase timeParse("parse");
         yyin = f;
         yy_switch_to_buffer(yy_create_buffer(yyin, 4096));
         yyparse();
@@ -508,11 +525,16 @@ Module::CompileFile() {
             f.addFnAttr("no-frame-pointer-elim", "true");
 #endif
 
-    ast->GenerateIR();
+    {
+        TimePhase timeCodegen("codegen");
+        ast->GenerateIR();
+        if (instrumentationCounters != NULL)
+            emitInstrumentationCounters();
+    }
 
     if (diBuilder)
         diBuilder->finalize();
-    if (errorCount == 0)
+    if (errorCount == 0 && optimize)
         Optimize(module, g->opt.level);
 
     return errorCount;
@@ -1167,6 +1189,142 @@ Module::AddFunctionDefinition(const std::string &name, const FunctionType *type,
 }
 
 
+llvm::Constant *
+Module::GetInstrumentationCounter(SourcePos pos, const char *note,
+                                  InstrumentationCounter counter) {
+    llvm::Type *countersType = llvm::ArrayType::get(LLVMTypes::Int64Type, 3);
+    if (instrumentationCounters == NULL)
+        // We don't know how many points there will be until all of the
+        // functions have been compiled; emitInstrumentationCounters()
+        // replaces this with the actual array.
+        instrumentationCounters =
+            new llvm::GlobalVariable(*module,
+                                     llvm::ArrayType::get(countersType, 0),
+                                     false, llvm::GlobalValue::ExternalLinkage,
+                                     NULL, "__ispc_instrument_counters_tmp");
+
+    char buf[32];
+    sprintf(buf, "\t%d\t", pos.first_line);
+    std::string key = std::string(pos.name) + buf + note;
+
+    int index;
+    std::map<std::string, int>::iterator iter =
+        instrumentationSiteIndices.find(key);
+    if (iter != instrumentationSiteIndices.end())
+        index = iter->second;
+    else {
+        index = (int)instrumentationSites.size();
+        instrumentationSites.push_back(std::make_pair(pos, std::string(note)));
+        instrumentationSiteIndices[key] = index;
+    }
+
+    llvm::Constant *indices[3] = { LLVMInt32(0), LLVMInt32(index),
+                                   LLVMInt32((int)counter) };
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_6 /* 3.2, 3.3, 3.4, 3.5, 3.6 */
+    return llvm::ConstantExpr::getGetElementPtr(instrumentationCounters,
+                                                indices);
+#else /* LLVM 3.7+ */
+    return llvm::ConstantExpr::getGetElementPtr(PTYPE(instrumentationCounters),
+                                                instrumentationCounters,
+                                                indices);
+#endif
+}
+
+
+static llvm::Constant *
+lInstrumentationString(llvm::Module *module, const std::string &s,
+                       std::map<std::string, llvm::Constant *> &strings) {
+    std::map<std::string, llvm::Constant *>::iterator iter = strings.find(s);
+    if (iter != strings.end())
+        return iter->second;
+
+    llvm::Constant *sConstant =
+        llvm::ConstantDataArray::getString(*g->ctx, s, true);
+    llvm::GlobalVariable *sPtr =
+        new llvm::GlobalVariable(*module, sConstant->getType(), true,
+                                 llvm::GlobalValue::InternalLinkage,
+                                 sConstant, "__ispc_instrument_string");
+    llvm::Constant *ptr =
+        llvm::ConstantExpr::getBitCast(sPtr, LLVMTypes::VoidPointerType);
+    strings[s] = ptr;
+    return ptr;
+}
+
+
+void
+Module::emitInstrumentationCounters() {
+    int count = (int)instrumentationSites.size();
+    llvm::Type *countersType = llvm::ArrayType::get(LLVMTypes::Int64Type, 3);
+    llvm::ArrayType *arrayType = llvm::ArrayType::get(countersType, count);
+    llvm::GlobalVariable *counters =
+        new llvm::GlobalVariable(*module, arrayType, false,
+                                 llvm::GlobalValue::InternalLinkage,
+                                 llvm::Constant::getNullValue(arrayType),
+                                 "__ispc_instrument_counters");
+    instrumentationCounters->replaceAllUsesWith(
+        llvm::ConstantExpr::getBitCast(counters,
+                                       instrumentationCounters->getType()));
+    instrumentationCounters->eraseFromParent();
+    instrumentationCounters = NULL;
+
+    // With sampling, the counters are only used to decide when to call
+    // ISPCInstrument(), so there's nothing to report.
+    if (g->instrumentMode != Globals::Instrument_Counters)
+        return;
+
+    // The table of instrumentation points, with an element for each one
+    // laid out like the C struct
+    // { const char *file; const char *note; int32_t line; }.
+    std::vector<llvm::Type *> siteTypes;
+    siteTypes.push_back(LLVMTypes::VoidPointerType);
+    siteTypes.push_back(LLVMTypes::VoidPointerType);
+    siteTypes.push_back(LLVMTypes::Int32Type);
+    llvm::StructType *siteType = llvm::StructType::get(*g->ctx, siteTypes);
+
+    std::map<std::string, llvm::Constant *> strings;
+    std::vector<llvm::Constant *> sites;
+    for (int i = 0; i < count; ++i) {
+        const SourcePos &pos = instrumentationSites[i].first;
+        std::vector<llvm::Constant *> fields;
+        fields.push_back(lInstrumentationString(module, pos.name, strings));
+        fields.push_back(lInstrumentationString(module,
+                                                instrumentationSites[i].second,
+                                                strings));
+        fields.push_back(LLVMInt32(pos.first_line));
+        sites.push_back(llvm::ConstantStruct::get(siteType, fields));
+    }
+    llvm::ArrayType *tableType = llvm::ArrayType::get(siteType, count);
+    llvm::GlobalVariable *table =
+        new llvm::GlobalVariable(*module, tableType, true,
+                                 llvm::GlobalValue::InternalLinkage,
+                                 llvm::ConstantArray::get(tableType, sites),
+                                 "__ispc_instrument_sites");
+
+    // Pass both of them to the runtime from a static constructor, so that
+    // it can report the counters when the program exits.
+    llvm::FunctionType *ftype =
+        llvm::FunctionType::get(LLVMTypes::VoidType, false);
+    llvm::Function *ctor =
+        llvm::Function::Create(ftype, llvm::GlobalValue::InternalLinkage,
+                               "__ispc_instrument_register", module);
+    llvm::BasicBlock *entry = llvm::BasicBlock::Create(*g->ctx, "entry", ctor);
+    llvm::Constant *registerFunc =
+        module->getOrInsertFunction("ISPCInstrumentRegister",
+                                    LLVMTypes::VoidType,
+                                    LLVMTypes::VoidPointerType,
+                                    LLVMTypes::VoidPointerType,
+                                    LLVMTypes::Int32Type, NULL);
+    llvm::Value *args[3] = {
+        llvm::ConstantExpr::getBitCast(table, LLVMTypes::VoidPointerType),
+        llvm::ConstantExpr::getBitCast(counters, LLVMTypes::VoidPointerType),
+        LLVMInt32(count)
+    };
+    llvm::CallInst::Create(registerFunc, args, "", entry);
+    llvm::ReturnInst::Create(*g->ctx, entry);
+    llvm::appendToGlobalCtors(*module, ctor, 65535);
+}
+
+
 void
 Module::AddExportedTypes(const std::vector<std::pair<const Type *,
                                                      SourcePos> > &types) {
@@ -1409,6 +1567,7 @@ Module::writeBitcode(llvm::Module *module, const char *outFileName) {
         }
     }
 
+    TimePhase timeEmit("emit bitcode");
     llvm::raw_fd_ostream fos(fd, (fd != 1), false);
 #ifdef ISPC_NVPTX_ENABLED
     if (g->target->getISA() == Target::NVPTX)
@@ -1526,6 +1685,7 @@ Module::writeObjectFileOrAssembly(llvm::TargetMachine *targetMachine,
 #else // LLVM 3.7+
     llvm::raw_fd_ostream &fos(of->os());
 #endif
+    TimePhase timeEmit(binary ? "emit object" : "emit assembly");
     if (targetMachine->addPassesToEmitFile(pm, fos, fileType)) {
         fprintf(stderr, "Fatal error adding passes to emit object file!");
         exit(1);
@@ -2242,7 +2402,17 @@ Module::writeHeader(const char *fn) {
     if (g->emitInstrumentation) {
         fprintf(f, "#define ISPC_INSTRUMENTATION 1\n");
         fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\nextern \"C\" {\n#endif // __cplusplus\n");
-        fprintf(f, "  void ISPCInstrument(const char *fn, const char *note, int line, uint64_t mask);\n");
+        if (g->instrumentMode == Globals::Instrument_Counters)
+            fprintf(f, "  void ISPCInstrumentRegister(const void *sites, uint64_t *counters, int32_t count);\n");
+        else
+            fprintf(f, "  void ISPCInstrument(const char *fn, const char *note, int line, uint64_t mask);\n");
+        fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\n} /* end extern C */\n#endif // __cplusplus\n");
+    }
+
+    if (g->newDeleteHooks) {
+        fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\nextern \"C\" {\n#endif // __cplusplus\n");
+        fprintf(f, "  void ISPCNew(void **ptrs, const uint64_t *sizes, int32_t count, int32_t alignment, uint64_t mask);\n");
+        fprintf(f, "  void ISPCDelete(void **ptrs, int32_t count, uint64_t mask);\n");
         fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\n} /* end extern C */\n#endif // __cplusplus\n");
     }
 
@@ -2355,7 +2525,17 @@ Module::writeDispatchHeader(DispatchHeaderInfo *DHI) {
       if (g->emitInstrumentation) {
         fprintf(f, "#define ISPC_INSTRUMENTATION 1\n");
         fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\nextern \"C\" {\n#endif // __cplusplus\n");
-        fprintf(f, "  void ISPCInstrument(const char *fn, const char *note, int line, uint64_t mask);\n");
+        if (g->instrumentMode == Globals::Instrument_Counters)
+            fprintf(f, "  void ISPCInstrumentRegister(const void *sites, uint64_t *counters, int32_t count);\n");
+        else
+            fprintf(f, "  void ISPCInstrument(const char *fn, const char *note, int line, uint64_t mask);\n");
+        fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\n} /* end extern C */\n#endif // __cplusplus\n");
+      }
+
+      if (g->newDeleteHooks) {
+        fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\nextern \"C\" {\n#endif // __cplusplus\n");
+        fprintf(f, "  void ISPCNew(void **ptrs, const uint64_t *sizes, int32_t count, int32_t alignment, uint64_t mask);\n");
+        fprintf(f, "  void ISPCDelete(void **ptrs, int32_t count, uint64_t mask);\n");
         fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\n} /* end extern C */\n#endif // __cplusplus\n");
       }
 
@@ -2981,7 +3161,8 @@ static bool lCompatibleTypes(llvm::Type *Ty1, llvm::Type *Ty2) {
 // to be declarations; we'll emit a single definition of each global in the
 // final module used with the dispatch functions, so that we don't have
 // multiple definitions of them, one in each of the target-specific output
-// files.
+// files.  If mdst is NULL, the definitions are only turned into
+// declarations.
 static void
 lExtractOrCheckGlobals(llvm::Module *msrc, llvm::Module *mdst, bool check) {
     llvm::Module::global_iterator iter;
@@ -2995,6 +3176,8 @@ lExtractOrCheckGlobals(llvm::Module *msrc, llvm::Module *mdst, bool check) {
             // initializer.
             llvm::Constant *init = gv->getInitializer();
             gv->setInitializer(NULL);
+            if (mdst == NULL)
+                continue;
 
             llvm::Type *type = gv->getType()->getElementType();
             Symbol *sym =
@@ -3057,6 +3240,141 @@ static std::string lCBEMangle(const std::string &S)
 }
 #endif /* ISPC_NVPTX_ENABLED */
 
+// Returns the name of the output file for the current target in a
+// multi-target compile, given the base output filename.
+static std::string
+lGetTargetOutFileName(const char *outFileName) {
+    // We always generate cpp file for *-generic target during multitarget compilation
+    if (g->target->getISA() == Target::GENERIC &&
+        !g->target->getTreatGenericAsSmth().empty())
+        return lGetTargetFileName(outFileName,
+                                  g->target->getTreatGenericAsSmth().c_str(), true);
+    else
+        return lGetTargetFileName(outFileName, g->target->GetISAString(), false);
+}
+
+
+// Writes the target-specific output file for the module, given the base
+// output filename for a multi-target compile.
+bool
+Module::writeTargetOutput(OutputType outputType, const char *outFileName,
+                          const char *includeFileName) {
+    std::string targetOutFileName = lGetTargetOutFileName(outFileName);
+    if (g->target->getISA() == Target::GENERIC &&
+        !g->target->getTreatGenericAsSmth().empty())
+        return writeOutput(CXX, targetOutFileName.c_str(), includeFileName);
+    else
+        return writeOutput(outputType, targetOutFileName.c_str());
+}
+
+
+// Returns a CompileCache with the key for the given compilation, or NULL
+// if there's no cache directory or the compilation's outputs can't be
+// cached.  The key covers the compiler version, the command-line
+// arguments, and the preprocessed source and the resolved triple and CPU
+// for each of the targets.
+CompileCache *
+Module::openCompileCache(const char *srcFile, const char *arch, const char *cpu,
+                         const char *target, bool generatePIC) {
+    if (g->cacheDir.empty() || g->enableFuzzTest ||
+        srcFile == NULL || !strcmp(srcFile, "-"))
+        return NULL;
+
+    CompileCache *cache = new CompileCache(g->cacheDir, g->cacheMaxSize);
+#if defined(BUILD_VERSION) && defined (BUILD_DATE)
+    cache->AddToKey(std::string(ISPC_VERSION) + " " + BUILD_VERSION + " " + BUILD_DATE);
+#else
+    cache->AddToKey(std::string(ISPC_VERSION) + " " + __DATE__ + " " + __TIME__);
+#endif
+    for (unsigned int i = 0; i < g->cacheKeyArgs.size(); ++i)
+        cache->AddToKey(g->cacheKeyArgs[i]);
+    if (g->profile != NULL)
+        cache->AddToKey(g->profile->GetText());
+    // The compilation directory is recorded in the debugging information.
+    if (g->generateDebuggingSymbols)
+        cache->AddToKey(g->currentDirectory);
+
+    std::vector<std::string> targets;
+    if (target != NULL)
+        targets = lExtractTargets(target);
+    else
+        targets.push_back("");
+
+    for (unsigned int i = 0; i < targets.size(); ++i) {
+        g->target = new Target(arch, cpu, targets[i].empty() ? NULL : targets[i].c_str(),
+                               generatePIC, false);
+        // Make sure that the file exists first, since otherwise we crash
+        // in the preprocessor.
+        FILE *f = fopen(srcFile, "rb");
+        bool valid = g->target->isValid() && f != NULL;
+        if (valid) {
+            cache->AddToKey(g->target->GetTripleString());
+            cache->AddToKey(g->target->getCPU());
+            cache->AddToKey(g->target->GetISATargetString());
+
+            std::string buffer;
+            llvm::raw_string_ostream os(buffer);
+            if (g->runCPP) {
+                Module *pm = new Module(srcFile);
+                pm->execPreprocessor(srcFile, &os);
+                delete pm->module;
+                delete pm;
+            }
+            else {
+                char buf[4096];
+                size_t n;
+                while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+                    os.write(buf, n);
+            }
+            cache->AddToKey(os.str());
+        }
+        if (f != NULL)
+            fclose(f);
+        delete g->target;
+        g->target = NULL;
+
+        // Let the compilation report the errors.
+        if (!valid) {
+            delete cache;
+            return NULL;
+        }
+    }
+    return cache;
+}
+
+
+#ifndef ISPC_IS_WINDOWS
+// Waits for the child processes that are compiling individual targets
+// until at most maxRunning of them are still running.  Returns the number
+// of the ones that finished that failed.
+static int
+lWaitForTargetJobs(std::vector<pid_t> &jobs, size_t maxRunning) {
+    int failed = 0;
+    while (jobs.size() > maxRunning) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("wait");
+            failed += (int)jobs.size();
+            jobs.clear();
+            break;
+        }
+
+        std::vector<pid_t>::iterator iter =
+            std::find(jobs.begin(), jobs.end(), pid);
+        if (iter == jobs.end())
+            continue;
+        jobs.erase(iter);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ++failed;
+    }
+    return failed;
+}
+#endif // !ISPC_IS_WINDOWS
+
+
 int
 Module::CompileAndOutput(const char *srcFile,
                          const char *arch,
@@ -3071,6 +3389,22 @@ Module::CompileAndOutput(const char *srcFile,
                          const char *hostStubFileName,
                          const char *devStubFileName)
 {
+    // Outputs that go to stdout and dependency and offload stub files
+    // aren't cached.
+    CompileCache *cache = NULL;
+    if ((outFileName == NULL || strcmp(outFileName, "-") != 0) &&
+        depsFileName == NULL && hostStubFileName == NULL &&
+        devStubFileName == NULL)
+        cache = openCompileCache(srcFile, arch, cpu, target, generatePIC);
+    if (cache != NULL && cache->Fetch()) {
+        if (g->printCacheStats)
+            cache->PrintStats();
+        delete cache;
+        return 0;
+    }
+    // The files written, for storing in the cache.
+    std::vector<std::string> outputFiles;
+
     if (target == NULL || strchr(target, ',') == NULL) {
         // We're only compiling to a single target
         g->target = new Target(arch, cpu, target, generatePIC, g->printTarget);
@@ -3123,12 +3457,16 @@ Module::CompileAndOutput(const char *srcFile,
                 }
             }
 
-            if (outFileName != NULL)
+            if (outFileName != NULL) {
                 if (!m->writeOutput(outputType, outFileName, includeFileName))
                     return 1;
-            if (headerFileName != NULL)
+                outputFiles.push_back(outFileName);
+            }
+            if (headerFileName != NULL) {
                 if (!m->writeOutput(Module::Header, headerFileName))
                     return 1;
+                outputFiles.push_back(headerFileName);
+            }
             if (depsFileName != NULL)
               if (!m->writeOutput(Module::Deps,depsFileName))
                 return 1;
@@ -3149,6 +3487,14 @@ Module::CompileAndOutput(const char *srcFile,
         delete g->target;
         g->target = NULL;
 
+        if (cache != NULL) {
+            if (errorCount == 0)
+                cache->Store(outputFiles);
+            if (g->printCacheStats)
+                cache->PrintStats();
+            delete cache;
+        }
+
         return errorCount > 0;
     }
     else {
@@ -3216,11 +3562,30 @@ Module::CompileAndOutput(const char *srcFile,
         // It indicates if we have *-generic target. 
         std::string treatGenericAsSmth = "";
 
+        // With more than one job, each target's module is optimized and
+        // its output file is written in a child process forked once the
+        // front-end is done with it; the parent only needs the
+        // unoptimized module for the dispatch functions, the globals, and
+        // the headers.  The child runs exactly the steps the serial path
+        // does on the same IR, so the output files are the same either way.
+#ifndef ISPC_IS_WINDOWS
+        bool parallelTargets = (g->numJobs > 1);
+        std::vector<pid_t> targetJobs;
+#else
+        bool parallelTargets = false;
+#endif // !ISPC_IS_WINDOWS
+
         for (unsigned int i = 0; i < targets.size(); ++i) {
             g->target = new Target(arch, cpu, targets[i].c_str(), generatePIC, g->printTarget);
             if (!g->target->isValid())
                 return 1;
 
+            // Time each target's compilation separately.  (When targets
+            // are compiled in parallel, the optimization and output for
+            // each one happen in a child process and aren't included.)
+            TimePhase timeTarget(std::string("target ") +
+                                 g->target->GetISATargetString());
+
             if (!g->target->getTreatGenericAsSmth().empty())
                 treatGenericAsSmth = g->target->getTreatGenericAsSmth();
 
@@ -3235,7 +3600,38 @@ Module::CompileAndOutput(const char *srcFile,
             targetMachines[g->target->getISA()] = g->target->GetTargetMachine();
 
             m = new Module(srcFile);
-            if (m->CompileFile() == 0) {
+            if (m->CompileFile(!parallelTargets) == 0) {
+#ifndef ISPC_IS_WINDOWS
+                if (parallelTargets) {
+                    errorCount +=
+                        lWaitForTargetJobs(targetJobs, g->numJobs - 1);
+
+                    // Flush all buffered output (including the dispatch
+                    // header) so that the child doesn't write it out a
+                    // second time.
+                    fflush(NULL);
+
+                    pid_t pid = fork();
+                    if (pid == 0) {
+                        Optimize(m->module, g->opt.level);
+                        lExtractOrCheckGlobals(m->module, NULL, false);
+                        bool ok = (m->errorCount == 0);
+                        if (ok && outFileName != NULL)
+                            ok = m->writeTargetOutput(outputType, outFileName,
+                                                      includeFileName);
+                        fflush(stdout);
+                        fflush(stderr);
+                        _exit(ok ? 0 : 1);
+                    }
+                    else if (pid == -1) {
+                        perror("fork");
+                        lWaitForTargetJobs(targetJobs, 0);
+                        return 1;
+                    }
+                    targetJobs.push_back(pid);
+                }
+#endif // !ISPC_IS_WINDOWS
+
                 // Create the dispatch module, unless already created;
                 // in the latter case, just do the checking
                 bool check = (dispatchModule != NULL);
@@ -3249,25 +3645,18 @@ Module::CompileAndOutput(const char *srcFile,
                 lGetExportedFunctions(m->symbolTable, exportedFunctions);
 
                 if (outFileName != NULL) {
-                    std::string targetOutFileName;
-                    // We always generate cpp file for *-generic target during multitarget compilation
-                    if (g->target->getISA() == Target::GENERIC && 
-                        !g->target->getTreatGenericAsSmth().empty()) {
-                        targetOutFileName = lGetTargetFileName(outFileName, 
-                                                g->target->getTreatGenericAsSmth().c_str(), true);
-                        if (!m->writeOutput(CXX, targetOutFileName.c_str(), includeFileName))
-                            return 1;
-                    }
-                    else {
-                        const char *isaName = g->target->GetISAString();
-                        targetOutFileName = lGetTargetFileName(outFileName, isaName, false);
-                        if (!m->writeOutput(outputType, targetOutFileName.c_str()))
-                            return 1;
-                    }
+                    if (!parallelTargets &&
+                        !m->writeTargetOutput(outputType, outFileName,
+                                              includeFileName))
+                        return 1;
+                    outputFiles.push_back(lGetTargetOutFileName(outFileName));
                 }
             }
             errorCount += m->errorCount;
             if (errorCount != 0) {
+#ifndef ISPC_IS_WINDOWS
+                lWaitForTargetJobs(targetJobs, 0);
+#endif // !ISPC_IS_WINDOWS
                 return 1;
             }
 
@@ -3294,6 +3683,7 @@ Module::CompileAndOutput(const char *srcFile,
               if (!m->writeOutput(Module::Header, targetHeaderFileName.c_str())) {
                 return 1;
               }
+              outputFiles.push_back(targetHeaderFileName);
               if (i == targets.size()-1) {
                 fclose(DHI.file);
               }
@@ -3307,6 +3697,11 @@ Module::CompileAndOutput(const char *srcFile,
             // we generate the dispatch module's functions...
         }
 
+#ifndef ISPC_IS_WINDOWS
+        if (lWaitForTargetJobs(targetJobs, 0) != 0)
+            return 1;
+#endif // !ISPC_IS_WINDOWS
+
         // Find the first non-NULL target machine from the targets we
         // compiled to above.  We'll use this as the target machine for
         // compiling the dispatch module--this is safe in that it is the
@@ -3333,6 +3728,7 @@ Module::CompileAndOutput(const char *srcFile,
             else
                 writeObjectFileOrAssembly(firstTargetMachine, dispatchModule,
                                           outputType, outFileName);
+            outputFiles.push_back(outFileName);
         }
 
         if (depsFileName != NULL)
@@ -3342,6 +3738,16 @@ Module::CompileAndOutput(const char *srcFile,
         delete g->target;
         g->target = NULL;
 
+        if (cache != NULL) {
+            if (headerFileName != NULL)
+                outputFiles.push_back(headerFileName);
+            if (errorCount == 0)
+                cache->Store(outputFiles);
+            if (g->printCacheStats)
+                cache->PrintStats();
+            delete cache;
+        }
+
 
         return errorCount > 0;
     }
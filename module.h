@@ -41,6 +41,7 @@
 
 #include "ispc.h"
 #include "ast.h"
+#include <map>
 #if ISPC_LLVM_VERSION == ISPC_LLVM_3_4
   #include <llvm/DebugInfo.h>
 #elif ISPC_LLVM_VERSION >= ISPC_LLVM_3_5
@@ -53,6 +54,7 @@ namespace llvm
 }
 
 struct DispatchHeaderInfo;
+class CompileCache;
 
 class Module {
 public:
@@ -62,8 +64,11 @@ public:
 
     /** Compiles the source file passed to the Module constructor, adding
         its global variables and functions to both the llvm::Module and
-        SymbolTable.  Returns the number of errors during compilation.  */
-    int CompileFile();
+        SymbolTable.  Returns the number of errors during compilation.
+        If optimize is false, the generated IR is left unoptimized; this is
+        used when the optimization and code generation for a target are
+        done in a separate process. */
+    int CompileFile(bool optimize = true);
 
     /** Add a named type definition to the module. */
     void AddTypeDef(const std::string &name, const Type *type,
@@ -87,6 +92,20 @@ public:
     void AddFunctionDefinition(const std::string &name,
                                const FunctionType *ftype, Stmt *code);
 
+    /** Counters that are kept for each instrumentation point with
+        --instrument=counters or --instrument=sample. */
+    enum InstrumentationCounter { Counter_Count, Counter_Lanes,
+                                  Counter_AllOff };
+
+    /** Returns a pointer to the given int64 counter for the
+        instrumentation point with the given note at the given source
+        position: the number of times that it was reached, the total
+        number of program instances that were active or the number of
+        times that none were.  All of the module's counters are in a single
+        array, indexed by the order in which the points were first seen. */
+    llvm::Constant *GetInstrumentationCounter(SourcePos pos, const char *note,
+                                              InstrumentationCounter counter);
+
     /** Adds the given type to the set of types that have their definitions
         included in automatically generated header files. */
     void AddExportedTypes(const std::vector<std::pair<const Type *,
@@ -172,6 +191,20 @@ private:
 
     std::vector<std::pair<const Type *, SourcePos> > exportedTypes;
 
+    /** Instrumentation points that have counters, and the index of each
+        one's counters, for GetInstrumentationCounter().
+        instrumentationCounters is a placeholder for the array of counters
+        until emitInstrumentationCounters() knows how many there are. */
+    std::vector<std::pair<SourcePos, std::string> > instrumentationSites;
+    std::map<std::string, int> instrumentationSiteIndices;
+    llvm::GlobalVariable *instrumentationCounters;
+
+    /** Creates the array of instrumentation counters and, with
+        --instrument=counters, a table that describes the points they are
+        for and a constructor that passes both of them to the
+        ISPCInstrumentRegister() runtime function. */
+    void emitInstrumentationCounters();
+
     /** Write the corresponding output type to the given file.  Returns
         true on success, false if there has been an error.  The given
         filename may be NULL, indicating that output should go to standard
@@ -185,12 +218,18 @@ private:
     bool writeDevStub(const char *filename);
     bool writeHostStub(const char *filename);
     bool writeObjectFileOrAssembly(OutputType outputType, const char *filename);
+    bool writeTargetOutput(OutputType outputType, const char *outFileName,
+                           const char *includeFileName);
     static bool writeObjectFileOrAssembly(llvm::TargetMachine *targetMachine,
                                           llvm::Module *module, OutputType outputType,
                                           const char *outFileName);
     static bool writeBitcode(llvm::Module *module, const char *outFileName);
 
     void execPreprocessor(const char *infilename, llvm::raw_string_ostream* ostream) const;
+
+    static CompileCache *openCompileCache(const char *srcFile, const char *arch,
+                                          const char *cpu, const char *target,
+                                          bool generatePIC);
 };
 
 #endif // ISPC_MODULE_H
@@ -83,11 +83,13 @@
     #include <llvm/IR/IRPrintingPasses.h>
     #include <llvm/IR/PatternMatch.h>
     #include <llvm/IR/DebugInfo.h>
+    #include <llvm/IR/CFG.h>
 #else // < 3.5
     #include <llvm/Analysis/Verifier.h>
     #include <llvm/Assembly/PrintModulePass.h>
     #include <llvm/Support/PatternMatch.h>
     #include <llvm/DebugInfo.h>
+    #include <llvm/Support/CFG.h>
 #endif
 #include <llvm/Analysis/ConstantFolding.h>
 #if ISPC_LLVM_VERSION <= ISPC_LLVM_3_6
@@ -100,6 +102,7 @@
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/IPO.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Target/TargetOptions.h>
 #if ISPC_LLVM_VERSION == ISPC_LLVM_3_2
   #include <llvm/DataLayout.h>
@@ -117,6 +120,12 @@
   #include "llvm/Transforms/Scalar/GVN.h"
 #endif
 #include <llvm/Analysis/Passes.h>
+#include <llvm/Analysis/LoopPass.h>
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_3
+  #include <llvm/CallGraphSCCPass.h>
+#else // LLVM 3.4+
+  #include <llvm/Analysis/CallGraphSCCPass.h>
+#endif
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/Dwarf.h>
 #if ISPC_LLVM_VERSION >= ISPC_LLVM_3_6
@@ -137,6 +146,9 @@
 #ifndef PRIu64
 #define PRIu64 "llu"
 #endif
+#ifndef PRIx64
+#define PRIx64 "llx"
+#endif
 
 static llvm::Pass *CreateIntrinsicsOptPass();
 static llvm::Pass *CreateInstructionSimplifyPass();
@@ -144,12 +156,16 @@ static llvm::Pass *CreatePeepholePass();
 
 static llvm::Pass *CreateImproveMemoryOpsPass();
 static llvm::Pass *CreateGatherCoalescePass();
+static llvm::Pass *CreateScatterCoalescePass();
 static llvm::Pass *CreateReplacePseudoMemoryOpsPass();
 
 static llvm::Pass *CreateIsCompileTimeConstantPass(bool isLastTry);
 static llvm::Pass *CreateMakeInternalFuncsStaticPass();
+static llvm::Pass *CreateUniformArgsSpecializationPass();
 
 static llvm::Pass *CreateDebugPass(char * output);
+static llvm::Pass *CreatePhaseTimerPass(llvm::Pass *pass, CompilePhase *phase,
+                                        bool start);
 
 static llvm::Pass *CreateReplaceStdlibShiftPass();
 
@@ -498,8 +514,22 @@ DebugPassManager::add(llvm::Pass * P, int stage = -1) {
         number = stage;
     }
     if (g->off_stages.find(number) == g->off_stages.end()) {
-        // adding optimization (not switched off)
+        // adding optimization (not switched off); with --time-passes, it
+        // goes between a pair of passes that time it.
+        llvm::Pass *timerStart = NULL, *timerStop = NULL;
+        if (g->timePasses) {
+            char buf[32];
+            sprintf(buf, "%d: ", number);
+            CompilePhase *phase =
+                CompilePhase::Get(buf + std::string(P->getPassName()));
+            timerStart = CreatePhaseTimerPass(P, phase, true);
+            timerStop = CreatePhaseTimerPass(P, phase, false);
+        }
+        if (timerStart != NULL)
+            PM.add(timerStart);
         PM.add(P);
+        if (timerStop != NULL)
+            PM.add(timerStop);
         if (g->debug_stages.find(number) != g->debug_stages.end()) {
             // adding dump of LLVM IR after optimization
             char buf[100];
@@ -527,6 +557,7 @@ DebugPassManager::add(llvm::Pass * P, int stage = -1) {
 
 void
 Optimize(llvm::Module *module, int optLevel) {
+    TimePhase timeOptimize("optimize");
     if (g->debugPrint) {
         printf("*** Code going into optimization ***\n");
         module->dump();
@@ -720,6 +751,11 @@ Optimize(llvm::Module *module, int optLevel) {
 
         if (g->opt.disableGatherScatterOptimizations == false &&
             g->target->getVectorWidth() > 1) {
+            // Specialize internal functions that weren't inlined for
+            // their uniform arguments, so that the memory optimizations
+            // below also improve the copies.
+            if (g->opt.disableUniformArgsSpecialization == false)
+                optPM.add(CreateUniformArgsSpecializationPass(), 254);
             optPM.add(llvm::createInstructionCombiningPass(), 255);
             optPM.add(CreateImproveMemoryOpsPass());
 
@@ -729,6 +765,7 @@ Optimize(llvm::Module *module, int optLevel) {
                 // finding matching gathers we can coalesce..
                 optPM.add(llvm::createEarlyCSEPass(), 260);
                 optPM.add(CreateGatherCoalescePass());
+                optPM.add(CreateScatterCoalescePass());
             }
         }
 
@@ -3065,9 +3102,424 @@ lGSToLoadStore(llvm::CallInst *callInst) {
 }
 
 
+/** Splits v into a base value and a constant integer offset if v is
+    computed by adding a constant splat vector to another vector.
+    Otherwise, *base is left as v and *offset is set to zero.
+ */
+static void
+lSplitConstantSplatAdd(llvm::Value *v, llvm::Value **base, int64_t *offset) {
+    *base = v;
+    *offset = 0;
+
+    llvm::BinaryOperator *bop = llvm::dyn_cast<llvm::BinaryOperator>(v);
+    if (bop == NULL || bop->getOpcode() != llvm::Instruction::Add)
+        return;
+
+    for (int i = 0; i < 2; ++i) {
+        int64_t elts[ISPC_MAX_NVEC];
+        int nElts;
+        if (!LLVMExtractVectorInts(bop->getOperand(i), elts, &nElts))
+            continue;
+
+        bool allEqual = true;
+        for (int j = 1; j < nElts; ++j)
+            allEqual &= (elts[j] == elts[0]);
+        if (allEqual) {
+            *base = bop->getOperand(i ^ 1);
+            *offset = elts[0];
+            return;
+        }
+    }
+}
+
+
+/** Returns true if the integer vector b is equal to the integer vector a
+    plus the same constant in all of the elements, setting *delta to that
+    constant.  (This only handles the easy cases: the two being constant
+    vectors or the same value, possibly plus a constant splat.)
+ */
+static bool
+lVectorsDifferByConstant(llvm::Value *a, llvm::Value *b, int64_t *delta) {
+    int64_t aElts[ISPC_MAX_NVEC], bElts[ISPC_MAX_NVEC];
+    int nElts;
+    if (LLVMExtractVectorInts(a, aElts, &nElts) &&
+        LLVMExtractVectorInts(b, bElts, &nElts)) {
+        for (int i = 1; i < nElts; ++i)
+            if (bElts[i] - aElts[i] != bElts[0] - aElts[0])
+                return false;
+        *delta = bElts[0] - aElts[0];
+        return true;
+    }
+
+    llvm::Value *aBase, *bBase;
+    int64_t aOffset, bOffset;
+    lSplitConstantSplatAdd(a, &aBase, &aOffset);
+    lSplitConstantSplatAdd(b, &bBase, &bOffset);
+    if (aBase != bBase)
+        return false;
+
+    *delta = bOffset - aOffset;
+    return true;
+}
+
+
+/** Assembles a vector where element i is taken from element elts[i].second
+    of srcs[elts[i].first]; all of the vectors are of the target's vector
+    width.  Each source vector is first paired up with another one with a
+    single shuffle, then those results are paired up, and so forth,
+    ending with a final shuffle that puts the elements in order.
+ */
+static llvm::Value *
+lAssembleTransposed(const std::vector<llvm::Value *> &srcs,
+                    const std::vector<std::pair<int, int> > &elts,
+                    llvm::Instruction *insertBefore) {
+    int width = g->target->getVectorWidth();
+    Assert((int)elts.size() == width);
+
+    // For each partial result, lanes[i] gives the element of the vector
+    // that holds the result's element i, or -1 if it doesn't have it.
+    std::vector<llvm::Value *> partials;
+    std::vector<std::vector<int32_t> > lanes;
+    for (int s = 0; s < (int)srcs.size(); ++s) {
+        std::vector<int32_t> srcLanes(width, -1);
+        bool used = false;
+        for (int i = 0; i < width; ++i) {
+            if (elts[i].first == s) {
+                srcLanes[i] = elts[i].second;
+                used = true;
+            }
+        }
+        if (used) {
+            partials.push_back(srcs[s]);
+            lanes.push_back(srcLanes);
+        }
+    }
+    Assert(partials.size() > 0);
+
+    while (partials.size() > 1) {
+        std::vector<llvm::Value *> newPartials;
+        std::vector<std::vector<int32_t> > newLanes;
+        for (int p = 0; p + 1 < (int)partials.size(); p += 2) {
+            std::vector<int32_t> shuf(width, -1), merged(width, -1);
+            for (int i = 0; i < width; ++i) {
+                if (lanes[p][i] != -1)
+                    shuf[i] = lanes[p][i];
+                else if (lanes[p+1][i] != -1)
+                    shuf[i] = width + lanes[p+1][i];
+                if (shuf[i] != -1)
+                    merged[i] = i;
+            }
+            newPartials.push_back(LLVMShuffleVectors(partials[p], partials[p+1],
+                                                     &shuf[0], width,
+                                                     insertBefore));
+            newLanes.push_back(merged);
+        }
+        if (partials.size() & 1) {
+            newPartials.push_back(partials.back());
+            newLanes.push_back(lanes.back());
+        }
+        partials = newPartials;
+        lanes = newLanes;
+    }
+
+    for (int i = 0; i < width; ++i)
+        if (lanes[0][i] != i)
+            return LLVMShuffleVectors(partials[0], partials[0], &lanes[0][0],
+                                      width, insertBefore);
+    return partials[0];
+}
+
+
+static bool lInstructionMayWriteToMemory(llvm::Instruction *inst);
+
+/** Array-of-structures accesses like "pts[i].x, pts[i].y, pts[i].z",
+    where consecutive program instances access consecutive elements of a
+    uniform array, turn into a series of gathers (or scatters) with the
+    same stride, each for one field of the structure.  If there are N of
+    them with an N-element stride, one for each field, then together they
+    access a contiguous range of memory.  This function finds such groups
+    for N = 2, 3, 4, and 8, and replaces them with N vector loads (or
+    stores) that go straight through the range, with the data transposed
+    from (to) AOS layout with shuffles.  Unlike the coalescing done by
+    GatherCoalescePass, this also works when the mask isn't all on, since
+    masked loads and stores are used for the individual vectors.
+ */
+static bool
+lGSToAoSLoadStore(llvm::CallInst *callInst) {
+    struct AoSInfo {
+        AoSInfo(const std::string &pName, const std::string &mName,
+                bool gather, bool factored, int sz) {
+            pseudoFunc = m->module->getFunction(pName);
+            memFunc = m->module->getFunction(mName);
+            isGather = gather;
+            isFactored = factored;
+            size = sz;
+        }
+        llvm::Function *pseudoFunc;
+        llvm::Function *memFunc;
+        bool isGather, isFactored;
+        int size;
+    };
+
+    std::vector<AoSInfo> info;
+    const char *types[] = { "i32", "float", "i64", "double" };
+    const char *offsetTypes[] = { "32", "64" };
+    for (int t = 0; t < 4; ++t) {
+        for (int o = 0; o < 2; ++o) {
+            std::string gatherName = g->target->hasGather() ?
+                "__pseudo_gather_base_offsets" : "__pseudo_gather_factored_base_offsets";
+            std::string scatterName = g->target->hasScatter() ?
+                "__pseudo_scatter_base_offsets" : "__pseudo_scatter_factored_base_offsets";
+            std::string suffix = std::string(offsetTypes[o]) + "_" + types[t];
+            info.push_back(AoSInfo(gatherName + suffix,
+                                   std::string("__masked_load_") + types[t],
+                                   true, !g->target->hasGather(), t < 2 ? 4 : 8));
+            info.push_back(AoSInfo(scatterName + suffix,
+                                   std::string("__pseudo_masked_store_") + types[t],
+                                   false, !g->target->hasScatter(), t < 2 ? 4 : 8));
+        }
+    }
+
+    llvm::Function *calledFunc = callInst->getCalledFunction();
+    AoSInfo *aosInfo = NULL;
+    for (unsigned int i = 0; i < info.size(); ++i) {
+        if (info[i].pseudoFunc != NULL && info[i].memFunc != NULL &&
+            calledFunc == info[i].pseudoFunc) {
+            aosInfo = &info[i];
+            break;
+        }
+    }
+    if (aosInfo == NULL)
+        return false;
+
+    // The operands that the other gathers/scatters in the group must
+    // share with this one, and the operand that holds the per-instance
+    // offsets that may differ by a constant.
+    int offsetsArg = aosInfo->isFactored ? 3 : 2;
+    int valueArg = aosInfo->isGather ? -1 : (offsetsArg + 1);
+    int maskArg = aosInfo->isGather ? (offsetsArg + 1) : (offsetsArg + 2);
+    llvm::Value *mask = callInst->getArgOperand(maskArg);
+
+    // Find the other gathers/scatters that could be in the same group
+    // (up to 7 others), recording each one's constant offset in bytes
+    // from this one.  Gathers may be moved up to this one as long as no
+    // writes to memory intervene; scatters are all moved down to the last
+    // one, so there mustn't be any memory accesses at all in between.
+    std::map<int64_t, llvm::CallInst *> byOffset;
+    byOffset[0] = callInst;
+    llvm::BasicBlock::iterator iter(callInst);
+    for (++iter; iter != callInst->getParent()->end() && byOffset.size() < 8;
+         ++iter) {
+        llvm::CallInst *ci = llvm::dyn_cast<llvm::CallInst>(&*iter);
+        if (ci != NULL && ci->getCalledFunction() == calledFunc) {
+            bool same = true;
+            for (int i = 0; i < offsetsArg; ++i)
+                same &= (ci->getArgOperand(i) == callInst->getArgOperand(i));
+            same &= (ci->getArgOperand(maskArg) == mask);
+
+            int64_t delta;
+            if (same && lVectorsDifferByConstant(callInst->getArgOperand(offsetsArg),
+                                                 ci->getArgOperand(offsetsArg),
+                                                 &delta)) {
+                if (!aosInfo->isFactored) {
+                    llvm::ConstantInt *scale =
+                        llvm::dyn_cast<llvm::ConstantInt>(callInst->getArgOperand(1));
+                    if (scale == NULL)
+                        break;
+                    delta *= (int64_t)scale->getZExtValue();
+                }
+                if (byOffset.find(delta) == byOffset.end()) {
+                    byOffset[delta] = ci;
+                    continue;
+                }
+            }
+        }
+
+        if (aosInfo->isGather ? lInstructionMayWriteToMemory(&*iter) :
+                                iter->mayReadOrWriteMemory())
+            break;
+    }
+    if (byOffset.size() < 2)
+        return false;
+
+    // Compute the full offsets for this one to check the stride.
+    std::vector<llvm::Instruction *> offsetsInsts;
+    if (aosInfo->isFactored) {
+        llvm::Value *varyingOffsets = callInst->getArgOperand(1);
+        llvm::Constant *offsetScaleVec =
+            lGetOffsetScaleVec(callInst->getArgOperand(2), varyingOffsets->getType());
+        offsetsInsts.push_back(
+            llvm::BinaryOperator::Create(llvm::Instruction::Mul, offsetScaleVec,
+                                         varyingOffsets, "scaled_varying", callInst));
+        offsetsInsts.push_back(
+            llvm::BinaryOperator::Create(llvm::Instruction::Add, offsetsInsts[0],
+                                         callInst->getArgOperand(3),
+                                         "varying+const_offsets", callInst));
+    }
+    else {
+        llvm::Value *offsets = callInst->getArgOperand(2);
+        llvm::Constant *offsetScaleVec =
+            lGetOffsetScaleVec(callInst->getArgOperand(1), offsets->getType());
+        offsetsInsts.push_back(
+            llvm::BinaryOperator::Create(llvm::Instruction::Mul, offsetScaleVec,
+                                         offsets, "scaled_offsets", callInst));
+    }
+    llvm::Value *fullOffsets = offsetsInsts.back();
+
+    // See if the stride matches the size of a structure for which all of
+    // the fields are accessed: the fields have to be at byte offsets
+    // start, start+size, ... start+(n-1)*size from this one.
+    int size = aosInfo->size;
+    int nFields = 0;
+    int64_t start = 0;
+    int fieldCounts[] = { 8, 4, 3, 2 };
+    for (int f = 0; f < 4 && nFields == 0; ++f) {
+        int n = fieldCounts[f];
+        if ((int)byOffset.size() < n || !LLVMVectorIsLinear(fullOffsets, n * size))
+            continue;
+        for (int64_t s = -(n - 1) * size; s <= 0; s += size) {
+            int k;
+            for (k = 0; k < n; ++k)
+                if (byOffset.find(s + k * size) == byOffset.end())
+                    break;
+            if (k == n) {
+                nFields = n;
+                start = s;
+                break;
+            }
+        }
+    }
+
+    std::vector<llvm::CallInst *> fields;
+    for (int k = 0; k < nFields; ++k)
+        fields.push_back(byOffset[start + k * size]);
+
+    // Gathers are replaced by loads at the position of the first one;
+    // scatters by stores at the position of the last one.  In the latter
+    // case, any other scatters that matched above but aren't part of the
+    // group mustn't be in between.
+    llvm::Instruction *insertBefore = callInst;
+    if (nFields > 0 && !aosInfo->isGather) {
+        std::set<llvm::Instruction *> fieldSet(fields.begin(), fields.end());
+        bool sawOtherAccess = false;
+        for (llvm::BasicBlock::iterator it(callInst);
+             it != callInst->getParent()->end() &&
+                 fieldSet.size() > 0; ++it) {
+            if (fieldSet.erase(&*it) > 0) {
+                insertBefore = &*it;
+                if (sawOtherAccess)
+                    nFields = 0;
+            }
+            else if (it->mayReadOrWriteMemory())
+                sawOtherAccess = true;
+        }
+    }
+
+    if (nFields == 0) {
+        // Clean up the instructions created above.
+        while (offsetsInsts.size() > 0) {
+            offsetsInsts.back()->eraseFromParent();
+            offsetsInsts.pop_back();
+        }
+        return false;
+    }
+
+    SourcePos pos;
+    lGetSourcePosFromMetadata(callInst, &pos);
+    Debug(pos, "Transformed %d %ss with AOS layout to vector %ss "
+          "and shuffles.", nFields, aosInfo->isGather ? "gather" : "scatter",
+          aosInfo->isGather ? "load" : "store");
+
+    // Element e of the contiguous range of memory holds field e % nFields
+    // for program instance e / nFields; vector v of the range holds the
+    // elements [v*width, (v+1)*width).
+    int width = g->target->getVectorWidth();
+    llvm::Value *basePtr = lComputeCommonPointer(callInst->getArgOperand(0),
+                                                 fullOffsets, insertBefore);
+    bool allOn = (lGetMaskStatus(mask) == ALL_ON);
+
+    std::vector<llvm::Value *> vectors;
+    if (!aosInfo->isGather) {
+        std::vector<llvm::Value *> values;
+        for (int k = 0; k < nFields; ++k)
+            values.push_back(fields[k]->getArgOperand(valueArg));
+        for (int v = 0; v < nFields; ++v) {
+            std::vector<std::pair<int, int> > elts;
+            for (int i = 0; i < width; ++i) {
+                int e = v * width + i;
+                elts.push_back(std::make_pair(e % nFields, e / nFields));
+            }
+            vectors.push_back(lAssembleTransposed(values, elts, insertBefore));
+        }
+    }
+
+    for (int v = 0; v < nFields; ++v) {
+        // Each program instance's mask bit covers its nFields elements.
+        llvm::Value *vMask = mask;
+        if (!allOn) {
+            std::vector<int32_t> shuf;
+            for (int i = 0; i < width; ++i)
+                shuf.push_back((v * width + i) / nFields);
+            vMask = LLVMShuffleVectors(mask, mask, &shuf[0], width, insertBefore);
+        }
+
+        llvm::Value *ptr = lGEPInst(basePtr, LLVMInt64(start + v * width * size),
+                                    "aos_ptr", insertBefore);
+        if (aosInfo->isGather) {
+            llvm::Instruction *load =
+                lCallInst(aosInfo->memFunc, ptr, vMask, "aos_load", insertBefore);
+            lCopyMetadata(load, callInst);
+            vectors.push_back(load);
+        }
+        else {
+            ptr = new llvm::BitCastInst(ptr, llvm::PointerType::get(vectors[v]->getType(), 0),
+                                        "aos_ptr_cast", insertBefore);
+            llvm::Instruction *store =
+                lCallInst(aosInfo->memFunc, ptr, vectors[v], vMask, "",
+                          insertBefore);
+            lCopyMetadata(store, callInst);
+        }
+    }
+
+    for (int k = 0; k < nFields; ++k) {
+        if (aosInfo->isGather) {
+            std::vector<std::pair<int, int> > elts;
+            for (int i = 0; i < width; ++i) {
+                int e = i * nFields + k;
+                elts.push_back(std::make_pair(e / width, e % width));
+            }
+            llvm::Value *result = lAssembleTransposed(vectors, elts, insertBefore);
+            fields[k]->replaceAllUsesWith(result);
+        }
+        fields[k]->eraseFromParent();
+    }
+
+    return true;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////
 // MaskedStoreOptPass
 
+/** Returns true if the given pointer is known to point into a stack
+    allocation: i.e. it is computed from an alloca by some sequence of
+    bitcasts and GEPs. */
+static bool
+lIsStackPointer(llvm::Value *ptr) {
+    while (true) {
+        if (llvm::isa<llvm::AllocaInst>(ptr))
+            return true;
+        else if (llvm::BitCastInst *bc = llvm::dyn_cast<llvm::BitCastInst>(ptr))
+            ptr = bc->getOperand(0);
+        else if (llvm::GetElementPtrInst *gep =
+                 llvm::dyn_cast<llvm::GetElementPtrInst>(ptr))
+            ptr = gep->getPointerOperand();
+        else
+            return false;
+    }
+}
+
+
 /** Masked stores are generally more complex than regular stores; for
     example, they require multiple instructions to simulate under SSE.
     This optimization detects cases where masked stores can be replaced
@@ -3077,22 +3529,31 @@ lGSToLoadStore(llvm::CallInst *callInst) {
 static bool
 lImproveMaskedStore(llvm::CallInst *callInst) {
     struct MSInfo {
-        MSInfo(const char *name, const int a)
+        MSInfo(const char *name, const int a, const char *ssName = NULL)
             : align(a) {
             func = m->module->getFunction(name);
             Assert(func != NULL);
+            streamingStoreFunc =
+                (ssName != NULL) ? m->module->getFunction(ssName) : NULL;
         }
         llvm::Function *func;
+        llvm::Function *streamingStoreFunc;
         const int align;
     };
 
     MSInfo msInfo[] = {
-        MSInfo("__pseudo_masked_store_i8",  1),
-        MSInfo("__pseudo_masked_store_i16", 2),
-        MSInfo("__pseudo_masked_store_i32", 4),
-        MSInfo("__pseudo_masked_store_float", 4),
-        MSInfo("__pseudo_masked_store_i64", 8),
-        MSInfo("__pseudo_masked_store_double", 8),
+        MSInfo("__pseudo_masked_store_i8",  1,
+               "__streaming_store_varying_i8"),
+        MSInfo("__pseudo_masked_store_i16", 2,
+               "__streaming_store_varying_i16"),
+        MSInfo("__pseudo_masked_store_i32", 4,
+               "__streaming_store_varying_i32"),
+        MSInfo("__pseudo_masked_store_float", 4,
+               "__streaming_store_varying_float"),
+        MSInfo("__pseudo_masked_store_i64", 8,
+               "__streaming_store_varying_i64"),
+        MSInfo("__pseudo_masked_store_double", 8,
+               "__streaming_store_varying_double"),
         MSInfo("__masked_store_blend_i8",  1),
         MSInfo("__masked_store_blend_i16", 2),
         MSInfo("__masked_store_blend_i32", 4),
@@ -3133,6 +3594,23 @@ lImproveMaskedStore(llvm::CallInst *callInst) {
         callInst->eraseFromParent();
         return true;
     }
+    else if (maskStatus == ALL_ON && g->opt.streamingStores &&
+             info->streamingStoreFunc != NULL &&
+             !lIsStackPointer(lvalue)) {
+        // With --opt=streaming-stores, full-width stores to memory other
+        // than the stack go through the target's streaming store, which
+        // uses a non-temporal store if the pointer is suitably aligned.
+        llvm::Type *eltPtrType =
+            llvm::PointerType::get(rvalue->getType()->getVectorElementType(), 0);
+        lvalue = new llvm::BitCastInst(lvalue, eltPtrType, "lvalue_to_elt_ptr",
+                                       callInst);
+        lCopyMetadata(lvalue, callInst);
+        llvm::Instruction *store =
+            lCallInst(info->streamingStoreFunc, lvalue, rvalue, mask, "");
+        lCopyMetadata(store, callInst);
+        llvm::ReplaceInstWithInst(callInst, store);
+        return true;
+    }
     else if (maskStatus == ALL_ON) {
         // The mask is all on, so turn this into a regular store
         llvm::Type *rvalueType = rvalue->getType();
@@ -3246,6 +3724,10 @@ ImproveMemoryOpsPass::runOnBasicBlock(llvm::BasicBlock &bb) {
             modifiedAny = true;
             goto restart;
         }
+        if (lGSToAoSLoadStore(callInst)) {
+            modifiedAny = true;
+            goto restart;
+        }
         if (lImproveMaskedStore(callInst)) {
             modifiedAny = true;
             goto restart;
@@ -3289,18 +3771,26 @@ CreateImproveMemoryOpsPass() {
 //  it's specifically helpful when data with AOS layout is being accessed;
 //  in this case, we're often able to generate wide vector loads and
 //  appropriate shuffles automatically.
+//
+//  The gathers in a series don't all have to be in the same basic block:
+//  a gather may also be coalesced with gathers in later blocks that are
+//  executed exactly when it is (e.g. the blocks before and after an
+//  if/else), as long as no path between them may write to memory.
 
-class GatherCoalescePass : public llvm::BasicBlockPass {
+class GatherCoalescePass : public llvm::FunctionPass {
 public:
     static char ID;
-    GatherCoalescePass() : BasicBlockPass(ID) { }
+    GatherCoalescePass() : FunctionPass(ID) { }
 
 #if ISPC_LLVM_VERSION <= ISPC_LLVM_3_9
     const char *getPassName() const { return "Gather Coalescing"; }
 #else // LLVM 4.0+
     llvm::StringRef getPassName() const { return "Gather Coalescing"; }
 #endif
-    bool runOnBasicBlock(llvm::BasicBlock &BB);
+    bool runOnFunction(llvm::Function &F);
+
+private:
+    bool coalesceBlock(llvm::BasicBlock &bb);
 };
 
 char GatherCoalescePass::ID = 0;
@@ -3493,15 +3983,19 @@ lSelectLoads(const std::vector<int64_t> &loadOffsets,
 
 
 /** Print a performance message with the details of the result of
-    coalescing over a group of gathers. */
+    coalescing over a group of gathers or scatters.  opsCount maps from the
+    width of each memory operation that was emitted to the number of them,
+    accessName is "gather" or "scatter", and opName is "load" or "store".
+ */
 static void
-lCoalescePerfInfo(const std::vector<llvm::CallInst *> &coalesceGroup,
-                  const std::vector<CoalescedLoadOp> &loadOps) {
+lPrintCoalescePerfInfo(const std::vector<llvm::CallInst *> &coalesceGroup,
+                       const std::map<int, int> &opsCount, int nOps,
+                       const char *accessName, const char *opName) {
     SourcePos pos;
     lGetSourcePosFromMetadata(coalesceGroup[0], &pos);
 
     // Create a string that indicates the line numbers of the subsequent
-    // gathers from the first one that were coalesced here.
+    // gathers or scatters from the first one that were coalesced here.
     char otherPositions[512];
     otherPositions[0] = '\0';
     if (coalesceGroup.size() > 1) {
@@ -3524,33 +4018,43 @@ lCoalescePerfInfo(const std::vector<llvm::CallInst *> &coalesceGroup,
         strcat(otherPositions, ") ");
     }
 
-    // Count how many loads of each size there were.
-    std::map<int, int> loadOpsCount;
-    for (int i = 0; i < (int)loadOps.size(); ++i)
-        ++loadOpsCount[loadOps[i].count];
-
-    // Generate a string the describes the mix of load ops
-    char loadOpsInfo[512];
-    loadOpsInfo[0] = '\0';
-    std::map<int, int>::const_iterator iter = loadOpsCount.begin();
-    while (iter != loadOpsCount.end()) {
+    // Generate a string the describes the mix of memory ops
+    char opsInfo[512];
+    opsInfo[0] = '\0';
+    std::map<int, int>::const_iterator iter = opsCount.begin();
+    while (iter != opsCount.end()) {
         char buf[32];
         sprintf(buf, "%d x %d-wide", iter->second, iter->first);
-        strcat(loadOpsInfo, buf);
+        strcat(opsInfo, buf);
         ++iter;
-        if (iter != loadOpsCount.end())
-            strcat(loadOpsInfo, ", ");
+        if (iter != opsCount.end())
+            strcat(opsInfo, ", ");
     }
 
     if (coalesceGroup.size() == 1)
-        PerformanceWarning(pos, "Coalesced gather into %d load%s (%s).",
-                           (int)loadOps.size(),
-                           (loadOps.size() > 1) ? "s" : "", loadOpsInfo);
+        PerformanceWarning(pos, "Coalesced %s into %d %s%s (%s).",
+                           accessName, nOps, opName,
+                           (nOps > 1) ? "s" : "", opsInfo);
     else
-        PerformanceWarning(pos, "Coalesced %d gathers starting here %sinto %d "
-                           "load%s (%s).", (int)coalesceGroup.size(),
-                           otherPositions,(int)loadOps.size(),
-                           (loadOps.size() > 1) ? "s" : "", loadOpsInfo);
+        PerformanceWarning(pos, "Coalesced %d %ss starting here %sinto %d "
+                           "%s%s (%s).", (int)coalesceGroup.size(), accessName,
+                           otherPositions, nOps, opName,
+                           (nOps > 1) ? "s" : "", opsInfo);
+}
+
+
+/** Print a performance message with the details of the result of
+    coalescing over a group of gathers. */
+static void
+lCoalescePerfInfo(const std::vector<llvm::CallInst *> &coalesceGroup,
+                  const std::vector<CoalescedLoadOp> &loadOps) {
+    // Count how many loads of each size there were.
+    std::map<int, int> loadOpsCount;
+    for (int i = 0; i < (int)loadOps.size(); ++i)
+        ++loadOpsCount[loadOps[i].count];
+
+    lPrintCoalescePerfInfo(coalesceGroup, loadOpsCount, (int)loadOps.size(),
+                           "gather", "load");
 }
 
 
@@ -4193,8 +4697,201 @@ lInstructionMayWriteToMemory(llvm::Instruction *inst) {
 }
 
 
+/** Returns true if the gather fwdCall can be coalesced with the gather
+    callInst: both have to be calls to the same function with the same
+    base pointer, variable offsets, offset scale, and mask.
+ */
+static bool
+lGathersMatch(llvm::CallInst *callInst, llvm::CallInst *fwdCall) {
+    if (fwdCall->getCalledFunction() != callInst->getCalledFunction())
+        return false;
+
+    llvm::Value *base = callInst->getArgOperand(0);
+    llvm::Value *variableOffsets = callInst->getArgOperand(1);
+    llvm::Value *offsetScale = callInst->getArgOperand(2);
+    llvm::Value *mask = callInst->getArgOperand(4);
+
+    SourcePos fwdPos;
+    bool ok = lGetSourcePosFromMetadata(fwdCall, &fwdPos);
+    Assert(ok);
+
+    if (g->debugPrint) {
+        if (base != fwdCall->getArgOperand(0)) {
+            Debug(fwdPos, "base pointers mismatch");
+            LLVMDumpValue(base);
+            LLVMDumpValue(fwdCall->getArgOperand(0));
+        }
+        if (variableOffsets != fwdCall->getArgOperand(1)) {
+            Debug(fwdPos, "varying offsets mismatch");
+            LLVMDumpValue(variableOffsets);
+            LLVMDumpValue(fwdCall->getArgOperand(1));
+        }
+        if (offsetScale != fwdCall->getArgOperand(2)) {
+            Debug(fwdPos, "offset scales mismatch");
+            LLVMDumpValue(offsetScale);
+            LLVMDumpValue(fwdCall->getArgOperand(2));
+        }
+        if (mask != fwdCall->getArgOperand(4)) {
+            Debug(fwdPos, "masks mismatch");
+            LLVMDumpValue(mask);
+            LLVMDumpValue(fwdCall->getArgOperand(4));
+        }
+    }
+
+    if (base == fwdCall->getArgOperand(0) &&
+        variableOffsets == fwdCall->getArgOperand(1) &&
+        offsetScale == fwdCall->getArgOperand(2) &&
+        mask == fwdCall->getArgOperand(4)) {
+        Debug(fwdPos, "This gather can be coalesced.");
+        return true;
+    }
+    else {
+        Debug(fwdPos, "This gather doesn't match the initial one.");
+        return false;
+    }
+}
+
+
+/** Adds all of the basic blocks that can be reached from the given start
+    block to *visited, following successor edges if forward is true and
+    predecessor edges otherwise.  The start block itself is only added if
+    it's reachable from itself.  The stop blocks (either of which may be
+    NULL) are added to *visited if they're reached, but the search doesn't
+    continue past them.
+ */
+static void
+lFindReachableBlocks(llvm::BasicBlock *start, bool forward,
+                     llvm::BasicBlock *stop0, llvm::BasicBlock *stop1,
+                     std::set<llvm::BasicBlock *> *visited) {
+    std::vector<llvm::BasicBlock *> worklist;
+    worklist.push_back(start);
+    while (worklist.size() > 0) {
+        llvm::BasicBlock *bb = worklist.back();
+        worklist.pop_back();
+
+        std::vector<llvm::BasicBlock *> next;
+        if (forward)
+            next.insert(next.end(), llvm::succ_begin(bb), llvm::succ_end(bb));
+        else
+            next.insert(next.end(), llvm::pred_begin(bb), llvm::pred_end(bb));
+
+        for (unsigned int i = 0; i < next.size(); ++i) {
+            if (visited->insert(next[i]).second &&
+                next[i] != stop0 && next[i] != stop1)
+                worklist.push_back(next[i]);
+        }
+    }
+}
+
+
+/** Returns true if gathers at the end of the basic block 'first' can be
+    coalesced with gathers at the start of the basic block 'second'; the
+    caller is responsible for checking that there are no writes to memory
+    after the gathers in 'first' and before the ones in 'second'.  The
+    coalesced loads are emitted in 'first', so this is only safe if:
+
+    - 'first' dominates 'second', so that the loaded values are available,
+    - every path from 'first' leads to 'second' without passing through
+      'first' again, and 'second' isn't executed again without first going
+      through 'first', so that the loads are executed exactly when the
+      gathers in 'second' would have been and aren't speculative, and
+    - no block on a path between the two may write to memory.
+ */
+static bool
+lCanCoalesceAcrossBlocks(llvm::BasicBlock *first, llvm::BasicBlock *second) {
+    llvm::BasicBlock *entry = &first->getParent()->getEntryBlock();
+    if (first != entry) {
+        if (second == entry)
+            return false;
+        std::set<llvm::BasicBlock *> fromEntry;
+        lFindReachableBlocks(entry, true, first, NULL, &fromEntry);
+        if (fromEntry.find(second) != fromEntry.end())
+            // There's a path to 'second' that skips 'first'
+            return false;
+    }
+
+    std::set<llvm::BasicBlock *> between;
+    lFindReachableBlocks(first, true, first, second, &between);
+    if (between.find(first) != between.end() ||
+        between.find(second) == between.end())
+        return false;
+
+    std::set<llvm::BasicBlock *> reachSecond;
+    lFindReachableBlocks(second, false, first, NULL, &reachSecond);
+
+    std::set<llvm::BasicBlock *>::iterator iter;
+    for (iter = between.begin(); iter != between.end(); ++iter) {
+        if (*iter == second)
+            continue;
+        if (reachSecond.find(*iter) == reachSecond.end())
+            // We may go from 'first' to somewhere that doesn't lead to
+            // 'second' (an exit or an infinite loop).
+            return false;
+        for (llvm::BasicBlock::iterator inst = (*iter)->begin();
+             inst != (*iter)->end(); ++inst)
+            if (lInstructionMayWriteToMemory(&*inst))
+                return false;
+    }
+
+    std::set<llvm::BasicBlock *> fromSecond;
+    lFindReachableBlocks(second, true, first, NULL, &fromSecond);
+    return fromSecond.find(second) == fromSecond.end();
+}
+
+
+/** Once there are no more writes to memory after the given gather in its
+    basic block, look for gathers that it can be coalesced with at the
+    start of the other blocks in the function and add them to
+    *coalesceGroup.
+ */
+static void
+lAddGathersFromOtherBlocks(llvm::CallInst *callInst,
+                           std::vector<llvm::CallInst *> *coalesceGroup) {
+    llvm::BasicBlock *first = callInst->getParent();
+    llvm::Function *func = first->getParent();
+
+    for (llvm::Function::iterator bbIter = func->begin();
+         bbIter != func->end() && coalesceGroup->size() < 4; ++bbIter) {
+        llvm::BasicBlock *bb = &*bbIter;
+        if (bb == first)
+            continue;
+
+        std::vector<llvm::CallInst *> matches;
+        for (llvm::BasicBlock::iterator iter = bb->begin();
+             iter != bb->end() && coalesceGroup->size() + matches.size() < 4;
+             ++iter) {
+            if (lInstructionMayWriteToMemory(&*iter))
+                break;
+
+            llvm::CallInst *fwdCall = llvm::dyn_cast<llvm::CallInst>(&*iter);
+            if (fwdCall != NULL && lGathersMatch(callInst, fwdCall))
+                matches.push_back(fwdCall);
+        }
+
+        // Only check the control flow if there's something to gain.
+        if (matches.size() > 0 && lCanCoalesceAcrossBlocks(first, bb)) {
+            SourcePos pos;
+            lGetSourcePosFromMetadata(matches[0], &pos);
+            Debug(pos, "Coalescing with gather(s) in another basic block.");
+            coalesceGroup->insert(coalesceGroup->end(), matches.begin(),
+                                  matches.end());
+        }
+    }
+}
+
+
+bool
+GatherCoalescePass::runOnFunction(llvm::Function &F) {
+    bool modifiedAny = false;
+    for (llvm::Function::iterator bbIter = F.begin(); bbIter != F.end();
+         ++bbIter)
+        modifiedAny |= coalesceBlock(*bbIter);
+    return modifiedAny;
+}
+
+
 bool
-GatherCoalescePass::runOnBasicBlock(llvm::BasicBlock &bb) {
+GatherCoalescePass::coalesceBlock(llvm::BasicBlock &bb) {
     DEBUG_START_PASS("GatherCoalescePass");
 
     llvm::Function *gatherFuncs[] = {
@@ -4232,9 +4929,7 @@ GatherCoalescePass::runOnBasicBlock(llvm::BasicBlock &bb) {
         lGetSourcePosFromMetadata(callInst, &pos);
         Debug(pos, "Checking for coalescable gathers starting here...");
 
-        llvm::Value *base = callInst->getArgOperand(0);
         llvm::Value *variableOffsets = callInst->getArgOperand(1);
-        llvm::Value *offsetScale = callInst->getArgOperand(2);
         llvm::Value *mask = callInst->getArgOperand(4);
 
         // To apply this optimization, we need a set of one or more gathers
@@ -4264,65 +4959,40 @@ GatherCoalescePass::runOnBasicBlock(llvm::BasicBlock &bb) {
         // look at the remainder of instructions in the basic block (up
         // until we reach a write to memory) to try to find any other
         // gathers that can coalesce with this one.
+        bool reachedEnd = true;
         llvm::BasicBlock::iterator fwdIter = iter;
         ++fwdIter;
         for (; fwdIter != bb.end(); ++fwdIter) {
             // Must stop once we come to an instruction that may write to
             // memory; otherwise we could end up moving a read before this
             // write.
-            if (lInstructionMayWriteToMemory(&*fwdIter))
+            if (lInstructionMayWriteToMemory(&*fwdIter)) {
+                reachedEnd = false;
                 break;
+            }
 
             llvm::CallInst *fwdCall = llvm::dyn_cast<llvm::CallInst>(&*fwdIter);
-            if (fwdCall == NULL ||
-                fwdCall->getCalledFunction() != calledFunc)
+            if (fwdCall == NULL || !lGathersMatch(callInst, fwdCall))
                 continue;
 
-            SourcePos fwdPos;
-            bool ok = lGetSourcePosFromMetadata(fwdCall, &fwdPos);
-            Assert(ok);
-
-            if (g->debugPrint) {
-                if (base != fwdCall->getArgOperand(0)) {
-                    Debug(fwdPos, "base pointers mismatch");
-                    LLVMDumpValue(base);
-                    LLVMDumpValue(fwdCall->getArgOperand(0));
-                }
-                if (variableOffsets != fwdCall->getArgOperand(1)) {
-                    Debug(fwdPos, "varying offsets mismatch");
-                    LLVMDumpValue(variableOffsets);
-                    LLVMDumpValue(fwdCall->getArgOperand(1));
-                }
-                if (offsetScale != fwdCall->getArgOperand(2)) {
-                    Debug(fwdPos, "offset scales mismatch");
-                    LLVMDumpValue(offsetScale);
-                    LLVMDumpValue(fwdCall->getArgOperand(2));
-                }
-                if (mask != fwdCall->getArgOperand(4)) {
-                    Debug(fwdPos, "masks mismatch");
-                    LLVMDumpValue(mask);
-                    LLVMDumpValue(fwdCall->getArgOperand(4));
-                }
-            }
-
-            if (base == fwdCall->getArgOperand(0) &&
-                variableOffsets == fwdCall->getArgOperand(1) &&
-                offsetScale == fwdCall->getArgOperand(2) &&
-                mask == fwdCall->getArgOperand(4)) {
-                Debug(fwdPos, "This gather can be coalesced.");
-                coalesceGroup.push_back(fwdCall);
+            coalesceGroup.push_back(fwdCall);
 
-                if (coalesceGroup.size() == 4)
-                    // FIXME: untested heuristic: don't try to coalesce
-                    // over a window of more than 4 gathers, so that we
-                    // don't cause too much register pressure and end up
-                    // spilling to memory anyway.
-                    break;
+            if (coalesceGroup.size() == 4) {
+                // FIXME: untested heuristic: don't try to coalesce
+                // over a window of more than 4 gathers, so that we
+                // don't cause too much register pressure and end up
+                // spilling to memory anyway.
+                reachedEnd = false;
+                break;
             }
-            else
-                Debug(fwdPos, "This gather doesn't match the initial one.");
         }
 
+        // If nothing after the gather in this block writes to memory,
+        // there may be more gathers to coalesce with in the blocks that
+        // follow.
+        if (reachedEnd)
+            lAddGathersFromOtherBlocks(callInst, &coalesceGroup);
+
         Debug(pos, "Done with checking for matching gathers");
 
         // Now that we have a group of gathers, see if we can coalesce them
@@ -4346,10 +5016,388 @@ CreateGatherCoalescePass() {
 
 
 ///////////////////////////////////////////////////////////////////////////
-// ReplacePseudoMemoryOpsPass
+// ScatterCoalescePass
+
+// This pass is the counterpart of GatherCoalescePass for scatters.  For a
+// series of two or more scatters of 32-bit or 64-bit values with the mask
+// all on that all write to constant offsets from a common base pointer (as
+// happens, for example, when the members of a varying struct are written
+// back to memory with AOS layout), it works out the full set of locations
+// written and stores to them with as few wide vector stores as possible,
+// shuffling the values to be stored into place.
+//
+// Unlike loads, a store can't touch any more memory than the scatters
+// themselves write to; vector stores are thus only used for runs of
+// contiguous offsets and the remaining locations are written with scalar
+// stores.  Scatters under a mask that isn't known to be all on are left
+// alone.
 
-/** For any gathers and scatters remaining after the GSToLoadStorePass
-    runs, we need to turn them into actual native gathers and scatters.
+class ScatterCoalescePass : public llvm::BasicBlockPass {
+public:
+    static char ID;
+    ScatterCoalescePass() : BasicBlockPass(ID) { }
+
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_9
+    const char *getPassName() const { return "Scatter Coalescing"; }
+#else // LLVM 4.0+
+    llvm::StringRef getPassName() const { return "Scatter Coalescing"; }
+#endif
+    bool runOnBasicBlock(llvm::BasicBlock &BB);
+};
+
+char ScatterCoalescePass::ID = 0;
+
+
+/** Representation of a memory store that the scatter coalescing code has
+    decided to generate.
+ */
+struct CoalescedStoreOp {
+    CoalescedStoreOp(int64_t s, int c) {
+        start = s;
+        count = c;
+    }
+
+    /** Starting offset of the store from the common base pointer (in
+        terms of numbers of items of the underlying element type). */
+    int64_t start;
+
+    /** Number of elements to store at this location */
+    int count;
+};
+
+
+/** For each offset written by a group of scatters, this records which
+    scatter in the group (first) and which of its program instances
+    (second) supplies the value that ends up in memory there. */
+typedef std::map<int64_t, std::pair<int, int> > ScatterSourceMap;
+
+
+/** Given the locations written by a group of scatters, determine a set of
+    store operations that write all of them, using 8, 4, or 2-wide vector
+    stores for runs of contiguous offsets and scalar stores otherwise.
+ */
+static void
+lSelectStores(const ScatterSourceMap &sources,
+              std::vector<CoalescedStoreOp> *stores) {
+    ScatterSourceMap::const_iterator iter = sources.begin();
+    while (iter != sources.end()) {
+        Debug(SourcePos(), "Store needed at %" PRId64 ".", iter->first);
+
+        int vectorWidths[] = { 8, 4, 2 };
+        int nVectorWidths = sizeof(vectorWidths) / sizeof(vectorWidths[0]);
+        int count = 1;
+        for (int i = 0; i < nVectorWidths; ++i) {
+            // A vector store of this width can only be used if every
+            // location that it covers is written by one of the scatters.
+            ScatterSourceMap::const_iterator spanIter = iter;
+            int j = 0;
+            while (j < vectorWidths[i] && spanIter != sources.end() &&
+                   spanIter->first == iter->first + j) {
+                ++spanIter;
+                ++j;
+            }
+            if (j == vectorWidths[i]) {
+                count = vectorWidths[i];
+                break;
+            }
+        }
+
+        stores->push_back(CoalescedStoreOp(iter->first, count));
+        for (int j = 0; j < count; ++j)
+            ++iter;
+    }
+}
+
+
+/** Print a performance message with the details of the result of
+    coalescing over a group of scatters. */
+static void
+lScatterCoalescePerfInfo(const std::vector<llvm::CallInst *> &coalesceGroup,
+                         const std::vector<CoalescedStoreOp> &storeOps) {
+    // Count how many stores of each size there were.
+    std::map<int, int> storeOpsCount;
+    for (int i = 0; i < (int)storeOps.size(); ++i)
+        ++storeOpsCount[storeOps[i].count];
+
+    lPrintCoalescePerfInfo(coalesceGroup, storeOpsCount, (int)storeOps.size(),
+                           "scatter", "store");
+}
+
+
+/** Utility routine that computes an offset from a base pointer and then
+    stores the given value to the resulting location:
+
+    *((typeof(value) *)(basePtr + offset)) = value
+ */
+static void
+lGEPAndStore(llvm::Value *basePtr, int64_t offset, int align,
+             llvm::Value *value, llvm::Instruction *insertBefore) {
+    llvm::Value *ptr = lGEPInst(basePtr, LLVMInt64(offset), "new_base",
+                                insertBefore);
+    ptr = new llvm::BitCastInst(ptr, llvm::PointerType::get(value->getType(), 0),
+                                "ptr_cast", insertBefore);
+    new llvm::StoreInst(value, ptr, false /* not volatile */, align,
+                        insertBefore);
+}
+
+
+/** Returns the value to be written by the given store operation, gathered
+    up from the program instances of the scatters' values that supply it.
+    The values vector holds the scatters' values, already bitcast to
+    <n x i32> or <n x i64> vectors.  As many of the elements as possible are assembled
+    with a single shuffle; any elements that come from further vectors are
+    then inserted individually.
+ */
+static llvm::Value *
+lAssembleStoreValue(const CoalescedStoreOp &store,
+                    const ScatterSourceMap &sources,
+                    const std::vector<llvm::Value *> &values,
+                    llvm::Instruction *insertBefore) {
+    ScatterSourceMap::const_iterator iter = sources.find(store.start);
+    Assert(iter != sources.end());
+
+    if (store.count == 1)
+        return llvm::ExtractElementInst::Create(values[iter->second.first],
+                                                LLVMInt32(iter->second.second),
+                                                "scatter_elt", insertBefore);
+
+    int width = g->target->getVectorWidth();
+    int srcs[2] = { iter->second.first, -1 };
+    int32_t shuf[8];
+    for (int i = 0; i < store.count; ++i, ++iter) {
+        Assert(iter != sources.end() && iter->first == store.start + i);
+        int src = iter->second.first, lane = iter->second.second;
+        if (src == srcs[0])
+            shuf[i] = lane;
+        else if (srcs[1] == -1 || src == srcs[1]) {
+            srcs[1] = src;
+            shuf[i] = width + lane;
+        }
+        else
+            shuf[i] = -1;
+    }
+
+    llvm::Value *v0 = values[srcs[0]];
+    llvm::Value *v1 = (srcs[1] == -1) ? v0 : values[srcs[1]];
+    llvm::Value *result = LLVMShuffleVectors(v0, v1, shuf, store.count,
+                                             insertBefore);
+
+    iter = sources.find(store.start);
+    for (int i = 0; i < store.count; ++i, ++iter) {
+        if (shuf[i] != -1)
+            continue;
+        llvm::Value *elt =
+            llvm::ExtractElementInst::Create(values[iter->second.first],
+                                             LLVMInt32(iter->second.second),
+                                             "scatter_elt", insertBefore);
+        result = llvm::InsertElementInst::Create(result, elt, LLVMInt32(i),
+                                                 "insert_store", insertBefore);
+    }
+    return result;
+}
+
+
+/** Actually do the coalescing for a group of scatters that all write to
+    addresses of the form basePtr + constOffset (see lCoalesceGathers()).
+    The new stores are emitted just before the last scatter in the group,
+    at which point all of the values to be stored are available;
+    ScatterCoalescePass::runOnBasicBlock() has made sure that no other
+    instructions in between access memory.
+ */
+static bool
+lCoalesceScatters(const std::vector<llvm::CallInst *> &coalesceGroup) {
+    llvm::Instruction *insertBefore = coalesceGroup.back();
+
+    llvm::Type *valueType = coalesceGroup[0]->getArgOperand(4)->getType();
+    llvm::Type *intVectorType = NULL;
+    int elementSize = 0;
+    if (valueType == LLVMTypes::Int32VectorType ||
+        valueType == LLVMTypes::FloatVectorType) {
+        intVectorType = LLVMTypes::Int32VectorType;
+        elementSize = 4;
+    }
+    else if (valueType == LLVMTypes::Int64VectorType ||
+             valueType == LLVMTypes::DoubleVectorType) {
+        intVectorType = LLVMTypes::Int64VectorType;
+        elementSize = 8;
+    }
+    else
+        FATAL("Unexpected scatter type in lCoalesceScatters");
+
+    // The stores are issued in units of elements, so all of the offsets
+    // need to be a multiple of the element size.
+    std::vector<int64_t> constOffsets;
+    lExtractConstOffsets(coalesceGroup, 1, &constOffsets);
+    for (int i = 0; i < (int)constOffsets.size(); ++i) {
+        if ((constOffsets[i] % elementSize) != 0)
+            return false;
+        constOffsets[i] /= elementSize;
+    }
+
+    llvm::Value *basePtr = lComputeBasePtr(coalesceGroup[0], insertBefore);
+
+    // Work out which value ends up at each offset.  If more than one
+    // program instance writes to the same location, the later scatter
+    // (and, within a scatter, the higher program instance) wins, just as
+    // with the scalarized scatter code.
+    int width = g->target->getVectorWidth();
+    ScatterSourceMap sources;
+    for (int i = 0; i < (int)constOffsets.size(); ++i)
+        sources[constOffsets[i]] = std::make_pair(i / width, i % width);
+
+    std::vector<CoalescedStoreOp> storeOps;
+    lSelectStores(sources, &storeOps);
+
+    lScatterCoalescePerfInfo(coalesceGroup, storeOps);
+
+    std::vector<llvm::Value *> values;
+    for (int i = 0; i < (int)coalesceGroup.size(); ++i) {
+        llvm::Value *value = coalesceGroup[i]->getArgOperand(4);
+        if (value->getType() != intVectorType)
+            value = new llvm::BitCastInst(value, intVectorType,
+                                          "scatter_value_to_int",
+                                          insertBefore);
+        values.push_back(value);
+    }
+
+    Debug(SourcePos(), "Coalesce doing %d stores.", (int)storeOps.size());
+    for (int i = 0; i < (int)storeOps.size(); ++i) {
+        Debug(SourcePos(), "Store #%d @ %" PRId64 ", %d items", i,
+              storeOps[i].start, storeOps[i].count);
+
+        llvm::Value *value = lAssembleStoreValue(storeOps[i], sources, values,
+                                                 insertBefore);
+        int align = elementSize;
+        if (storeOps[i].count >= 4 && g->opt.forceAlignedMemory)
+            align = g->target->getNativeVectorAlignment();
+        lGEPAndStore(basePtr, storeOps[i].start * elementSize, align, value,
+                     insertBefore);
+    }
+
+    for (int i = 0; i < (int)coalesceGroup.size(); ++i)
+        coalesceGroup[i]->eraseFromParent();
+
+    return true;
+}
+
+
+bool
+ScatterCoalescePass::runOnBasicBlock(llvm::BasicBlock &bb) {
+    DEBUG_START_PASS("ScatterCoalescePass");
+
+    llvm::Function *scatterFuncs[] = {
+        m->module->getFunction("__pseudo_scatter_factored_base_offsets32_i32"),
+        m->module->getFunction("__pseudo_scatter_factored_base_offsets32_float"),
+        m->module->getFunction("__pseudo_scatter_factored_base_offsets64_i32"),
+        m->module->getFunction("__pseudo_scatter_factored_base_offsets64_float"),
+        m->module->getFunction("__pseudo_scatter_factored_base_offsets32_i64"),
+        m->module->getFunction("__pseudo_scatter_factored_base_offsets32_double"),
+        m->module->getFunction("__pseudo_scatter_factored_base_offsets64_i64"),
+        m->module->getFunction("__pseudo_scatter_factored_base_offsets64_double"),
+    };
+    int nScatterFuncs = sizeof(scatterFuncs) / sizeof(scatterFuncs[0]);
+
+    bool modifiedAny = false;
+
+ restart:
+    for (llvm::BasicBlock::iterator iter = bb.begin(), e = bb.end(); iter != e;
+         ++iter) {
+        llvm::CallInst *callInst = llvm::dyn_cast<llvm::CallInst>(&*iter);
+        if (callInst == NULL)
+            continue;
+
+        llvm::Function *calledFunc = callInst->getCalledFunction();
+        if (calledFunc == NULL)
+            continue;
+
+        int i;
+        for (i = 0; i < nScatterFuncs; ++i)
+            if (scatterFuncs[i] != NULL && calledFunc == scatterFuncs[i])
+                break;
+        if (i == nScatterFuncs)
+            continue;
+
+        SourcePos pos;
+        lGetSourcePosFromMetadata(callInst, &pos);
+        Debug(pos, "Checking for coalescable scatters starting here...");
+
+        llvm::Value *base = callInst->getArgOperand(0);
+        llvm::Value *variableOffsets = callInst->getArgOperand(1);
+        llvm::Value *offsetScale = callInst->getArgOperand(2);
+        llvm::Value *mask = callInst->getArgOperand(5);
+
+        // The same conditions as for coalescing gathers apply: mask all
+        // on, uniform variable offsets, and the same base pointer,
+        // variable offsets, and offset scale across the group.
+        if (lGetMaskStatus(mask) != ALL_ON)
+            continue;
+
+        if (!LLVMVectorValuesAllEqual(variableOffsets))
+            continue;
+
+        std::vector<llvm::CallInst *> coalesceGroup;
+        coalesceGroup.push_back(callInst);
+
+        // Look at the following instructions for more scatters to add to
+        // the group.  Because the coalesced stores are all issued at the
+        // last scatter in the group, the earlier ones are effectively
+        // moved later; we must therefore stop at the first instruction
+        // that may read or write memory, so that no access is reordered
+        // with respect to them.
+        llvm::BasicBlock::iterator fwdIter = iter;
+        ++fwdIter;
+        for (; fwdIter != bb.end(); ++fwdIter) {
+            llvm::CallInst *fwdCall = llvm::dyn_cast<llvm::CallInst>(&*fwdIter);
+            if (fwdCall != NULL && fwdCall->getCalledFunction() == calledFunc &&
+                base == fwdCall->getArgOperand(0) &&
+                variableOffsets == fwdCall->getArgOperand(1) &&
+                offsetScale == fwdCall->getArgOperand(2) &&
+                lGetMaskStatus(fwdCall->getArgOperand(5)) == ALL_ON) {
+                SourcePos fwdPos;
+                lGetSourcePosFromMetadata(fwdCall, &fwdPos);
+                Debug(fwdPos, "This scatter can be coalesced.");
+                coalesceGroup.push_back(fwdCall);
+
+                if (coalesceGroup.size() == 4)
+                    // As with gathers, limit the window to 4 scatters.
+                    break;
+                continue;
+            }
+
+            if (fwdIter->mayReadOrWriteMemory())
+                break;
+        }
+
+        Debug(pos, "Done with checking for matching scatters");
+
+        // A lone scatter already does exactly the stores it needs, so
+        // there's nothing to be gained from it.
+        if (coalesceGroup.size() < 2)
+            continue;
+
+        if (lCoalesceScatters(coalesceGroup)) {
+            modifiedAny = true;
+            goto restart;
+        }
+    }
+
+    DEBUG_END_PASS("ScatterCoalescePass");
+
+    return modifiedAny;
+}
+
+
+static llvm::Pass *
+CreateScatterCoalescePass() {
+    return new ScatterCoalescePass;
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+// ReplacePseudoMemoryOpsPass
+
+/** For any gathers and scatters remaining after the GSToLoadStorePass
+    runs, we need to turn them into actual native gathers and scatters.
     This task is handled by the ReplacePseudoMemoryOpsPass here.
  */
 class ReplacePseudoMemoryOpsPass : public llvm::BasicBlockPass {
@@ -4472,6 +5520,238 @@ lReplacePseudoMaskedStore(llvm::CallInst *callInst) {
 }
 
 
+/** Returns a bitmask of the program instances that may be active under
+    the given execution mask.  This is exact if the mask is a
+    compile-time constant; the 'and' of two masks can only have lanes on
+    that are on in both of them.  Otherwise all lanes are returned.
+ */
+static uint64_t
+lGetPossiblyActiveLanes(llvm::Value *mask, int depth = 0) {
+    int width = g->target->getVectorWidth();
+    uint64_t allLanes = (width == 64) ? ~0ull : ((1ull << width) - 1);
+
+    uint64_t bits;
+    if (lGetMask(mask, &bits))
+        return bits & allLanes;
+
+    llvm::BinaryOperator *bop = llvm::dyn_cast<llvm::BinaryOperator>(mask);
+    if (bop != NULL && bop->getOpcode() == llvm::Instruction::And &&
+        depth < 8)
+        return (lGetPossiblyActiveLanes(bop->getOperand(0), depth + 1) &
+                lGetPossiblyActiveLanes(bop->getOperand(1), depth + 1));
+
+    return allLanes;
+}
+
+
+/** Checks whether the given offsets are a value that's the same in all
+    lanes plus a vector of constants.  If so, the constants are returned
+    in deltas[]; two lanes then access the same location exactly when
+    their deltas are equal.
+ */
+static bool
+lGetUniformPlusConstOffsets(llvm::Value *offsets, int64_t deltas[]) {
+    int nElts;
+    if (LLVMExtractVectorInts(offsets, deltas, &nElts))
+        return true;
+
+    llvm::BinaryOperator *bop = llvm::dyn_cast<llvm::BinaryOperator>(offsets);
+    if (bop == NULL || bop->getOpcode() != llvm::Instruction::Add)
+        return false;
+
+    for (int i = 0; i < 2; ++i) {
+        if (LLVMExtractVectorInts(bop->getOperand(i), deltas, &nElts) &&
+            LLVMVectorValuesAllEqual(bop->getOperand(i ^ 1)))
+            return true;
+    }
+    return false;
+}
+
+
+/** On targets with a native gather instruction, a gather where only a
+    few program instances are active (or where many of them read the
+    same location) may be faster as a handful of scalar loads.  This
+    function estimates the cost of both alternatives for the given
+    __pseudo_gather_base_offsets* call, using the target's gather cost
+    table (or the --opt=gather-cost override), and if the scalar loads
+    are cheaper, replaces the call with them.  Returns true if the call
+    was replaced.
+ */
+static bool
+lScalarizeGatherIfCheaper(llvm::CallInst *callInst) {
+    if (g->opt.disableGatherCostModel || !g->target->hasGather())
+        return false;
+
+    Target::ISA isa = g->target->getISA();
+    if (isa != Target::AVX2 && isa != Target::KNL_AVX512 &&
+        isa != Target::SKX_AVX512)
+        return false;
+
+    struct NativeGatherInfo {
+        NativeGatherInfo(const char *pName, llvm::Type *st)
+            : scalarType(st) {
+            pseudoFunc = m->module->getFunction(pName);
+        }
+        llvm::Function *pseudoFunc;
+        llvm::Type *scalarType;
+    };
+
+    NativeGatherInfo ngInfo[] = {
+        NativeGatherInfo("__pseudo_gather_base_offsets32_i32", LLVMTypes::Int32Type),
+        NativeGatherInfo("__pseudo_gather_base_offsets32_float", LLVMTypes::FloatType),
+        NativeGatherInfo("__pseudo_gather_base_offsets32_i64", LLVMTypes::Int64Type),
+        NativeGatherInfo("__pseudo_gather_base_offsets32_double", LLVMTypes::DoubleType),
+        NativeGatherInfo("__pseudo_gather_base_offsets64_i32", LLVMTypes::Int32Type),
+        NativeGatherInfo("__pseudo_gather_base_offsets64_float", LLVMTypes::FloatType),
+        NativeGatherInfo("__pseudo_gather_base_offsets64_i64", LLVMTypes::Int64Type),
+        NativeGatherInfo("__pseudo_gather_base_offsets64_double", LLVMTypes::DoubleType),
+    };
+
+    NativeGatherInfo *info = NULL;
+    for (unsigned int i = 0; i < sizeof(ngInfo) / sizeof(ngInfo[0]); ++i) {
+        if (ngInfo[i].pseudoFunc != NULL &&
+            callInst->getCalledFunction() == ngInfo[i].pseudoFunc) {
+            info = &ngInfo[i];
+            break;
+        }
+    }
+    if (info == NULL)
+        return false;
+
+    int elementBits = info->scalarType->getPrimitiveSizeInBits();
+    // The AVX-512 targets only have native gathers of 32-bit values; the
+    // 64-bit ones are already scalarized in the builtins.
+    if (isa != Target::AVX2 && elementBits != 32)
+        return false;
+
+    llvm::Value *base = callInst->getArgOperand(0);
+    llvm::Value *offsetScale = callInst->getArgOperand(1);
+    llvm::Value *offsets = callInst->getArgOperand(2);
+    llvm::Value *mask = callInst->getArgOperand(3);
+
+    llvm::ConstantInt *offsetScaleInt =
+        llvm::dyn_cast<llvm::ConstantInt>(offsetScale);
+    if (offsetScaleInt == NULL)
+        return false;
+
+    int width = g->target->getVectorWidth();
+    bool offsets64 = (offsets->getType() == LLVMTypes::Int64VectorType);
+
+    // How many native gather instructions the call will turn into: each
+    // one fills a native-width register, with lanes the size of the
+    // larger of the offsets and the values.
+    int laneBits = (offsets64 && elementBits < 64) ? 64 : elementBits;
+    int lanesPerGather = g->target->getNativeVectorWidth() * 32 / laneBits;
+    int nativeGathers = (width + lanesPerGather - 1) / lanesPerGather;
+
+    // Figure out which lanes have to be loaded.  If we know exactly which
+    // ones are active, lanes that read the same location can share a
+    // single load.
+    uint64_t knownActive;
+    if (lGetMask(mask, &knownActive) == false)
+        knownActive = 0;
+    uint64_t possiblyActive = lGetPossiblyActiveLanes(mask);
+    bool maskKnown = (knownActive == possiblyActive);
+
+    int64_t deltas[ISPC_MAX_NVEC];
+    bool haveDeltas = maskKnown && lGetUniformPlusConstOffsets(offsets, deltas);
+
+    // loadLane[i] gives the lane whose load provides lane i's value, or
+    // -1 if lane i's value doesn't matter.
+    int loadLane[ISPC_MAX_NVEC];
+    int nLoads = 0;
+    for (int i = 0; i < width; ++i) {
+        loadLane[i] = -1;
+        if ((possiblyActive & (1ull << i)) == 0)
+            continue;
+        if (haveDeltas) {
+            for (int j = 0; j < i; ++j) {
+                if (loadLane[j] == j && deltas[j] == deltas[i]) {
+                    loadLane[i] = j;
+                    break;
+                }
+            }
+        }
+        if (loadLane[i] == -1) {
+            loadLane[i] = i;
+            ++nLoads;
+        }
+    }
+
+    int gatherCost = (g->opt.gatherCost >= 0) ? g->opt.gatherCost :
+        g->target->getNativeGatherCost();
+    int laneCost = (g->opt.gatherLaneCost > 0) ? g->opt.gatherLaneCost :
+        g->target->getScalarGatherLaneCost();
+    // Lanes that may or may not be active need their mask bit checked
+    // first, which costs about as much again.
+    int nativeCost = nativeGathers * gatherCost;
+    int scalarCost = nLoads * laneCost * (maskKnown ? 1 : 2);
+
+    SourcePos pos;
+    lGetSourcePosFromMetadata(callInst, &pos);
+    Debug(pos, "Gather cost model: %d native gather(s), cost %d; "
+          "%d scalar load(s), cost %d.", nativeGathers, nativeCost,
+          nLoads, scalarCost);
+
+    if (scalarCost >= nativeCost)
+        return false;
+
+    // Generate the scalar loads.  Lanes that may be inactive load from
+    // the base pointer instead, following the same convention as the
+    // factored gathers that the first element is always safe to read.
+    llvm::Value *scaleValue = LLVMInt64(offsetScaleInt->getSExtValue());
+    llvm::Type *ptrType = llvm::PointerType::get(info->scalarType, 0);
+    llvm::Value *laneValues[ISPC_MAX_NVEC];
+    llvm::Value *result = llvm::UndefValue::get(callInst->getType());
+    for (int i = 0; i < width; ++i) {
+        if (loadLane[i] == -1)
+            continue;
+        if (loadLane[i] != i) {
+            laneValues[i] = laneValues[loadLane[i]];
+        }
+        else {
+            llvm::Value *offset =
+                llvm::ExtractElementInst::Create(offsets, LLVMInt32(i),
+                                                 "offset", callInst);
+            if (!offsets64)
+                offset = new llvm::SExtInst(offset, LLVMTypes::Int64Type,
+                                            "offset64", callInst);
+            if (!maskKnown) {
+                llvm::Value *maskLane =
+                    llvm::ExtractElementInst::Create(mask, LLVMInt32(i),
+                                                     "mask_lane", callInst);
+                if (maskLane->getType() != LLVMTypes::BoolType)
+                    maskLane =
+                        llvm::CmpInst::Create(llvm::Instruction::ICmp,
+                                              llvm::CmpInst::ICMP_NE, maskLane,
+                                              llvm::Constant::getNullValue(maskLane->getType()),
+                                              "lane_on", callInst);
+                offset = llvm::SelectInst::Create(maskLane, offset, LLVMInt64(0),
+                                                  "lane_offset", callInst);
+            }
+            offset = llvm::BinaryOperator::Create(llvm::Instruction::Mul, offset,
+                                                  scaleValue, "scaled_offset",
+                                                  callInst);
+            llvm::Value *ptr = lGEPInst(base, offset, "lane_ptr", callInst);
+            ptr = new llvm::BitCastInst(ptr, ptrType, "lane_ptr_cast", callInst);
+            laneValues[i] = new llvm::LoadInst(ptr, "lane_val", callInst);
+        }
+        result = llvm::InsertElementInst::Create(result, laneValues[i],
+                                                 LLVMInt32(i), "gather_scalar",
+                                                 callInst);
+    }
+
+    if (g->target->getVectorWidth() > 1)
+        PerformanceWarning(pos, "Gather required to load value; done with %d "
+                           "scalar load(s) since few lanes are needed.", nLoads);
+
+    lCopyMetadata(result, callInst);
+    callInst->replaceAllUsesWith(result);
+    callInst->eraseFromParent();
+    return true;
+}
+
+
 static bool
 lReplacePseudoGS(llvm::CallInst *callInst) {
     struct LowerGSInfo {
@@ -4641,6 +5921,9 @@ lReplacePseudoGS(llvm::CallInst *callInst) {
                     "__prefetch_read_varying_nt_native", false, true),
     };
 
+    if (lScalarizeGatherIfCheaper(callInst))
+        return true;
+
     llvm::Function *calledFunc = callInst->getCalledFunction();
 
     LowerGSInfo *info = NULL;
@@ -4855,6 +6138,342 @@ CreateDebugPass(char * output) {
     return new DebugPass(output);
 }
 
+///////////////////////////////////////////////////////////////////////////
+// PhaseTimer*Pass
+
+/** With --time-passes, DebugPassManager::add() puts each pass between a
+    pair of these passes, which start and stop the clock for its
+    CompilePhase.  The pass manager runs consecutive passes of the same
+    kind together (function passes one function at a time, and so forth),
+    so there's one of these for each kind of pass; using the same kind as
+    the pass being timed keeps the order in which passes run unchanged. */
+class PhaseTimer {
+protected:
+    PhaseTimer(CompilePhase *p, bool s) : phase(p), start(s) { }
+
+    void run() const {
+        if (start)
+            phase->Start();
+        else
+            phase->Stop();
+    }
+
+private:
+    CompilePhase *phase;
+    bool start;
+};
+
+
+class PhaseTimerModulePass : public llvm::ModulePass, PhaseTimer {
+public:
+    static char ID;
+    PhaseTimerModulePass(CompilePhase *p, bool s)
+        : ModulePass(ID), PhaseTimer(p, s) { }
+
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_9
+    const char *getPassName() const { return "Phase Timer"; }
+#else // LLVM 4.0+
+    llvm::StringRef getPassName() const { return "Phase Timer"; }
+#endif
+    void getAnalysisUsage(llvm::AnalysisUsage &AU) const {
+        AU.setPreservesAll();
+    }
+    bool runOnModule(llvm::Module &) { run(); return false; }
+};
+
+char PhaseTimerModulePass::ID = 0;
+
+
+class PhaseTimerSCCPass : public llvm::CallGraphSCCPass, PhaseTimer {
+public:
+    static char ID;
+    PhaseTimerSCCPass(CompilePhase *p, bool s)
+        : CallGraphSCCPass(ID), PhaseTimer(p, s) { }
+
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_9
+    const char *getPassName() const { return "Phase Timer"; }
+#else // LLVM 4.0+
+    llvm::StringRef getPassName() const { return "Phase Timer"; }
+#endif
+    void getAnalysisUsage(llvm::AnalysisUsage &AU) const {
+        // CallGraphSCCPass requires this of its subclasses.
+        llvm::CallGraphSCCPass::getAnalysisUsage(AU);
+        AU.setPreservesAll();
+    }
+    bool runOnSCC(llvm::CallGraphSCC &) { run(); return false; }
+};
+
+char PhaseTimerSCCPass::ID = 0;
+
+
+class PhaseTimerFunctionPass : public llvm::FunctionPass, PhaseTimer {
+public:
+    static char ID;
+    PhaseTimerFunctionPass(CompilePhase *p, bool s)
+        : FunctionPass(ID), PhaseTimer(p, s) { }
+
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_9
+    const char *getPassName() const { return "Phase Timer"; }
+#else // LLVM 4.0+
+    llvm::StringRef getPassName() const { return "Phase Timer"; }
+#endif
+    void getAnalysisUsage(llvm::AnalysisUsage &AU) const {
+        AU.setPreservesAll();
+    }
+    bool runOnFunction(llvm::Function &) { run(); return false; }
+};
+
+char PhaseTimerFunctionPass::ID = 0;
+
+
+class PhaseTimerLoopPass : public llvm::LoopPass, PhaseTimer {
+public:
+    static char ID;
+    PhaseTimerLoopPass(CompilePhase *p, bool s)
+        : LoopPass(ID), PhaseTimer(p, s) { }
+
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_9
+    const char *getPassName() const { return "Phase Timer"; }
+#else // LLVM 4.0+
+    llvm::StringRef getPassName() const { return "Phase Timer"; }
+#endif
+    void getAnalysisUsage(llvm::AnalysisUsage &AU) const {
+        AU.setPreservesAll();
+    }
+    bool runOnLoop(llvm::Loop *, llvm::LPPassManager &) { run(); return false; }
+};
+
+char PhaseTimerLoopPass::ID = 0;
+
+
+class PhaseTimerBasicBlockPass : public llvm::BasicBlockPass, PhaseTimer {
+public:
+    static char ID;
+    PhaseTimerBasicBlockPass(CompilePhase *p, bool s)
+        : BasicBlockPass(ID), PhaseTimer(p, s) { }
+
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_9
+    const char *getPassName() const { return "Phase Timer"; }
+#else // LLVM 4.0+
+    llvm::StringRef getPassName() const { return "Phase Timer"; }
+#endif
+    void getAnalysisUsage(llvm::AnalysisUsage &AU) const {
+        AU.setPreservesAll();
+    }
+    bool runOnBasicBlock(llvm::BasicBlock &) { run(); return false; }
+};
+
+char PhaseTimerBasicBlockPass::ID = 0;
+
+
+/** Returns a pass of the same kind as the given one that starts or stops
+    the clock for the given phase, or NULL for passes that aren't run
+    (analyses that hold information for other passes) or are of a kind that
+    isn't handled, which are then only included in the time of the
+    enclosing phase. */
+static llvm::Pass *
+CreatePhaseTimerPass(llvm::Pass *pass, CompilePhase *phase, bool start) {
+    if (pass->getAsImmutablePass() != NULL)
+        return NULL;
+
+    switch (pass->getPassKind()) {
+    case llvm::PT_Module:
+        return new PhaseTimerModulePass(phase, start);
+    case llvm::PT_CallGraphSCC:
+        return new PhaseTimerSCCPass(phase, start);
+    case llvm::PT_Function:
+        return new PhaseTimerFunctionPass(phase, start);
+    case llvm::PT_Loop:
+        return new PhaseTimerLoopPass(phase, start);
+    case llvm::PT_BasicBlock:
+        return new PhaseTimerBasicBlockPass(phase, start);
+    default:
+        return NULL;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// UniformArgsSpecializationPass
+
+/** Parameters of ispc functions that aren't declared 'uniform' are
+    varying, even if the function is only ever called with values that
+    are the same for all of the program instances.  For internal
+    functions that weren't inlined, this pass looks at each call site to
+    see which vector arguments have the same value in all lanes, and
+    redirects the call to a copy of the function where those parameters
+    are replaced by a broadcast of their first element.  The optimizations
+    that follow (ImproveMemoryOpsPass in particular) can then turn
+    gathers and scatters that are indexed by them into uniform loads and
+    stores, as they would for code written with 'uniform' by hand.
+ */
+class UniformArgsSpecializationPass : public llvm::ModulePass {
+public:
+    static char ID;
+    UniformArgsSpecializationPass() : ModulePass(ID) {
+    }
+
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_9
+    const char *getPassName() const { return "Uniform Argument Specialization"; }
+#else // LLVM 4.0+
+    llvm::StringRef getPassName() const { return "Uniform Argument Specialization"; }
+#endif
+    bool runOnModule(llvm::Module &m);
+};
+
+char UniformArgsSpecializationPass::ID = 0;
+
+
+/** Returns a copy of the given function where the parameters given by
+    the bits of uniformArgs are known to have the same value in all
+    lanes. */
+static llvm::Function *
+lCloneWithUniformArgs(llvm::Function *func, uint64_t uniformArgs) {
+    llvm::ValueToValueMapTy vmap;
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_8
+    llvm::Function *clone = llvm::CloneFunction(func, vmap, false);
+    func->getParent()->getFunctionList().push_back(clone);
+#else // LLVM 3.9+
+    llvm::Function *clone = llvm::CloneFunction(func, vmap);
+#endif
+    char suffix[32];
+    sprintf(suffix, "___uniform_%" PRIx64, uniformArgs);
+    clone->setName(func->getName().str() + suffix);
+    clone->setLinkage(llvm::GlobalValue::InternalLinkage);
+
+    llvm::Instruction *insertBefore =
+        &*clone->getEntryBlock().getFirstInsertionPt();
+    int argNum = 0;
+    for (llvm::Function::arg_iterator argIter = clone->arg_begin();
+         argIter != clone->arg_end(); ++argIter, ++argNum) {
+        if ((uniformArgs & (1ull << argNum)) == 0)
+            continue;
+
+        // Replace all uses of the parameter with a broadcast of its first
+        // element; RAUW also replaces the use in the extractelement, so
+        // that's restored afterward.
+        llvm::Value *arg = &*argIter;
+        llvm::Instruction *first =
+            llvm::ExtractElementInst::Create(arg, LLVMInt32(0),
+                                             LLVMGetName(arg, "_first"),
+                                             insertBefore);
+        llvm::Value *undefValue = llvm::UndefValue::get(arg->getType());
+        llvm::Value *insertVec =
+            llvm::InsertElementInst::Create(undefValue, first, LLVMInt32(0),
+                                            LLVMGetName(arg, "_first"),
+                                            insertBefore);
+        llvm::Value *zeroMask = llvm::ConstantVector::getSplat(
+            arg->getType()->getVectorNumElements(),
+            llvm::Constant::getNullValue(llvm::Type::getInt32Ty(*g->ctx)));
+        llvm::Value *smear =
+            new llvm::ShuffleVectorInst(insertVec, undefValue, zeroMask,
+                                        LLVMGetName(arg, "_smear"), insertBefore);
+        arg->replaceAllUsesWith(smear);
+        first->setOperand(0, arg);
+    }
+    return clone;
+}
+
+
+/** Finds the call sites of the given function that pass some vector
+    arguments with all lanes equal and directs them to specialized copies
+    of it.  Returns true if any call was changed. */
+static bool
+lSpecializeUniformArgs(llvm::Function *func) {
+    // We don't want to make too many copies of any one function.
+    const int maxClones = 4;
+
+    int nArgs = (int)func->arg_size();
+    if (nArgs == 0 || nArgs > 64)
+        return false;
+
+    uint64_t vectorArgs = 0;
+    int argNum = 0;
+    for (llvm::Function::arg_iterator argIter = func->arg_begin();
+         argIter != func->arg_end(); ++argIter, ++argNum)
+        if (llvm::isa<llvm::VectorType>(argIter->getType()))
+            vectorArgs |= (1ull << argNum);
+    if (vectorArgs == 0)
+        return false;
+
+    // Find the calls to the function and which of their vector arguments
+    // are the same in all lanes.  If the function is used other than by
+    // being called (e.g. its address is taken), leave it alone.
+    std::vector<std::pair<llvm::CallInst *, uint64_t> > calls;
+    for (llvm::Value::use_iterator ui = func->use_begin(); ui != func->use_end();
+         ++ui) {
+#if ISPC_LLVM_VERSION <= ISPC_LLVM_3_4
+        llvm::User *user = *ui;
+        unsigned int operandNo = ui.getOperandNo();
+#else // LLVM 3.5+
+        llvm::User *user = ui->getUser();
+        unsigned int operandNo = ui->getOperandNo();
+#endif
+        llvm::CallInst *callInst = llvm::dyn_cast<llvm::CallInst>(user);
+        if (callInst == NULL || operandNo != callInst->getNumArgOperands())
+            return false;
+
+        uint64_t uniformArgs = 0;
+        for (int i = 0; i < nArgs; ++i)
+            if ((vectorArgs & (1ull << i)) &&
+                LLVMVectorValuesAllEqual(callInst->getArgOperand(i)))
+                uniformArgs |= (1ull << i);
+        if (uniformArgs != 0)
+            calls.push_back(std::make_pair(callInst, uniformArgs));
+    }
+
+    std::map<uint64_t, llvm::Function *> clones;
+    bool modifiedAny = false;
+    for (unsigned int i = 0; i < calls.size(); ++i) {
+        uint64_t uniformArgs = calls[i].second;
+        llvm::Function *clone = NULL;
+        if (clones.find(uniformArgs) != clones.end())
+            clone = clones[uniformArgs];
+        else if ((int)clones.size() < maxClones) {
+            clone = lCloneWithUniformArgs(func, uniformArgs);
+            clones[uniformArgs] = clone;
+            Debug(SourcePos(), "Specialized function \"%s\" for uniform "
+                  "arguments (0x%" PRIx64 ").", func->getName().str().c_str(),
+                  uniformArgs);
+        }
+        if (clone == NULL)
+            continue;
+
+        calls[i].first->setCalledFunction(clone);
+        modifiedAny = true;
+    }
+    return modifiedAny;
+}
+
+
+bool
+UniformArgsSpecializationPass::runOnModule(llvm::Module &module) {
+    // Collect the candidates first, since we'll be adding functions to
+    // the module as we go.
+    std::vector<llvm::Function *> funcs;
+    for (llvm::Module::iterator iter = module.begin(); iter != module.end();
+         ++iter) {
+        llvm::Function *func = &*iter;
+        if (func->isDeclaration() || !func->hasLocalLinkage() ||
+            func->isVarArg())
+            continue;
+        funcs.push_back(func);
+    }
+
+    bool modifiedAny = false;
+    for (unsigned int i = 0; i < funcs.size(); ++i)
+        if (lSpecializeUniformArgs(funcs[i]))
+            modifiedAny = true;
+
+    return modifiedAny;
+}
+
+
+static llvm::Pass *
+CreateUniformArgsSpecializationPass() {
+    return new UniformArgsSpecializationPass;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////
 // MakeInternalFuncsStaticPass
 
@@ -4960,6 +6579,9 @@ MakeInternalFuncsStaticPass::runOnModule(llvm::Module &module) {
         "__scatter64_float", "__scatter64_double",
         "__prefetch_read_varying_1", "__prefetch_read_varying_2",
         "__prefetch_read_varying_3", "__prefetch_read_varying_nt",
+        "__streaming_store_varying_i8", "__streaming_store_varying_i16",
+        "__streaming_store_varying_i32", "__streaming_store_varying_i64",
+        "__streaming_store_varying_float", "__streaming_store_varying_double",
         "__keep_funcs_live",
     };
 
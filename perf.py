@@ -61,7 +61,7 @@ def execute_test(commands):
     return r
 
 #gathers all tests results and made an item test from answer structure
-def run_test(commands, c1, c2, test, test_ref, b_serial):
+def run_test(commands, c1, c2, test, test_ref, b_serial, b_tasks_only):
     if build_test(commands) != 0:
         error("Compilation fails of test %s\n" % test[0], 0)
         return
@@ -69,13 +69,15 @@ def run_test(commands, c1, c2, test, test_ref, b_serial):
         error("Execution fails of test %s\n" % test[0], 0)
         return
     print_debug("TEST COMPILER:\n", s, perf_log)
-    analyse_test(c1, c2, test, b_serial, perf_temp+"_test")
+    analyse_test(c1, c2, test, b_serial, b_tasks_only, perf_temp+"_test")
     if options.ref:
         print_debug("REFERENCE COMPILER:\n", s, perf_log)
-        analyse_test(c1, c2, test_ref, b_serial, perf_temp+"_ref")
+        analyse_test(c1, c2, test_ref, b_serial, b_tasks_only, perf_temp+"_ref")
 
 
-def analyse_test(c1, c2, test, b_serial, perf_temp_n):
+#b_tasks_only: the test only measures ISPC + tasks times (e.g. task system
+#benchmarks), so all of its "million cycles" results are taken as those
+def analyse_test(c1, c2, test, b_serial, b_tasks_only, perf_temp_n):
     tasks = [] #list of results with tasks, it will be test[2]
     ispc = [] #list of results without tasks, it will be test[1]
     absolute_tasks = []  #list of absolute results with tasks, it will be test[4]
@@ -105,7 +107,7 @@ def analyse_test(c1, c2, test, b_serial, perf_temp_n):
                     line = line.replace("]","[")
                     line = line.split("[")
                     number = float(line[3])
-                    if "tasks" in line[1]:
+                    if b_tasks_only or "tasks" in line[1]:
                         absolute_tasks.append(number)
                     else:
                         if "ispc" in line[1]:
@@ -128,6 +130,10 @@ def analyse_test(c1, c2, test, b_serial, perf_temp_n):
             print_debug("ISPC + tasks speedup / ISPC + tasks time / serial time\n", s, perf_log)
             for i in range(0,len(serial)):
                 print_debug("%10s\t     /    %10s\t /%10s\n" % (tasks[i], absolute_tasks[i], serial[i]), s, perf_log)
+        elif b_tasks_only:
+            print_debug("ISPC + tasks time\n", s, perf_log)
+            for i in range(0,len(absolute_tasks)):
+                print_debug("%10s\n" % absolute_tasks[i], s, perf_log)
 
     test[1] = test[1] + ispc
     test[2] = test[2] + tasks
@@ -510,12 +516,15 @@ def perf(options1, args):
                 c1 = 1
                 c2 = 1
             next_line = lines[i+3]
+            b_tasks_only = next_line[0] == "$" # all results are ISPC + tasks times
+            if b_tasks_only:
+                temp = 1
             if next_line[0] == "^":
                 temp = 1
             if next_line[0] == "^" and target_number == 1:  #we should concatenate result of this test with previous one
-                run_test(commands, c1, c2, answer[len(answer)-1], answer_ref[len(answer)-1], False)
+                run_test(commands, c1, c2, answer[len(answer)-1], answer_ref[len(answer)-1], False, b_tasks_only)
             else: #we run this test and append it's result to answer structure
-                run_test(commands, c1, c2, test, test_ref, True)
+                run_test(commands, c1, c2, test, test_ref, True, b_tasks_only)
                 answer.append(test)
                 answer_ref.append(test_ref)
         i = i + temp
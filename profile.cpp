@@ -0,0 +1,131 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file profile.cpp
+    @brief Implementation of the Profile class, used with --profile-use.
+*/
+
+#include "profile.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Instrumentation points that were reached fewer times than this don't
+    say enough about how the program runs to base decisions on. */
+static const int64_t PROFILE_MIN_COUNT = 16;
+
+
+static std::string
+lSiteKey(const char *file, int line, const char *note) {
+    char buf[32];
+    sprintf(buf, "\t%d\t", line);
+    return std::string(file) + buf + note;
+}
+
+
+Profile *
+Profile::Read(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        Error(SourcePos(), "Unable to open profile file \"%s\".", filename);
+        return NULL;
+    }
+
+    Profile *profile = new Profile;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        profile->text.append(buf, n);
+    fclose(f);
+
+    const std::string &text = profile->text;
+    int lineNumber = 0;
+    for (size_t start = 0; start < text.size(); ) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+        ++lineNumber;
+
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        // The four numbers, then the file name and the note, which may
+        // have spaces in them.
+        long long count, lanes, allOff;
+        int sourceLine, length;
+        if (sscanf(line.c_str(), "%lld\t%lld\t%lld\t%d\t%n", &count, &lanes,
+                   &allOff, &sourceLine, &length) != 4) {
+            Error(SourcePos(), "Malformed line %d in profile file \"%s\".",
+                  lineNumber, filename);
+            delete profile;
+            return NULL;
+        }
+        std::string rest = line.substr(length);
+        size_t tab = rest.find('\t');
+        if (tab == std::string::npos) {
+            Error(SourcePos(), "Malformed line %d in profile file \"%s\".",
+                  lineNumber, filename);
+            delete profile;
+            return NULL;
+        }
+
+        Site &site = profile->sites[lSiteKey(rest.substr(0, tab).c_str(),
+                                             sourceLine,
+                                             rest.substr(tab + 1).c_str())];
+        site.count += count;
+        site.lanes += lanes;
+        site.allOff += allOff;
+    }
+
+    return profile;
+}
+
+
+const Profile::Site *
+Profile::Lookup(SourcePos pos, const char *note) const {
+    std::map<std::string, Site>::const_iterator iter =
+        sites.find(lSiteKey(pos.name, pos.first_line, note));
+    if (iter == sites.end() || iter->second.count < PROFILE_MIN_COUNT)
+        return NULL;
+    return &iter->second;
+}
+
+
+double
+Profile::ActiveFraction(const Site *site) {
+    return (double)site->lanes /
+        ((double)site->count * g->target->getVectorWidth());
+}
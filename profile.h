@@ -0,0 +1,98 @@
+/*
+  Copyright (c) 2016, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file profile.h
+    @brief Declaration of the Profile class, which holds the execution
+           profile of a program that was read with --profile-use.
+*/
+
+#ifndef ISPC_PROFILE_H
+#define ISPC_PROFILE_H 1
+
+#include "ispc.h"
+#include <map>
+
+/** @brief Execution profile of an ispc program, for profile-guided
+    optimization.
+
+    The profile is gathered by running a program compiled with
+    --instrument with an implementation of ISPCInstrument() that writes a
+    profile file, such as the one in examples/util/ispc_profile.cpp.  Each
+    line of the file has the statistics for one instrumentation point:
+
+    <count> <lanes> <all off> <line> <file> <note>
+
+    separated by tabs, where count is the number of times the point was
+    reached, lanes is the total of the number of active program instances
+    over all of them and all off is the number of times that none were
+    active.  Lines starting with '#' are ignored.  Statistics for the same
+    point that appear more than once (e.g. from several runs appended to
+    the same file) are added together.
+ */
+class Profile {
+public:
+    /** Statistics for one instrumentation point. */
+    struct Site {
+        Site() { count = lanes = allOff = 0; }
+        int64_t count;
+        int64_t lanes;
+        int64_t allOff;
+    };
+
+    /** Reads the profile in the given file.  Returns NULL, after issuing
+        an error, if it can't be read. */
+    static Profile *Read(const char *filename);
+
+    /** Returns the statistics for the instrumentation point with the
+        given note at the given source position, or NULL if there are
+        none or the point was reached too few times for them to be
+        meaningful. */
+    const Site *Lookup(SourcePos pos, const char *note) const;
+
+    /** Returns the fraction of the program instances that were active on
+        average at the given instrumentation point, for the current
+        target's gang size. */
+    static double ActiveFraction(const Site *site);
+
+    /** Contents of the profile file, which are part of the key for the
+        compilation cache. */
+    const std::string &GetText() const { return text; }
+
+private:
+    Profile() { }
+
+    std::map<std::string, Site> sites;
+    std::string text;
+};
+
+#endif // ISPC_PROFILE_H
@@ -152,6 +152,16 @@ def check_test(filename):
     return done
 
 
+def test_ispc_flags(filename):
+    # extra ispc flags that a test needs to be compiled with, given with
+    # e.g. "// rule: ispc flags=--opt=streaming-stores"
+    flags = ""
+    b = buffer(file(filename).read());
+    for rule in re.finditer('// *rule: ispc flags=(.*)', b):
+        flags += " " + rule.group(1).strip()
+    return flags
+
+
 def run_test(testname):
     # testname is a path to the test from the root of ispc dir
     # filename is a path to the test from the current dir
@@ -320,6 +330,7 @@ def run_test(testname):
                          (filename4ptx, obj_name, options.target)
 
         # compile the ispc code, make the executable, and run it...
+        ispc_cmd += test_ispc_flags(filename)
         ispc_cmd += " -h " + filename + ".h"
         cc_cmd += " -DTEST_HEADER=<" + filename + ".h>"
         (compile_error, run_error) = run_cmds([ispc_cmd, cc_cmd], 
@@ -44,6 +44,7 @@
 #include "sym.h"
 #include "module.h"
 #include "llvmutil.h"
+#include "profile.h"
 
 #include <stdio.h>
 #include <map>
@@ -543,6 +544,62 @@ lEmitIfStatements(FunctionEmitContext *ctx, Stmt *stmts, const char *trueOrFalse
 }
 
 
+/** With --profile-use, code that checks whether the mask is all on is
+    emitted at varying control flow where at least this fraction of the
+    program instances were active on average... */
+static const double PROFILE_COHERENT_FRACTION = 0.95;
+
+/** ...and it is left out where fewer than this fraction were, even for
+    "cif" and the like. */
+static const double PROFILE_INCOHERENT_FRACTION = 0.75;
+
+
+/** Given whether the code for the varying control flow statement that
+    reaches the given instrumentation point at the current source position
+    would otherwise check for the mask being all on, returns whether it
+    should, based on the profile given with --profile-use, if any. */
+static bool
+lProfileCoherentCheck(FunctionEmitContext *ctx, const char *note,
+                      bool coherentCheck) {
+    if (g->profile == NULL || g->opt.disableCoherentControlFlow)
+        return coherentCheck;
+
+    SourcePos pos = ctx->GetDebugPos();
+    const Profile::Site *site = g->profile->Lookup(pos, note);
+    if (site == NULL)
+        return coherentCheck;
+
+    double active = Profile::ActiveFraction(site);
+    bool check = coherentCheck;
+    if (active >= PROFILE_COHERENT_FRACTION)
+        check = true;
+    else if (active < PROFILE_INCOHERENT_FRACTION)
+        check = false;
+
+    if (check != coherentCheck)
+        Debug(pos, "Profile: %.2f of program instances active at \"%s\"; "
+              "%s check for mask all on.", active, note,
+              check ? "adding" : "removing");
+    return check;
+}
+
+
+/** Sets the weights of the conditional branch at the end of the current
+    basic block, which is taken if any program instances are active at
+    the given instrumentation point, from the profile given with
+    --profile-use, if any. */
+static void
+lProfileBranchWeights(FunctionEmitContext *ctx, SourcePos pos,
+                      const char *note) {
+    if (g->profile == NULL)
+        return;
+
+    const Profile::Site *site = g->profile->Lookup(pos, note);
+    if (site != NULL)
+        ctx->SetBranchWeights(site->count - site->allOff, site->allOff);
+}
+
+
 /** Returns true if the "true" block for the if statement consists of a
     single 'break' statement, and the "false" block is empty. */
 /*
@@ -722,7 +779,24 @@ IfStmt::emitMaskedTrueAndFalse(FunctionEmitContext *ctx, llvm::Value *oldMask,
 void
 IfStmt::emitVaryingIf(FunctionEmitContext *ctx, llvm::Value *ltest) const {
     llvm::Value *oldMask = ctx->GetInternalMask();
-    if (doAllCheck) {
+
+    // Record how many program instances reach the 'if' and how many of
+    // them take each side, for --profile-use.
+    ctx->SetDebugPos(pos);
+    if (g->emitInstrumentation) {
+        llvm::Value *fullMask = ctx->GetFullMask();
+        llvm::Value *notTest = ctx->NotOperator(ltest, "~test");
+        ctx->AddInstrumentationPoint("if: varying");
+        ctx->AddInstrumentationPoint("if: test true",
+            ctx->BinaryOperator(llvm::Instruction::And, fullMask, ltest,
+                                "mask&test"));
+        ctx->AddInstrumentationPoint("if: test false",
+            ctx->BinaryOperator(llvm::Instruction::And, fullMask, notTest,
+                                "mask&~test"));
+    }
+
+    bool allCheck = lProfileCoherentCheck(ctx, "if: varying", doAllCheck);
+    if (allCheck) {
         // We can't tell if the mask going into the if is all on at the
         // compile time.  Emit code to check for this and then either run
         // the code for the 'all on' or the 'mixed' case depending on the
@@ -891,6 +965,7 @@ IfStmt::emitMaskMixed(FunctionEmitContext *ctx, llvm::Value *oldMask,
 #endif /* ISPC_NVPTX_ENABLED */
 
     ctx->BranchInst(bRunTrue, bNext, maskAnyTrueQ);
+    lProfileBranchWeights(ctx, pos, "if: test true");
 
     // Emit statements for true
     ctx->SetCurrentBasicBlock(bRunTrue);
@@ -917,6 +992,7 @@ IfStmt::emitMaskMixed(FunctionEmitContext *ctx, llvm::Value *oldMask,
     llvm::Value *maskAnyFalseQ = ctx->Any(ctx->GetFullMask());
 #endif /* ISPC_NVPTX_ENABLED */
     ctx->BranchInst(bRunFalse, bDone, maskAnyFalseQ);
+    lProfileBranchWeights(ctx, pos, "if: test false");
 
     // Emit code for false
     ctx->SetCurrentBasicBlock(bRunFalse);
@@ -1016,6 +1092,130 @@ lHasVaryingBreakOrContinue(Stmt *stmt) {
 }
 
 
+struct LoopVersioningCheckInfo {
+    LoopVersioningCheckInfo() {
+        foundVaryingExpr = false;
+        foundLabel = false;
+        foundStaticDecl = false;
+    }
+
+    bool foundVaryingExpr;
+    bool foundLabel;
+    bool foundStaticDecl;
+};
+
+
+/** Preorder callback function for lVersionLoopOnMask(); records whether
+    the loop body has any varying computation (for which the mask
+    matters) and whether it has any labels or static variable
+    declarations (which we can't emit twice). */
+static bool
+lLoopVersioningPreFunc(ASTNode *node, void *d) {
+    LoopVersioningCheckInfo *info = (LoopVersioningCheckInfo *)d;
+
+    if (llvm::dyn_cast<LabeledStmt>(node) != NULL) {
+        info->foundLabel = true;
+        return false;
+    }
+
+    DeclStmt *ds = llvm::dyn_cast<DeclStmt>(node);
+    if (ds != NULL) {
+        for (unsigned int i = 0; i < ds->vars.size(); ++i)
+            if (ds->vars[i].sym != NULL &&
+                ds->vars[i].sym->storageClass == SC_STATIC)
+                info->foundStaticDecl = true;
+    }
+
+    Expr *expr = llvm::dyn_cast<Expr>(node);
+    if (expr != NULL && info->foundVaryingExpr == false) {
+        const Type *type = expr->GetType();
+        if (type != NULL && type->IsVaryingType())
+            info->foundVaryingExpr = true;
+    }
+    return true;
+}
+
+
+/** Decides whether a loop with the given body should be emitted twice,
+    once for when the mask is all on when the loop starts and once for
+    when it isn't, with a single check of the mask before the loop.  A
+    uniform loop doesn't change the mask from one iteration to the next,
+    so in the first version the mask is known to be all on throughout the
+    loop, and the masked loads, stores and mask tests in its body can be
+    optimized accordingly; otherwise the mask is checked every time
+    around the loop. */
+static bool
+lVersionLoopOnMask(FunctionEmitContext *ctx, bool uniformTest, Stmt *stmts,
+                   SourcePos pos) {
+    if (!uniformTest || stmts == NULL)
+        return false;
+    if (g->opt.disableLoopVersioning ||
+        g->opt.disableMaskAllOnOptimizations ||
+        g->opt.disableCoherentControlFlow)
+        return false;
+    // As with the mask check at function entry, there's nothing to gain
+    // when masked operations cost the same as unmasked ones.
+    if (g->target->getMaskingIsFree())
+        return false;
+    // Nor is there if the mask is already known to be all on here.
+    if (ctx->IsFullMaskKnownAllOn())
+        return false;
+    // Loops in either version of an enclosing versioned loop gain nothing
+    // from being versioned again: the mask there is either known to be
+    // all on or has already been found not to be.
+    if (ctx->InVersionedLoop())
+        return false;
+
+    LoopVersioningCheckInfo info;
+    WalkAST(stmts, lLoopVersioningPreFunc, NULL, &info);
+    if (info.foundLabel || info.foundStaticDecl || !info.foundVaryingExpr)
+        return false;
+
+    int bodyCost = ::EstimateCost(stmts);
+    if (bodyCost > LOOP_VERSIONING_MAX_BODY_COST)
+        return false;
+
+    Debug(pos, "Versioning uniform loop on \"all on\" mask (body cost %d).",
+          bodyCost);
+    return true;
+}
+
+
+/** Emits the given loop twice, as described for lVersionLoopOnMask()
+    above, branching to one or the other version depending on whether the
+    mask is all on. */
+static void
+lEmitMaskVersionedLoop(FunctionEmitContext *ctx, const Stmt *loop) {
+    llvm::BasicBlock *bAllOn = ctx->CreateBasicBlock("loop_mask_all");
+    llvm::BasicBlock *bMixed = ctx->CreateBasicBlock("loop_mask_mixed");
+    llvm::BasicBlock *bDone = ctx->CreateBasicBlock("loop_mask_done");
+
+    llvm::Value *maskAllQ = ctx->All(ctx->GetFullMask());
+    ctx->BranchInst(bAllOn, bMixed, maskAllQ);
+
+    ctx->StartVersionedLoop();
+
+    // As with 'cif', explicitly set the mask to "all on" so that the code
+    // emitted for the loop can take advantage of it.
+    ctx->SetCurrentBasicBlock(bAllOn);
+    ctx->SetInternalMask(LLVMMaskAllOn);
+    llvm::Value *oldFunctionMask = ctx->GetFunctionMask();
+    ctx->SetFunctionMask(LLVMMaskAllOn);
+    loop->EmitCode(ctx);
+    ctx->SetFunctionMask(oldFunctionMask);
+    if (ctx->GetCurrentBasicBlock())
+        ctx->BranchInst(bDone);
+
+    ctx->SetCurrentBasicBlock(bMixed);
+    loop->EmitCode(ctx);
+    if (ctx->GetCurrentBasicBlock())
+        ctx->BranchInst(bDone);
+
+    ctx->EndVersionedLoop();
+    ctx->SetCurrentBasicBlock(bDone);
+}
+
+
 DoStmt::DoStmt(Expr *t, Stmt *s, bool cc, SourcePos p)
     : Stmt(p, DoStmtID), testExpr(t), bodyStmts(s),
       doCoherentCheck(cc && !g->opt.disableCoherentControlFlow) {
@@ -1035,6 +1235,12 @@ void DoStmt::EmitCode(FunctionEmitContext *ctx) const {
         Warning(testExpr->pos, "Uniform condition supplied to \"cdo\" "
                 "statement.");
 
+    if (!doCoherentCheck &&
+        lVersionLoopOnMask(ctx, uniformTest, bodyStmts, pos)) {
+        lEmitMaskVersionedLoop(ctx, this);
+        return;
+    }
+
     llvm::BasicBlock *bloop = ctx->CreateBasicBlock("do_loop");
     llvm::BasicBlock *bexit = ctx->CreateBasicBlock("do_exit");
     llvm::BasicBlock *btest = ctx->CreateBasicBlock("do_test");
@@ -1056,7 +1262,8 @@ void DoStmt::EmitCode(FunctionEmitContext *ctx) const {
         ctx->StartScope();
 
     ctx->AddInstrumentationPoint("do loop body");
-    if (doCoherentCheck && !uniformTest) {
+    if (!uniformTest &&
+        lProfileCoherentCheck(ctx, "do loop body", doCoherentCheck)) {
         // Check to see if the mask is all on
         llvm::BasicBlock *bAllOn = ctx->CreateBasicBlock("do_all_on");
         llvm::BasicBlock *bMixed = ctx->CreateBasicBlock("do_mixed");
@@ -1203,15 +1410,21 @@ ForStmt::EmitCode(FunctionEmitContext *ctx) const {
     if (!ctx->GetCurrentBasicBlock())
         return;
 
+    bool uniformTest = test ? test->GetType()->IsUniformType() :
+        (!g->opt.disableUniformControlFlow &&
+         !lHasVaryingBreakOrContinue(stmts));
+
+    if (!doCoherentCheck &&
+        lVersionLoopOnMask(ctx, uniformTest, stmts, pos)) {
+        lEmitMaskVersionedLoop(ctx, this);
+        return;
+    }
+
     llvm::BasicBlock *btest = ctx->CreateBasicBlock("for_test");
     llvm::BasicBlock *bstep = ctx->CreateBasicBlock("for_step");
     llvm::BasicBlock *bloop = ctx->CreateBasicBlock("for_loop");
     llvm::BasicBlock *bexit = ctx->CreateBasicBlock("for_exit");
 
-    bool uniformTest = test ? test->GetType()->IsUniformType() :
-        (!g->opt.disableUniformControlFlow &&
-         !lHasVaryingBreakOrContinue(stmts));
-
     ctx->StartLoop(bexit, bstep, uniformTest);
     ctx->SetDebugPos(pos);
 
@@ -1261,10 +1474,12 @@ ForStmt::EmitCode(FunctionEmitContext *ctx) const {
     ctx->SetCurrentBasicBlock(bloop);
     ctx->SetBlockEntryMask(ctx->GetFullMask());
     ctx->AddInstrumentationPoint("for loop body");
+    bool coherentCheck = !uniformTest &&
+        lProfileCoherentCheck(ctx, "for loop body", doCoherentCheck);
     if (!llvm::dyn_cast_or_null<StmtList>(stmts))
         ctx->StartScope();
 
-    if (doCoherentCheck && !uniformTest) {
+    if (coherentCheck) {
         // For 'varying' loops with the coherence check, we start by
         // checking to see if the mask is all on, after it has been updated
         // based on the value of the test.
@@ -1656,6 +1871,35 @@ lGetSpans(int dimsLeft, int nDims, int itemsLeft, bool isTiled, int *a) {
 }
 
 
+/* Decide whether a foreach loop should emit its body only once, running
+   every iteration with a mask, rather than also peeling off a copy of the
+   body for full vectors with the mask all on (see Opt::foreachRemainder).
+   The peeled copy doesn't pay for itself when the innermost dimension is
+   known to be short, so that at most one full vector is run before the
+   remainder.
+ */
+static bool
+lForeachUseMaskedOnly(llvm::Value *innerStart, llvm::Value *innerEnd,
+                      int innerSpan, SourcePos pos) {
+    if (g->opt.foreachRemainder == Opt::Foreach_Peel)
+        return false;
+    if (g->opt.foreachRemainder == Opt::Foreach_Masked)
+        return true;
+
+    llvm::ConstantInt *startInt = llvm::dyn_cast<llvm::ConstantInt>(innerStart);
+    llvm::ConstantInt *endInt = llvm::dyn_cast<llvm::ConstantInt>(innerEnd);
+    if (startInt != NULL && endInt != NULL) {
+        int64_t nItems = endInt->getSExtValue() - startInt->getSExtValue();
+        if (nItems < 2 * innerSpan) {
+            Debug(pos, "Foreach: short inner dimension (%d items); "
+                  "using masked iterations only.", (int)nItems);
+            return true;
+        }
+    }
+    return false;
+}
+
+
 /* Emit code for a foreach statement.  We effectively emit code to run the
    set of n-dimensional nested loops corresponding to the dimensionality of
    the foreach statement along with the extra logic to deal with mismatches
@@ -1667,7 +1911,6 @@ ForeachStmt::EmitCode(FunctionEmitContext *ctx) const {
     if (ctx->GetCurrentBasicBlock() == NULL || stmts == NULL)
         return;
 
-    llvm::BasicBlock *bbFullBody = ctx->CreateBasicBlock("foreach_full_body");
     llvm::BasicBlock *bbMaskedBody = ctx->CreateBasicBlock("foreach_masked_body");
     llvm::BasicBlock *bbExit = ctx->CreateBasicBlock("foreach_exit");
 
@@ -1759,6 +2002,12 @@ ForeachStmt::EmitCode(FunctionEmitContext *ctx) const {
         ctx->StoreInst(LLVMMaskAllOn, extrasMaskPtrs[i]);
     }
 
+    // Choose between peeling off a copy of the body that runs with the
+    // mask all on and running the body with a mask for every iteration.
+    bool maskedOnly =
+        lForeachUseMaskedOnly(startVals[nDims-1], endVals[nDims-1],
+                              span[nDims-1], pos);
+
     ctx->StartForeach(FunctionEmitContext::FOREACH_REGULAR);
 
     // On to the outermost loop's test
@@ -1884,11 +2133,15 @@ ForeachStmt::EmitCode(FunctionEmitContext *ctx) const {
     // vector).
     llvm::BasicBlock *bbOuterInExtras =
         ctx->CreateBasicBlock("outer_in_extras");
-    llvm::BasicBlock *bbOuterNotInExtras =
+    llvm::BasicBlock *bbOuterNotInExtras = maskedOnly ? NULL :
         ctx->CreateBasicBlock("outer_not_in_extras");
 
     ctx->SetCurrentBasicBlock(bbTest[nDims-1]);
-    if (inExtras.size())
+    if (maskedOnly)
+        // Everything goes through the masked body; treat it as if the
+        // outer dimensions were always processing extra elements.
+        ctx->BranchInst(bbOuterInExtras);
+    else if (inExtras.size())
         ctx->BranchInst(bbOuterInExtras, bbOuterNotInExtras,
                         inExtras.back());
     else
@@ -1951,8 +2204,9 @@ ForeachStmt::EmitCode(FunctionEmitContext *ctx) const {
     ctx->SetCurrentBasicBlock(bbAllInnerPartialOuter); {
         llvm::Value *mask;
         if (nDims == 1)
-            // 1D loop; we shouldn't ever get here anyway
-            mask = LLVMMaskAllOff;
+            // 1D loop; we only get here if we're running all iterations
+            // masked.
+            mask = maskedOnly ? LLVMMaskAllOn : LLVMMaskAllOff;
         else
             mask = ctx->LoadInst(extrasMaskPtrs[nDims-2]);
 
@@ -1997,90 +2251,95 @@ ForeachStmt::EmitCode(FunctionEmitContext *ctx) const {
         ctx->BranchInst(bbMaskedBody, bbReset[nDims-1], atEnd);
     }
 
-    ///////////////////////////////////////////////////////////////////////////
-    // None of the outer dimensions is processing extras; along the lines
-    // of above, we can express this as:
-    // for (counter = start; counter < alignedEnd; counter += step) {
-    //   // mask is all on
-    //   // run loop body with mask all on
-    // }
-    // // counter == alignedEnd
-    // if (counter < end) {
-    //   // set mask to (counter+programCounter < end)
-    //   // run loop body with mask
-    // }
-    llvm::BasicBlock *bbPartialInnerAllOuter =
-        ctx->CreateBasicBlock("partial_inner_all_outer");
-    ctx->SetCurrentBasicBlock(bbOuterNotInExtras); {
-        llvm::Value *counter = ctx->LoadInst(uniformCounterPtrs[nDims-1], "counter");
-        llvm::Value *beforeAlignedEnd =
-            ctx->CmpInst(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLT,
-                         counter, alignedEnd[nDims-1], "before_aligned_end");
-        ctx->BranchInst(bbFullBody, bbPartialInnerAllOuter,
-                        beforeAlignedEnd);
-    }
-
-    ///////////////////////////////////////////////////////////////////////////
-    // full_body: do a full vector's worth of work.  We know that all
-    // lanes will be running here, so we explicitly set the mask to be 'all
-    // on'.  This ends up being relatively straightforward: just update the
-    // value of the varying loop counter and have the statements in the
-    // loop body emit their code.
-    llvm::BasicBlock *bbFullBodyContinue =
-        ctx->CreateBasicBlock("foreach_full_continue");
-    ctx->SetCurrentBasicBlock(bbFullBody); {
-        ctx->SetInternalMask(LLVMMaskAllOn);
-        ctx->SetBlockEntryMask(LLVMMaskAllOn);
-        lUpdateVaryingCounter(nDims-1, nDims, ctx, uniformCounterPtrs[nDims-1],
-                              dimVariables[nDims-1]->storagePtr, span);
-        ctx->SetContinueTarget(bbFullBodyContinue);
-        ctx->AddInstrumentationPoint("foreach loop body (all on)");
-        stmts->EmitCode(ctx);
-        AssertPos(pos, ctx->GetCurrentBasicBlock() != NULL);
-        ctx->BranchInst(bbFullBodyContinue);
-    }
-    ctx->SetCurrentBasicBlock(bbFullBodyContinue); {
-        ctx->RestoreContinuedLanes();
-        llvm::Value *counter = ctx->LoadInst(uniformCounterPtrs[nDims-1]);
-        llvm::Value *newCounter =
-            ctx->BinaryOperator(llvm::Instruction::Add, counter,
-                                LLVMInt32(span[nDims-1]), "new_counter");
-        ctx->StoreInst(newCounter, uniformCounterPtrs[nDims-1]);
-        ctx->BranchInst(bbOuterNotInExtras);
-    }
-
-    ///////////////////////////////////////////////////////////////////////////
-    // We're done running blocks with the mask all on; see if the counter is
-    // less than the end value, in which case we need to run the body one
-    // more time to get the extra bits.
-    llvm::BasicBlock *bbSetInnerMask =
-        ctx->CreateBasicBlock("partial_inner_only");
-    ctx->SetCurrentBasicBlock(bbPartialInnerAllOuter); {
-        llvm::Value *counter = ctx->LoadInst(uniformCounterPtrs[nDims-1], "counter");
-        llvm::Value *beforeFullEnd =
-            ctx->CmpInst(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLT,
-                         counter, endVals[nDims-1], "before_full_end");
-        ctx->BranchInst(bbSetInnerMask, bbReset[nDims-1], beforeFullEnd);
-    }
+    // The peeled path, taken when the mask is all on for the outer
+    // dimensions; it isn't emitted at all if all iterations run masked.
+    if (!maskedOnly) {
+        ///////////////////////////////////////////////////////////////////////
+        // None of the outer dimensions is processing extras; along the lines
+        // of above, we can express this as:
+        // for (counter = start; counter < alignedEnd; counter += step) {
+        //   // mask is all on
+        //   // run loop body with mask all on
+        // }
+        // // counter == alignedEnd
+        // if (counter < end) {
+        //   // set mask to (counter+programCounter < end)
+        //   // run loop body with mask
+        // }
+        llvm::BasicBlock *bbFullBody = ctx->CreateBasicBlock("foreach_full_body");
+        llvm::BasicBlock *bbPartialInnerAllOuter =
+            ctx->CreateBasicBlock("partial_inner_all_outer");
+        ctx->SetCurrentBasicBlock(bbOuterNotInExtras); {
+            llvm::Value *counter = ctx->LoadInst(uniformCounterPtrs[nDims-1], "counter");
+            llvm::Value *beforeAlignedEnd =
+                ctx->CmpInst(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLT,
+                             counter, alignedEnd[nDims-1], "before_aligned_end");
+            ctx->BranchInst(bbFullBody, bbPartialInnerAllOuter,
+                            beforeAlignedEnd);
+        }
 
-    ///////////////////////////////////////////////////////////////////////////
-    // The outer dimensions are all on, so the mask is just given by the
-    // mask for the innermost dimension
-    ctx->SetCurrentBasicBlock(bbSetInnerMask); {
-        llvm::Value *varyingCounter =
+        ///////////////////////////////////////////////////////////////////////
+        // full_body: do a full vector's worth of work.  We know that all
+        // lanes will be running here, so we explicitly set the mask to be 'all
+        // on'.  This ends up being relatively straightforward: just update the
+        // value of the varying loop counter and have the statements in the
+        // loop body emit their code.
+        llvm::BasicBlock *bbFullBodyContinue =
+            ctx->CreateBasicBlock("foreach_full_continue");
+        ctx->SetCurrentBasicBlock(bbFullBody); {
+            ctx->SetInternalMask(LLVMMaskAllOn);
+            ctx->SetBlockEntryMask(LLVMMaskAllOn);
             lUpdateVaryingCounter(nDims-1, nDims, ctx, uniformCounterPtrs[nDims-1],
                                   dimVariables[nDims-1]->storagePtr, span);
-        llvm::Value *smearEnd = ctx->BroadcastValue(
-            endVals[nDims-1], LLVMTypes::Int32VectorType, "smear_end");
-        llvm::Value *emask =
-            ctx->CmpInst(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLT,
-                         varyingCounter, smearEnd);
-        emask = ctx->I1VecToBoolVec(emask);
-        ctx->SetInternalMask(emask);
-        ctx->SetBlockEntryMask(emask);
+            ctx->SetContinueTarget(bbFullBodyContinue);
+            ctx->AddInstrumentationPoint("foreach loop body (all on)");
+            stmts->EmitCode(ctx);
+            AssertPos(pos, ctx->GetCurrentBasicBlock() != NULL);
+            ctx->BranchInst(bbFullBodyContinue);
+        }
+        ctx->SetCurrentBasicBlock(bbFullBodyContinue); {
+            ctx->RestoreContinuedLanes();
+            llvm::Value *counter = ctx->LoadInst(uniformCounterPtrs[nDims-1]);
+            llvm::Value *newCounter =
+                ctx->BinaryOperator(llvm::Instruction::Add, counter,
+                                    LLVMInt32(span[nDims-1]), "new_counter");
+            ctx->StoreInst(newCounter, uniformCounterPtrs[nDims-1]);
+            ctx->BranchInst(bbOuterNotInExtras);
+        }
 
-        ctx->StoreInst(LLVMFalse, stepIndexAfterMaskedBodyPtr);
-        ctx->BranchInst(bbMaskedBody);
+        ///////////////////////////////////////////////////////////////////////
+        // We're done running blocks with the mask all on; see if the counter is
+        // less than the end value, in which case we need to run the body one
+        // more time to get the extra bits.
+        llvm::BasicBlock *bbSetInnerMask =
+            ctx->CreateBasicBlock("partial_inner_only");
+        ctx->SetCurrentBasicBlock(bbPartialInnerAllOuter); {
+            llvm::Value *counter = ctx->LoadInst(uniformCounterPtrs[nDims-1], "counter");
+            llvm::Value *beforeFullEnd =
+                ctx->CmpInst(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLT,
+                             counter, endVals[nDims-1], "before_full_end");
+            ctx->BranchInst(bbSetInnerMask, bbReset[nDims-1], beforeFullEnd);
+        }
+
+        ///////////////////////////////////////////////////////////////////////
+        // The outer dimensions are all on, so the mask is just given by the
+        // mask for the innermost dimension
+        ctx->SetCurrentBasicBlock(bbSetInnerMask); {
+            llvm::Value *varyingCounter =
+                lUpdateVaryingCounter(nDims-1, nDims, ctx, uniformCounterPtrs[nDims-1],
+                                      dimVariables[nDims-1]->storagePtr, span);
+            llvm::Value *smearEnd = ctx->BroadcastValue(
+                endVals[nDims-1], LLVMTypes::Int32VectorType, "smear_end");
+            llvm::Value *emask =
+                ctx->CmpInst(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLT,
+                             varyingCounter, smearEnd);
+            emask = ctx->I1VecToBoolVec(emask);
+            ctx->SetInternalMask(emask);
+            ctx->SetBlockEntryMask(emask);
+
+            ctx->StoreInst(LLVMFalse, stepIndexAfterMaskedBodyPtr);
+            ctx->BranchInst(bbMaskedBody);
+        }
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -2096,10 +2355,14 @@ ForeachStmt::EmitCode(FunctionEmitContext *ctx) const {
     ctx->SetCurrentBasicBlock(bbMaskedBody); {
         ctx->AddInstrumentationPoint("foreach loop body (masked)");
         ctx->SetContinueTarget(bbMaskedBodyContinue);
-        ctx->DisableGatherScatterWarnings();
+        // Warnings about gathers and scatters have already been issued
+        // for the copy of the body in the full vector case, if any.
+        if (!maskedOnly)
+            ctx->DisableGatherScatterWarnings();
         ctx->SetBlockEntryMask(ctx->GetFullMask());
         stmts->EmitCode(ctx);
-        ctx->EnableGatherScatterWarnings();
+        if (!maskedOnly)
+            ctx->EnableGatherScatterWarnings();
         ctx->BranchInst(bbMaskedBodyContinue);
     }
     ctx->SetCurrentBasicBlock(bbMaskedBodyContinue); {
@@ -3586,7 +3849,9 @@ DeleteStmt::EmitCode(FunctionEmitContext *ctx) const {
         exprValue = ctx->BitCastInst(exprValue, LLVMTypes::VoidPointerType,
                                      "ptr_to_void");
         llvm::Function *func;
-        if (g->target->is32Bit()) {
+        if (g->newDeleteHooks) {
+            func = m->module->getFunction("__delete_uniform_hook");
+        } else if (g->target->is32Bit()) {
             func = m->module->getFunction("__delete_uniform_32rt");
         } else {
             func = m->module->getFunction("__delete_uniform_64rt");
@@ -3601,7 +3866,9 @@ DeleteStmt::EmitCode(FunctionEmitContext *ctx) const {
         // only need to extend to 64-bit values on 32-bit targets before
         // calling it.
         llvm::Function *func;
-        if (g->target->is32Bit()) {
+        if (g->newDeleteHooks) {
+            func = m->module->getFunction("__delete_varying_hook");
+        } else if (g->target->is32Bit()) {
             func = m->module->getFunction("__delete_varying_32rt");
         } else {
             func = m->module->getFunction("__delete_varying_64rt");
@@ -70,6 +70,7 @@
 #else // LLVM 3.3+
   #include <llvm/IR/DataLayout.h>
 #endif
+#include <llvm/Support/Timer.h>
 
 /** Returns the width of the terminal where the compiler is running.
     Finding this out may fail in a variety of reasonable situations (piping
@@ -657,3 +658,146 @@ VerifyDataLayoutCompatibility(const std::string &module_dl,
     return true;
 }
 
+
+///////////////////////////////////////////////////////////////////////////
+// CompilePhase
+
+static CompilePhase *lCurrentPhase = NULL;
+
+
+static double
+lWallTime() {
+    return llvm::TimeRecord::getCurrentTime().getWallTime();
+}
+
+
+CompilePhase::CompilePhase(const std::string &n)
+    : name(n) {
+    seconds = startTime = 0.;
+    runs = 0;
+    running = false;
+}
+
+
+/** Returns the root of the tree of phases, which just collects the
+    top-level phases. */
+CompilePhase *
+CompilePhase::root() {
+    static CompilePhase *rootPhase = NULL;
+    if (rootPhase == NULL)
+        rootPhase = new CompilePhase("ispc");
+    return rootPhase;
+}
+
+
+CompilePhase *
+CompilePhase::Get(const std::string &name) {
+    CompilePhase *parent = (lCurrentPhase != NULL) ? lCurrentPhase : root();
+    for (unsigned int i = 0; i < parent->children.size(); ++i)
+        if (parent->children[i]->name == name)
+            return parent->children[i];
+
+    CompilePhase *phase = new CompilePhase(name);
+    parent->children.push_back(phase);
+    return phase;
+}
+
+
+void
+CompilePhase::Start() {
+    startTime = lWallTime();
+    running = true;
+}
+
+
+void
+CompilePhase::Stop() {
+    if (!running)
+        return;
+    seconds += lWallTime() - startTime;
+    ++runs;
+    running = false;
+}
+
+
+/** Writes the given string as a JSON string literal. */
+static void
+lWriteJSONString(FILE *f, const std::string &str) {
+    fputc('"', f);
+    for (unsigned int i = 0; i < str.size(); ++i) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+
+void
+CompilePhase::write(FILE *f, int indent) const {
+    fprintf(f, "%*s{ \"name\": ", indent, "");
+    lWriteJSONString(f, name);
+    fprintf(f, ", \"seconds\": %.6f, \"runs\": %d", seconds, runs);
+    if (children.size() > 0) {
+        fprintf(f, ",\n%*s  \"children\": [\n", indent, "");
+        for (unsigned int i = 0; i < children.size(); ++i) {
+            children[i]->write(f, indent + 4);
+            fprintf(f, (i + 1 < children.size()) ? ",\n" : "\n");
+        }
+        fprintf(f, "%*s  ]\n%*s}", indent, "", indent, "");
+    }
+    else
+        fprintf(f, " }");
+}
+
+
+bool
+CompilePhase::WriteReport(const char *filename) {
+    FILE *f = stderr;
+    if (filename != NULL && (f = fopen(filename, "w")) == NULL) {
+        perror(filename);
+        return false;
+    }
+
+    // The root's time is the total of the top-level phases.
+    CompilePhase *top = root();
+    top->seconds = 0.;
+    for (unsigned int i = 0; i < top->children.size(); ++i)
+        top->seconds += top->children[i]->seconds;
+    top->runs = 1;
+
+    top->write(f, 0);
+    fprintf(f, "\n");
+    if (f != stderr)
+        fclose(f);
+    return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+// TimePhase
+
+TimePhase::TimePhase(const std::string &name) {
+    if (!g->timePasses) {
+        phase = savedCurrent = NULL;
+        return;
+    }
+
+    phase = CompilePhase::Get(name);
+    savedCurrent = lCurrentPhase;
+    lCurrentPhase = phase;
+    phase->Start();
+}
+
+
+TimePhase::~TimePhase() {
+    if (phase == NULL)
+        return;
+
+    phase->Stop();
+    lCurrentPhase = savedCurrent;
+}
@@ -170,4 +170,56 @@ void PrintWithWordBreaks(const char *buf, int indent, int columnWidth,
  */
 int TerminalWidth();
 
+/** @brief A phase of compilation whose running time is measured for
+    --time-passes.
+
+    Phases form a tree: a phase that is timed while another is being timed
+    with a TimePhase object is its child.  The times of all of the runs of
+    the phases with the same name and parent are added together.
+ */
+class CompilePhase {
+public:
+    /** Returns the child with the given name of the phase that is
+        currently being timed with a TimePhase object (or of the root of
+        the tree, if there isn't one), creating it if needed. */
+    static CompilePhase *Get(const std::string &name);
+
+    /** Starts and stops the clock for a run of this phase.  Stop() does
+        nothing if the clock isn't running. */
+    void Start();
+    void Stop();
+
+    /** Writes the tree of phases, as JSON, to the given file, or to
+        stderr if the filename is NULL.  Returns false if the file
+        couldn't be written. */
+    static bool WriteReport(const char *filename);
+
+private:
+    CompilePhase(const std::string &name);
+    static CompilePhase *root();
+    void write(FILE *f, int indent) const;
+
+    std::string name;
+    std::vector<CompilePhase *> children;
+    /** Total time of all of the completed runs, in seconds. */
+    double seconds;
+    /** Start time of the current run, if running is true. */
+    double startTime;
+    int runs;
+    bool running;
+};
+
+/** @brief Times the given phase of compilation, as a child of the
+    current one, from when the TimePhase is constructed until it is
+    destroyed.  It does nothing unless --time-passes was given. */
+class TimePhase {
+public:
+    TimePhase(const std::string &name);
+    ~TimePhase();
+
+private:
+    CompilePhase *phase;
+    CompilePhase *savedCurrent;
+};
+
 #endif // ISPC_UTIL_H